@@ -0,0 +1,90 @@
+#include "chip8.h"
+
+// Audio rendering
+//   Everything the SDL frontend's audio callback does short of asking SDL for the time, so it can
+//   be run without SDL. Times are in ticks of a host clock running at freq ticks per second (the
+//   performance counter in the frontend).
+
+// Set up the audio engine for a device playing sample_rate samples per second, buffer_samples at a
+//   time, with a host clock of freq ticks per second: silent, empty queue, tone off
+void audio_init(audio_t *audio, const int64_t sample_rate, const int64_t freq, const uint32_t buffer_samples,
+                const uint32_t square_wave_freq, const int16_t volume) {
+    memset(audio->events, 0, sizeof audio->events);
+    atomic_init(&audio->head, 0);
+    atomic_init(&audio->tail, 0);
+    atomic_init(&audio->volume, volume);
+
+    // 1 square wave cycle in the pattern, high for the first half, stepped through at the
+    //   pattern's 128 bits per cycle; phase is in 1/2^25ths of a bit
+    memset(audio->pattern, 0, sizeof audio->pattern);
+    memset(audio->pattern, 0xFF, sizeof audio->pattern / 2);
+    audio->phase = 0;
+    audio->phase_step = (uint32_t)((double)square_wave_freq * 128 / sample_rate * (1u << 25));
+    audio->on = false;
+    audio->gain = 0;
+    audio->base = 0;
+    audio->samples = 0;
+    audio->delay = freq * buffer_samples * 5 / 4 / sample_rate;
+    audio->sample_rate = sample_rate;
+    audio->freq = freq;
+}
+
+// Queue a sound on/off change for the audio callback, stamped with its host clock time; false if
+//   the queue is full
+bool queue_sound(audio_t *audio, const uint64_t time, const bool on) {
+    const uint32_t head = atomic_load(&audio->head);
+    if (head - atomic_load(&audio->tail) == SOUND_QUEUE_SIZE) return false;
+
+    audio->events[head % SOUND_QUEUE_SIZE] = (sound_event_t){ .time = time, .on = on };
+    atomic_store(&audio->head, head + 1);
+    return true;
+}
+
+// Fill out count samples of audio, the first of them played at host clock time now
+void render_audio(audio_t *audio, int16_t *samples, const int32_t count, const int64_t now) {
+    const int32_t volume = atomic_load(&audio->volume);
+
+    // Samples are timed from base on; start that clock over from now whenever it is off from the
+    //   host clock by more than a few buffers (first callback, device stalled or drifted)
+    const int64_t start = audio->base + audio->samples * audio->freq / audio->sample_rate;
+    if (audio->base == 0 || llabs(start - now) > audio->delay * 4) {
+        audio->base = now;
+        audio->samples = 0;
+    }
+
+    for (int32_t i = 0; i < count; ) {
+        // Render up to the next queued change if it falls in this buffer, else to the end
+        int32_t end = count;
+        const uint32_t tail = atomic_load(&audio->tail);
+        const bool change = (tail != atomic_load(&audio->head));
+        if (change) {
+            const sound_event_t *event = &audio->events[tail % SOUND_QUEUE_SIZE];
+            const int64_t at = ((int64_t)event->time + audio->delay - audio->base) *
+                               audio->sample_rate / audio->freq - audio->samples;
+            if (at < count) end = (at > i) ? at : i;
+        }
+
+        // Square wave (pattern) at the current volume, faded in or out over SOUND_RAMP_SAMPLES
+        for (; i < end; i++) {
+            if (audio->on && audio->gain < SOUND_RAMP_SAMPLES) audio->gain++;
+            else if (!audio->on && audio->gain > 0) audio->gain--;
+
+            const uint32_t bit = audio->phase >> 25;
+            const bool high = (audio->pattern[bit / 8] << (bit % 8)) & 0x80;
+            samples[i] = (high ? volume : -volume) * audio->gain / SOUND_RAMP_SAMPLES;
+            audio->phase += audio->phase_step;
+        }
+
+        if (change && end < count) {
+            audio->on = audio->events[tail % SOUND_QUEUE_SIZE].on;
+            atomic_store(&audio->tail, tail + 1);
+        }
+    }
+
+    // Keep the sample count small, 1 second at a time
+    audio->samples += count;
+    while (audio->samples >= audio->sample_rate) {
+        audio->samples -= audio->sample_rate;
+        audio->base += audio->freq;
+    }
+}
@@ -0,0 +1,420 @@
+#define _DEFAULT_SOURCE   // strdup, sysconf
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8.h"
+
+// Batch runner: runs every entry of a manifest headless, spread over a work stealing thread pool,
+//   and prints 1 CSV result line per run (in manifest order) to stdout.
+//   Given a directory instead, runs every ROM in it under each extension.
+//
+// Manifest format, 1 run per line; blank lines and lines starting with # are skipped:
+//   <rom_path> [chip8|superchip|xochip] [frames] [golden display hash]
+// Missing fields default to chip8 quirks and --max-frames (or 600) frames. Runs with a golden hash
+//   are conformance checks: ending with any other display is a mismatch, and fails the batch.
+//   --write-golden FILE writes the results as such a manifest, to check later runs against.
+
+#define MANIFEST_LINE_MAX 4096
+
+// 1 manifest entry and its results
+typedef struct {
+    char *rom_name;
+    extension_t extension;
+    uint64_t max_frames;
+    bool has_golden;        // Golden hash given, the run must end with that display
+    uint64_t golden_hash;
+
+    bool ok;                // ROM loaded and ran
+    uint64_t frames;        // Frames run
+    uint64_t insts;         // Instructions run
+    uint64_t display_hash;  // Final framebuffer hash
+    uint16_t PC;
+    uint16_t I;
+    uint8_t V[16];
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+} batch_job_t;
+
+// Per worker queue of job indexes; the owner takes jobs from the head, idle workers steal from the tail
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t head;
+    uint32_t tail;
+} job_queue_t;
+
+// Shared by all workers
+typedef struct {
+    batch_job_t *jobs;
+    job_queue_t *queues;
+    uint32_t num_workers;
+    config_t config;
+} batch_t;
+
+typedef struct {
+    batch_t *batch;
+    uint32_t id;
+} worker_t;
+
+static const char *extension_names[] = {
+    [CHIP8]     = "chip8",
+    [SUPERCHIP] = "superchip",
+    [XOCHIP]    = "xochip",
+};
+
+static double host_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Parse a quirks/extension name
+static bool parse_extension(const char *name, extension_t *extension) {
+    for (extension_t i = CHIP8; i <= XOCHIP; i++)
+        if (strcmp(name, extension_names[i]) == 0) {
+            *extension = i;
+            return true;    // Success
+        }
+
+    return false;
+}
+
+// Read all manifest entries into a newly allocated job array
+static bool load_manifest(const char *manifest_name, const uint64_t default_frames,
+                          batch_job_t **jobs_out, uint32_t *num_jobs_out) {
+    FILE *manifest = fopen(manifest_name, "r");
+    if (!manifest) {
+        fprintf(stderr, "Manifest file %s is invalid or does not exist\n", manifest_name);
+        return false;
+    }
+
+    batch_job_t *jobs = NULL;
+    uint32_t num_jobs = 0;
+    uint32_t line_num = 0;
+    char line[MANIFEST_LINE_MAX];
+
+    while (fgets(line, sizeof line, manifest)) {
+        line_num++;
+
+        const char *rom_name = strtok(line, " \t\r\n");
+        if (!rom_name || rom_name[0] == '#') continue;  // Blank line or comment
+
+        batch_job_t job = {
+            .extension = CHIP8,
+            .max_frames = default_frames,
+        };
+
+        const char *field = strtok(NULL, " \t\r\n");
+        if (field && !parse_extension(field, &job.extension)) {
+            fprintf(stderr, "%s:%u: unknown extension %s\n", manifest_name, line_num, field);
+            goto error;
+        }
+
+        field = strtok(NULL, " \t\r\n");
+        if (field) job.max_frames = strtoull(field, NULL, 10);
+
+        field = strtok(NULL, " \t\r\n");
+        if (field) {
+            char *end;
+            job.golden_hash = strtoull(field, &end, 16);
+            job.has_golden = true;
+            if (*end) {
+                fprintf(stderr, "%s:%u: invalid golden hash %s\n", manifest_name, line_num, field);
+                goto error;
+            }
+        }
+
+        batch_job_t *new_jobs = realloc(jobs, (num_jobs + 1) * sizeof *jobs);
+        if (!new_jobs || !(job.rom_name = strdup(rom_name))) {
+            if (new_jobs) jobs = new_jobs;
+            fprintf(stderr, "Out of memory reading manifest\n");
+            goto error;
+        }
+
+        jobs = new_jobs;
+        jobs[num_jobs++] = job;
+    }
+
+    fclose(manifest);
+    *jobs_out = jobs;
+    *num_jobs_out = num_jobs;
+    return true;    // Success
+
+error:
+    for (uint32_t i = 0; i < num_jobs; i++) free(jobs[i].rom_name);
+    free(jobs);
+    fclose(manifest);
+    return false;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Make a job of every file in a directory (in name order) under each extension
+static bool load_directory(const char *dir_name, const uint64_t default_frames,
+                           batch_job_t **jobs_out, uint32_t *num_jobs_out) {
+    DIR *dir = opendir(dir_name);
+    if (!dir) {
+        fprintf(stderr, "ROM directory %s is invalid or does not exist\n", dir_name);
+        return false;
+    }
+
+    char **names = NULL;
+    uint32_t num_names = 0;
+    for (struct dirent *entry; (entry = readdir(dir)); ) {
+        if (entry->d_name[0] == '.') continue;  // Hidden files, . and ..
+
+        const size_t size = strlen(dir_name) + strlen(entry->d_name) + 2;
+        char *name = malloc(size);
+        char **new_names = realloc(names, (num_names + 1) * sizeof *names);
+        if (!name || !new_names) {
+            free(name);
+            if (new_names) names = new_names;
+            fprintf(stderr, "Out of memory reading ROM directory\n");
+            goto error;
+        }
+        names = new_names;
+        snprintf(name, size, "%s/%s", dir_name, entry->d_name);
+
+        struct stat info;
+        if (stat(name, &info) != 0 || !S_ISREG(info.st_mode)) {
+            free(name);
+            continue;
+        }
+        names[num_names++] = name;
+    }
+    closedir(dir);
+    dir = NULL;
+    qsort(names, num_names, sizeof *names, compare_names);
+
+    batch_job_t *jobs = calloc(num_names * (XOCHIP + 1) + 1, sizeof *jobs);
+    if (!jobs) {
+        fprintf(stderr, "Out of memory reading ROM directory\n");
+        goto error;
+    }
+
+    uint32_t num_jobs = 0;
+    for (uint32_t i = 0; i < num_names; i++)
+        for (extension_t extension = CHIP8; extension <= XOCHIP; extension++)
+            jobs[num_jobs++] = (batch_job_t){
+                .rom_name = extension == CHIP8 ? names[i] : strdup(names[i]),
+                .extension = extension,
+                .max_frames = default_frames,
+            };
+
+    for (uint32_t i = 0; i < num_jobs; i++)
+        if (!jobs[i].rom_name) {
+            fprintf(stderr, "Out of memory reading ROM directory\n");
+            for (uint32_t j = 0; j < num_jobs; j++) free(jobs[j].rom_name);
+            free(jobs);
+            free(names);
+            return false;
+        }
+
+    free(names);
+    *jobs_out = jobs;
+    *num_jobs_out = num_jobs;
+    return true;    // Success
+
+error:
+    for (uint32_t i = 0; i < num_names; i++) free(names[i]);
+    free(names);
+    if (dir) closedir(dir);
+    return false;
+}
+
+// Run 1 manifest entry on its own machine
+static void run_job(batch_job_t *job, config_t config) {
+    chip8_t *chip8 = calloc(1, sizeof *chip8);
+    if (!chip8) return;
+
+    config.current_extension = job->extension;
+    config.max_frames = job->max_frames;
+
+    if (init_chip8(chip8, config, job->rom_name)) {
+        run_until_limit(chip8, config, NULL, &job->frames, &job->insts);
+
+        job->ok = true;
+        job->display_hash = display_hash(chip8);
+        job->PC = chip8->PC;
+        job->I = chip8->I;
+        memcpy(job->V, chip8->V, sizeof job->V);
+        job->delay_timer = read_delay_timer(chip8);
+        job->sound_timer = read_sound_timer(chip8);
+    }
+
+    jit_destroy(chip8);
+    free(chip8);
+}
+
+// Next job for a worker: from its own queue first, otherwise stolen from another worker's queue.
+//   No jobs are added once the workers start, so all queues empty means all work is handed out
+static bool next_job(batch_t *batch, const uint32_t id, uint32_t *job) {
+    job_queue_t *own = &batch->queues[id];
+
+    pthread_mutex_lock(&own->lock);
+    const bool found = own->head < own->tail;
+    if (found) *job = own->head++;
+    pthread_mutex_unlock(&own->lock);
+    if (found) return true;
+
+    for (uint32_t i = 1; i < batch->num_workers; i++) {
+        job_queue_t *victim = &batch->queues[(id + i) % batch->num_workers];
+
+        pthread_mutex_lock(&victim->lock);
+        const bool stolen = victim->head < victim->tail;
+        if (stolen) *job = --victim->tail;
+        pthread_mutex_unlock(&victim->lock);
+        if (stolen) return true;
+    }
+
+    return false;
+}
+
+static void *worker_main(void *arg) {
+    const worker_t *worker = arg;
+    uint32_t job;
+
+    while (next_job(worker->batch, worker->id, &job))
+        run_job(&worker->batch->jobs[job], worker->batch->config);
+
+    return NULL;
+}
+
+// Print results as CSV, 1 line per manifest entry
+static void print_results(const batch_job_t *jobs, const uint32_t num_jobs) {
+    printf("rom,extension,status,frames,instructions,display_hash,PC,I,DT,ST,V\n");
+
+    for (uint32_t i = 0; i < num_jobs; i++) {
+        const batch_job_t *job = &jobs[i];
+
+        const char *status = !job->ok ? "error" :
+                             (job->has_golden && job->display_hash != job->golden_hash) ? "mismatch" : "ok";
+        printf("%s,%s,%s", job->rom_name, extension_names[job->extension], status);
+        if (job->ok) {
+            printf(",%llu,%llu,0x%016llX,0x%04X,0x%04X,0x%02X,0x%02X,",
+                   (long long unsigned)job->frames, (long long unsigned)job->insts,
+                   (long long unsigned)job->display_hash, job->PC, job->I,
+                   job->delay_timer, job->sound_timer);
+            for (uint8_t j = 0; j < 16; j++) printf("%02X", job->V[j]);
+        } else {
+            printf(",,,,,,,,");
+        }
+        printf("\n");
+    }
+}
+
+// Write results as a manifest with golden hashes, for later runs to be checked against
+static bool write_golden(const char *golden_name, const batch_job_t *jobs, const uint32_t num_jobs) {
+    FILE *golden = fopen(golden_name, "w");
+    if (!golden) {
+        fprintf(stderr, "Could not open golden file %s for writing\n", golden_name);
+        return false;
+    }
+
+    fprintf(golden, "# <rom_path> <extension> <frames> <golden display hash>\n");
+    for (uint32_t i = 0; i < num_jobs; i++)
+        if (jobs[i].ok)
+            fprintf(golden, "%s %s %llu %016llX\n", jobs[i].rom_name, extension_names[jobs[i].extension],
+                    (long long unsigned)jobs[i].max_frames, (long long unsigned)jobs[i].display_hash);
+
+    if (ferror(golden) | (fclose(golden) != 0)) {
+        fprintf(stderr, "Could not write golden file %s\n", golden_name);
+        return false;
+    }
+
+    return true;    // Success
+}
+
+int main(int argc, char **argv) {
+    // Default Usage message for args
+    if (argc < 2) {
+       fprintf(stderr, "Usage: %s <manifest|rom_dir> [--threads N] [--max-frames N] [--max-insts N] [--jit] "
+                       "[--write-golden FILE]\n", argv[0]);
+       exit(EXIT_FAILURE);
+    }
+
+    // Emulator options shared by all runs
+    batch_t batch = {0};
+    if (!set_config_from_args(&batch.config, argc, argv)) exit(EXIT_FAILURE);
+    batch.config.headless = true;
+    batch.config.rng_seed = 0;  // Fixed default seed so runs are repeatable
+
+    // Default to 1 worker per host core
+    long num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *golden_name = NULL;
+    for (int i = 2; i < argc; i++)
+        if (strncmp(argv[i], "--threads", strlen("--threads")) == 0) {
+            if (++i >= argc) exit(EXIT_FAILURE);
+            num_workers = strtol(argv[i], NULL, 10);
+        } else if (strncmp(argv[i], "--write-golden", strlen("--write-golden")) == 0) {
+            if (++i >= argc) exit(EXIT_FAILURE);
+            golden_name = argv[i];
+        }
+
+    uint32_t num_jobs = 0;
+    const uint64_t default_frames = batch.config.max_frames ? batch.config.max_frames : 600;
+    struct stat info;
+    const bool is_dir = (stat(argv[1], &info) == 0 && S_ISDIR(info.st_mode));
+    if (!(is_dir ? load_directory : load_manifest)(argv[1], default_frames, &batch.jobs, &num_jobs))
+        exit(EXIT_FAILURE);
+
+    if (num_workers < 1) num_workers = 1;
+    if ((uint32_t)num_workers > num_jobs) num_workers = num_jobs ? num_jobs : 1;
+    batch.num_workers = num_workers;
+
+    // Split jobs into even contiguous ranges, 1 per worker queue
+    batch.queues = calloc(batch.num_workers, sizeof *batch.queues);
+    pthread_t *threads = calloc(batch.num_workers, sizeof *threads);
+    worker_t *workers = calloc(batch.num_workers, sizeof *workers);
+    if (!batch.queues || !threads || !workers) exit(EXIT_FAILURE);
+
+    for (uint32_t i = 0; i < batch.num_workers; i++) {
+        pthread_mutex_init(&batch.queues[i].lock, NULL);
+        batch.queues[i].head = (uint64_t)num_jobs * i / batch.num_workers;
+        batch.queues[i].tail = (uint64_t)num_jobs * (i + 1) / batch.num_workers;
+        workers[i] = (worker_t){ .batch = &batch, .id = i };
+    }
+
+    const double start_time = host_seconds();
+
+    // Worker 0 runs on this thread
+    for (uint32_t i = 1; i < batch.num_workers; i++)
+        if (pthread_create(&threads[i], NULL, worker_main, &workers[i]) != 0) {
+            fprintf(stderr, "Could not create worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    worker_main(&workers[0]);
+    for (uint32_t i = 1; i < batch.num_workers; i++) pthread_join(threads[i], NULL);
+
+    const double elapsed = host_seconds() - start_time;
+
+    print_results(batch.jobs, num_jobs);
+    bool ok = !golden_name || write_golden(golden_name, batch.jobs, num_jobs);
+
+    // Summary
+    uint32_t failed = 0;
+    uint32_t mismatched = 0;
+    uint64_t insts = 0;
+    for (uint32_t i = 0; i < num_jobs; i++) {
+        if (!batch.jobs[i].ok) failed++;
+        else if (batch.jobs[i].has_golden && batch.jobs[i].display_hash != batch.jobs[i].golden_hash) mismatched++;
+        insts += batch.jobs[i].insts;
+    }
+    fprintf(stderr, "%u runs, %u failed, %u mismatched, %u threads, %.3f seconds, %.3f mips\n",
+            num_jobs, failed, mismatched, batch.num_workers, elapsed, elapsed > 0 ? insts / elapsed / 1e6 : 0.0);
+    ok &= !failed && !mismatched;
+
+    for (uint32_t i = 0; i < batch.num_workers; i++) pthread_mutex_destroy(&batch.queues[i].lock);
+    for (uint32_t i = 0; i < num_jobs; i++) free(batch.jobs[i].rom_name);
+    free(batch.jobs);
+    free(batch.queues);
+    free(threads);
+    free(workers);
+
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,353 @@
+#include <time.h>
+
+#include "chip8.h"
+
+// Instruction throughput benchmark
+//   Writes a corpus of synthetic ROMs, each hammering 1 kind of work in an endless loop, then runs
+//   every ROM of it and any real ROMs given for a fixed number of instructions on each CPU engine,
+//   headless with idle skipping off, and times the render path (changed rows + phosphor fade, as
+//   the frontend does each present minus the texture upload) and the fade on its own.
+//   Prints 1 JSON object per line: MIPS, ns per instruction and frames per second for each
+//   ROM/engine, ns per frame and frames per second for render/fade. Exits with failure if the
+//   engines don't agree on where a ROM ends up (display, PC, I and registers).
+
+#define DEFAULT_INSTS 20000000
+#define DEFAULT_IPS 600000      // 10000 instructions a frame, so frame overhead doesn't dominate
+#define RENDER_FRAMES 600       // Frames recorded from the sprite storm to render
+#define RENDER_PASSES 50        // Times they are all rendered
+
+// Synthetic ROM, CHIP8 code loaded at 0x200
+typedef struct {
+    const char *name;
+    extension_t extension;
+    uint16_t code[40];
+    uint32_t length;    // Instructions in code
+} synthetic_rom_t;
+
+// CPU only ROMs show their results: every 256 times around the loop (VE counting), they clear
+//   the screen and draw their registers and the RAM they work on as sprite rows at VD,VD (0,0),
+//   so the final display is a check of what they computed
+static const synthetic_rom_t synthetic_roms[] = {
+    // 8XYN ALU ops back to back
+    { "alu", CHIP8, {
+        0x6001, 0x6103, 0x6207,         // V0 = 1, V1 = 3, V2 = 7
+        0x8014, 0x8125, 0x8231, 0x8302, // 0x206: V0 += V1, V1 -= V2, V2 |= V3, V3 &= V0
+        0x8413, 0x8506, 0x860E, 0x8717, //        V4 ^= V1, V5 >>= 1, V6 <<= 1, V7 = V1 - V7
+        0x8804, 0x7301,                 //        V8 += V0, V3 += 1
+        0x7E01, 0x3E00, 0x1206,         //        loop, 256 times
+        0x00E0, 0xA380, 0xF855,         // Show V0-V8
+        0xA380, 0xDDD9, 0x1206,
+    }, 22 },
+    // DXYN sprite storm; SUPERCHIP, as CHIP8 waits for the display after every draw
+    { "sprites", SUPERCHIP, {
+        0xA000, 0x6000, 0x6100,         // I = font 0, V0 = V1 = 0
+        0xD015, 0x7005, 0xD015, 0x7103, // 0x206: draw, move right, draw, move down
+        0xD01F, 0xF029, 0x7201, 0x1206, //        draw 15 rows, I = font V0, V2 += 1, loop
+    }, 11 },
+    // FX55/FX65 memory traffic; I is set again every time, CHIP8 FX55/FX65 move it
+    { "memory", CHIP8, {
+        0x6011, 0x6122, 0x6233, 0x6C08, // V0 = 0x11, V1 = 0x22, V2 = 0x33, VC = 8
+        0xA300, 0xF755, 0xA300, 0xF765, // 0x208: store/load V0-V7 at 0x300
+        0xA310, 0xFF55, 0xA310, 0xFF65, //        store/load V0-VF at 0x310
+        0x7001,                         //        V0 += 1
+        0x7E01, 0x3E00, 0x1208,         //        loop, 256 times
+        0x00E0, 0xA300, 0xDDDF,         // Show 0x300-0x31D, at 0,0 and 8,0
+        0xA30F, 0xDCDF, 0x1208,
+    }, 22 },
+    // 2NNN/00EE call chain 3 deep
+    { "calls", CHIP8, {
+        0x2220, 0x7101,                 // Call sub1, V1 += 1
+        0x7E01, 0x3E64, 0x1200,         // loop, 100 times, as 256 would show only zeros
+        0x6E00, 0x00E0, 0xA380,         // Show V0-V4
+        0xF455, 0xA380, 0xDDD5, 0x1200,
+        0x0000, 0x0000, 0x0000,         // Padding
+        0x0000,
+        0x2226, 0x7202, 0x00EE,         // 0x220 sub1: call sub2, V2 += 2, return
+        0x222C, 0x7303, 0x00EE,         // 0x226 sub2: call sub3, V3 += 3, return
+        0x7405, 0x00EE,                 // 0x22C sub3: V4 += 5, return
+    }, 24 },
+    // Self modifying code: each time around, rewrite the instruction about to run
+    { "selfmod", CHIP8, {
+        0x6071, 0x6C08,                 // V0 = 0x71, opcode high byte of 71NN (V1 += NN); VC = 8
+        0xA20C, 0xF155, 0x7101,         // 0x204: I = 0x20C, write V0,V1 (71 V1) there, V1 += 1
+        0x6300, 0x7100,                 //        V3 = 0, 0x20C: V1 += (rewritten)
+        0x7E01, 0x3E00, 0x1204,         //        loop, 256 times
+        0x00E0, 0xA380, 0xF355,         // Show V0-V3, and the rewritten instruction at 8,0
+        0xA380, 0xDDD4, 0xA20C,
+        0xDCD2, 0x1204,
+    }, 18 },
+    // Running off the end of RAM, which wraps around to 0x000: falling through 0xFFE, and BNNN
+    //   past 0xFFF; a jump back is written at 0x000 and 0x002 first. Draws its counters
+    { "wrap", CHIP8, {
+        0x6012, 0x6116, 0x6212, 0x6320, // V0-V3 = 12 16 12 20: JP 0x216, JP 0x220
+        0xA000, 0xF355,                 // Write them at 0x000
+        0x6075, 0x6101, 0xAFFE, 0xF155, // Write 7501 (V5 += 1) at 0xFFE
+        0x1FFE,                         // 0x214: V5 += 1 at 0xFFE, then on at 0x000
+        0x6003, 0xBFFF,                 // 0x216: PC = 3 + 0xFFF, on at 0x002
+        0x0000, 0x0000, 0x0000,         //        Padding
+        0x7601, 0x00E0,                 // 0x220: V6 += 1, clear screen
+        0xA300, 0xF533, 0xF265,         //        V0-V2 = BCD digits of V5
+        0x6A00, 0x6B00,                 //        At 0,0:
+        0xF029, 0xDAB5, 0x7A05,         //        draw each digit
+        0xF129, 0xDAB5, 0x7A05,
+        0xF229, 0xDAB5,
+        0x1214,                         //        loop
+    }, 32 },
+};
+
+#define NUM_SYNTHETIC_ROMS (sizeof synthetic_roms / sizeof synthetic_roms[0])
+
+// CPU engines every ROM is run on; profiled ones count into a profile as they run, for the
+//   profiler's overhead
+static const struct {
+    const char *name;
+    engine_t engine;
+    bool fuse;
+    bool profile;
+} engines[] = {
+#ifdef SWITCH_DISPATCH
+    { "switch",            INTERPRETER, false, false },
+    { "switch-profiled",   INTERPRETER, false, true },
+#else
+    { "threaded",          INTERPRETER, true,  false },
+    { "threaded-nofuse",   INTERPRETER, false, false },
+    { "threaded-profiled", INTERPRETER, true,  true },
+#endif
+    { "jit",               JIT,         true,  false },
+};
+
+#define NUM_ENGINES (sizeof engines / sizeof engines[0])
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Write a synthetic ROM to dir/name.ch8, returns the path or NULL on error
+static char *write_synthetic_rom(const synthetic_rom_t *rom, const char dir[]) {
+    const size_t size = strlen(dir) + strlen(rom->name) + sizeof "/.ch8";
+    char *path = malloc(size);
+    if (!path) return NULL;
+    snprintf(path, size, "%s/%s.ch8", dir, rom->name);
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not open %s for writing, does %s exist?\n", path, dir);
+        free(path);
+        return NULL;
+    }
+
+    // Big endian, as CHIP8 fetches them
+    for (uint32_t i = 0; i < rom->length; i++) {
+        fputc(rom->code[i] >> 8, file);
+        fputc(rom->code[i] & 0xFF, file);
+    }
+
+    if (ferror(file) | (fclose(file) != 0)) {
+        fprintf(stderr, "Could not write %s\n", path);
+        free(path);
+        return NULL;
+    }
+
+    return path;
+}
+
+// Name of a ROM for reports, its file name without the directory
+static const char *rom_label(const char path[]) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+// Hash of where a machine ended up: display, PC, I and registers (FNV-1a over the display hash)
+static uint64_t state_hash(const chip8_t *chip8) {
+    uint64_t hash = display_hash(chip8);
+    const uint8_t regs[] = { chip8->PC >> 8, chip8->PC & 0xFF, chip8->I >> 8, chip8->I & 0xFF };
+
+    for (uint8_t i = 0; i < sizeof regs; i++) hash = (hash ^ regs[i]) * 0x100000001B3ULL;
+    for (uint8_t i = 0; i < 16; i++) hash = (hash ^ chip8->V[i]) * 0x100000001B3ULL;
+    return hash;
+}
+
+// Run a ROM on 1 engine for config.max_insts instructions and print its throughput;
+//   returns the state hash it ended with, 0 if it could not be loaded
+static uint64_t bench_rom(chip8_t *chip8, config_t config, const char path[], const uint32_t engine) {
+    config.engine = engines[engine].engine;
+    config.fuse = engines[engine].fuse;
+    if (!init_chip8(chip8, config, path)) return 0;
+
+    // A new machine has nothing decoded yet, as profiling needs
+    profile_t *profile = NULL;
+    if (engines[engine].profile) {
+        profile = calloc(1, sizeof *profile);
+        if (!profile) return 0;
+        chip8->profile = profile;
+    }
+
+    uint64_t frames, insts;
+    const double start_time = now_seconds();
+    run_until_limit(chip8, config, NULL, &frames, &insts);
+    const double seconds = now_seconds() - start_time;
+
+    chip8->profile = NULL;
+    free(profile);
+
+    printf("{\"case\": \"%s\", \"engine\": \"%s\", \"extension\": %u, \"insts\": %llu, \"frames\": %llu, "
+           "\"seconds\": %.6f, \"mips\": %.2f, \"ns_per_inst\": %.3f, \"frames_per_second\": %.0f, "
+           "\"state_hash\": \"0x%016llX\"}\n",
+           rom_label(path), engines[engine].name, config.current_extension, (long long unsigned)insts,
+           (long long unsigned)frames, seconds, insts / seconds / 1e6, seconds * 1e9 / insts,
+           frames / seconds, (long long unsigned)state_hash(chip8));
+    fflush(stdout);
+
+    const uint64_t hash = state_hash(chip8);
+    return hash ? hash : 1;
+}
+
+// Run a ROM on every engine; false if they disagree
+static bool bench_engines(chip8_t *chip8, const config_t config, const char path[]) {
+    uint64_t expected = 0;
+    bool ok = true;
+
+    for (uint32_t engine = 0; engine < NUM_ENGINES; engine++) {
+        const uint64_t hash = bench_rom(chip8, config, path, engine);
+        if (!hash) return false;
+
+        if (!expected) expected = hash;
+        if (hash != expected) {
+            fprintf(stderr, "%s: %s ended in a different state than %s\n",
+                    rom_label(path), engines[engine].name, engines[0].name);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+// Time the render and fade paths over frames recorded from a ROM
+static bool bench_render(chip8_t *chip8, config_t config, const char path[]) {
+    static uint64_t displays[RENDER_FRAMES][32];
+    static uint32_t dirty_rows[RENDER_FRAMES];
+    static uint32_t pixel_color[64*32];
+
+    // Record what the display looked like after each frame and which rows were drawn to
+    config.engine = INTERPRETER;
+    if (!init_chip8(chip8, config, path)) return false;
+    for (uint32_t frame = 0; frame < RENDER_FRAMES; frame++) {
+        emulate_frame(chip8, config);
+        update_timers(chip8);
+        memcpy(displays[frame], chip8->display, sizeof displays[frame]);
+        dirty_rows[frame] = chip8->dirty_rows;
+        chip8->dirty_rows = 0;
+    }
+
+    // Render: the rows that changed since the last present, and the rows still fading from before
+    for (uint32_t i = 0; i < 64*32; i++) pixel_color[i] = config.bg_color;
+    memset(chip8->presented, 0, sizeof chip8->presented);
+    uint64_t fading_rows = 0;
+    uint64_t rendered_rows = 0;
+    double start_time = now_seconds();
+    for (uint32_t pass = 0; pass < RENDER_PASSES; pass++) {
+        for (uint32_t frame = 0; frame < RENDER_FRAMES; frame++) {
+            memcpy(chip8->display, displays[frame], sizeof chip8->display);
+            chip8->dirty_rows = dirty_rows[frame];
+
+            const uint64_t rows = take_changed_rows(chip8) | fading_rows;
+            fading_rows = fade_pixels(FADE_AUTO, pixel_color, chip8->display, 64, 32, rows,
+                                      config.fg_color, config.bg_color, config.color_lerp_rate);
+            rendered_rows += __builtin_popcountll(rows);
+        }
+    }
+    double seconds = now_seconds() - start_time;
+    const uint32_t frames = RENDER_FRAMES * RENDER_PASSES;
+
+    printf("{\"case\": \"render\", \"rom\": \"%s\", \"frames\": %u, \"rows_per_frame\": %.2f, "
+           "\"seconds\": %.6f, \"ns_per_frame\": %.1f, \"frames_per_second\": %.0f}\n",
+           rom_label(path), frames, (double)rendered_rows / frames, seconds, seconds * 1e9 / frames,
+           frames / seconds);
+
+    // Fade: every row, every frame, as when the whole screen is fading
+    start_time = now_seconds();
+    for (uint32_t pass = 0; pass < RENDER_PASSES; pass++)
+        for (uint32_t frame = 0; frame < RENDER_FRAMES; frame++)
+            fade_pixels(FADE_AUTO, pixel_color, displays[frame], 64, 32, UINT32_MAX,
+                        config.fg_color, config.bg_color, config.color_lerp_rate);
+    seconds = now_seconds() - start_time;
+
+    printf("{\"case\": \"fade\", \"rom\": \"%s\", \"frames\": %u, \"rows_per_frame\": 32, "
+           "\"seconds\": %.6f, \"ns_per_frame\": %.1f, \"frames_per_second\": %.0f}\n",
+           rom_label(path), frames, seconds, seconds * 1e9 / frames, frames / seconds);
+    fflush(stdout);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    config_t config = {0};
+    if (!set_config_from_args(&config, argc, argv)) {
+       fprintf(stderr, "Usage: %s [--insts N] [--corpus DIR] [--write-corpus] [--ips N] [--roms rom_name...]\n", argv[0]);
+       exit(EXIT_FAILURE);
+    }
+    config.headless = true;
+    config.idle_skip = false;   // Run every instruction, or there is nothing to measure
+    config.insts_per_second = DEFAULT_IPS;
+    config.max_insts = DEFAULT_INSTS;
+
+    // Own args; everything after --roms is a real ROM to run as well
+    const char *corpus = "bench-roms";
+    bool corpus_only = false;   // Only write the corpus, e.g. for conformance checks on it
+    char **roms = NULL;
+    uint32_t num_roms = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--insts", strlen("--insts")) == 0 && i + 1 < argc) {
+            config.max_insts = strtoull(argv[++i], NULL, 10);
+        } else if (strncmp(argv[i], "--corpus", strlen("--corpus")) == 0 && i + 1 < argc) {
+            corpus = argv[++i];
+        } else if (strncmp(argv[i], "--ips", strlen("--ips")) == 0 && i + 1 < argc) {
+            config.insts_per_second = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--write-corpus") == 0) {
+            corpus_only = true;
+        } else if (strcmp(argv[i], "--roms") == 0) {
+            roms = &argv[i + 1];
+            num_roms = argc - i - 1;
+            break;
+        }
+    }
+
+    chip8_t *chip8 = calloc(1, sizeof *chip8);
+    if (!chip8) exit(EXIT_FAILURE);
+    bool ok = true;
+
+    // Synthetic corpus
+    char *sprites_path = NULL;
+    for (uint32_t i = 0; i < NUM_SYNTHETIC_ROMS; i++) {
+        char *path = write_synthetic_rom(&synthetic_roms[i], corpus);
+        if (!path) exit(EXIT_FAILURE);
+        if (corpus_only) {
+            free(path);
+            continue;
+        }
+
+        config_t rom_config = config;
+        rom_config.current_extension = synthetic_roms[i].extension;
+        ok &= bench_engines(chip8, rom_config, path);
+
+        if (strcmp(synthetic_roms[i].name, "sprites") == 0) sprites_path = path;
+        else free(path);
+    }
+
+    if (corpus_only) exit(EXIT_SUCCESS);
+
+    // Real ROMs, with the extension set for the run
+    for (uint32_t i = 0; i < num_roms; i++) ok &= bench_engines(chip8, config, roms[i]);
+
+    // Render and fade, on the sprite storm's frames at the usual clock rate
+    config.insts_per_second = 600;
+    config.current_extension = SUPERCHIP;
+    ok &= bench_render(chip8, config, sprites_path);
+
+    jit_destroy(chip8);
+    free(chip8);
+    free(sprites_path);
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,102 @@
+#include <time.h>
+
+#include "chip8.h"
+
+// Multi-machine engine benchmark
+//   Steps N machines of 1 ROM with envs_step(), then runs the same N machines 1 at a time on the
+//   single machine interpreter with the same key presses, checks that every machine ends up in the
+//   same state, and prints machine frames per second for both.
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Keys held by a machine during a step; varies per machine so their PCs diverge on input
+static uint16_t action(const uint32_t env, const uint32_t step) {
+    return ((env + step) % 3 == 0) ? 1u << ((env * 7 + step) % 16) : 0;
+}
+
+int main(int argc, char **argv) {
+    // Default Usage message for args
+    if (argc < 2) {
+       fprintf(stderr, "Usage: %s <rom_name> [--envs N] [--steps N] [--frames-per-step N]\n", argv[0]);
+       exit(EXIT_FAILURE);
+    }
+
+    config_t config = {0};
+    if (!set_config_from_args(&config, argc, argv)) exit(EXIT_FAILURE);
+    config.headless = true;
+
+    uint32_t count = 1024;
+    uint32_t steps = 60;
+    uint32_t frames_per_step = 4;
+    for (int i = 2; i < argc - 1; i++) {
+        if (strncmp(argv[i], "--envs", strlen("--envs")) == 0)
+            count = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strncmp(argv[i], "--steps", strlen("--steps")) == 0)
+            steps = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strncmp(argv[i], "--frames-per-step", strlen("--frames-per-step")) == 0)
+            frames_per_step = (uint32_t)strtoul(argv[++i], NULL, 10);
+    }
+
+    envs_t *envs = envs_create(config, argv[1], count);
+    uint16_t *actions = calloc(count, sizeof *actions);
+    chip8_t *chip8 = calloc(1, sizeof *chip8);
+    chip8_t *expected = calloc(1, sizeof *expected);
+    if (!envs || !actions || !chip8 || !expected) exit(EXIT_FAILURE);
+
+    // Multi-machine engine
+    double start_time = now_seconds();
+    for (uint32_t step = 0; step < steps; step++) {
+        for (uint32_t env = 0; env < count; env++) actions[env] = action(env, step);
+        envs_step(envs, actions, frames_per_step);
+    }
+    const double envs_seconds = now_seconds() - start_time;
+
+    // Same machines 1 at a time, checked against the multi-machine results
+    uint32_t mismatches = 0;
+    double single_seconds = 0;
+    for (uint32_t env = 0; env < count; env++) {
+        if (!init_chip8(chip8, config, argv[1])) exit(EXIT_FAILURE);
+
+        start_time = now_seconds();
+        for (uint32_t step = 0; step < steps; step++) {
+            for (uint8_t key = 0; key < 16; key++) chip8->keypad[key] = (action(env, step) >> key) & 1;
+            for (uint32_t frame = 0; frame < frames_per_step; frame++) {
+                emulate_frame(chip8, config);
+                update_timers(chip8);
+            }
+        }
+        single_seconds += now_seconds() - start_time;
+
+        envs_get(envs, env, expected);
+        if (display_hash(chip8) != display_hash(expected) || chip8->PC != expected->PC ||
+            chip8->I != expected->I || memcmp(chip8->V, expected->V, sizeof chip8->V) ||
+            read_delay_timer(chip8) != read_delay_timer(expected) ||
+            read_sound_timer(chip8) != read_sound_timer(expected) ||
+            chip8->stack_ptr - chip8->stack != expected->stack_ptr - expected->stack ||
+            memcmp(chip8->stack, expected->stack, sizeof chip8->stack) ||
+            memcmp(chip8->ram, expected->ram, sizeof chip8->ram)) {
+            if (mismatches++ < 10)
+                fprintf(stderr, "env %u differs: PC 0x%04X vs 0x%04X\n", env, expected->PC, chip8->PC);
+        }
+    }
+
+    const double machine_frames = (double)count * steps * frames_per_step;
+    printf("envs: %u\n", count);
+    printf("frames_per_env: %u\n", steps * frames_per_step);
+    printf("envs_frames_per_second: %.0f\n", machine_frames / envs_seconds);
+    printf("single_frames_per_second: %.0f\n", machine_frames / single_seconds);
+    printf("speedup: %.2f\n", single_seconds / envs_seconds);
+    printf("mismatches: %u\n", mismatches);
+
+    jit_destroy(chip8);
+    free(chip8);
+    free(expected);
+    free(actions);
+    envs_destroy(envs);
+
+    exit(mismatches ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,138 @@
+#include <time.h>
+
+#include "chip8.h"
+
+// Phosphor fade microbenchmark
+//   Fades a random display at 64x32 (CHIP8) and 128x64 (SUPERCHIP hi-res) with the float
+//   color_lerp reference and each fixed point kernel, printing ns per frame, speedup over the
+//   reference, and the largest per channel difference from the reference after 1 fade step.
+//   The display keeps changing a little every frame, so most pixels are settled like in a real
+//   game and only some are fading.
+
+#define BENCH_FRAMES 20000
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Simple deterministic PRNG so runs are repeatable
+static uint64_t bench_rng = 0x9E3779B97F4A7C15ull;
+static uint64_t next_random(void) {
+    bench_rng ^= bench_rng << 13;
+    bench_rng ^= bench_rng >> 7;
+    bench_rng ^= bench_rng << 17;
+    return bench_rng;
+}
+
+// Float reference, same as the frontend did per pixel before the fixed point kernels
+static void fade_reference(uint32_t *pixel_color, const uint64_t *display, const uint32_t width,
+                           const uint32_t height, const uint32_t fg_color, const uint32_t bg_color,
+                           const float rate) {
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            const uint32_t i = y * width + x;
+            const bool on = (display[y * (width / 64) + x / 64] >> (63 - x % 64)) & 1;
+            const uint32_t target = on ? fg_color : bg_color;
+
+            if (pixel_color[i] != target) {
+                uint32_t color = color_lerp(pixel_color[i], target, rate);
+                if (color == pixel_color[i]) color = target;
+                pixel_color[i] = color;
+            }
+        }
+    }
+}
+
+// Largest difference of any color channel between 2 pixel buffers
+static uint32_t max_channel_diff(const uint32_t *a, const uint32_t *b, const uint32_t count) {
+    uint32_t max = 0;
+    for (uint32_t i = 0; i < count; i++)
+        for (uint32_t shift = 0; shift < 32; shift += 8) {
+            const int32_t diff = (int32_t)((a[i] >> shift) & 0xFF) - (int32_t)((b[i] >> shift) & 0xFF);
+            if ((uint32_t)abs(diff) > max) max = abs(diff);
+        }
+    return max;
+}
+
+static void bench_size(const uint32_t width, const uint32_t height) {
+    const uint32_t count = width * height;
+    const uint32_t fg_color = 0xFFFFFFFF;
+    const uint32_t bg_color = 0x00000000;
+    const float rate = 0.7f;
+    const uint64_t all_rows = (height >= 64) ? ~0ull : (1ull << height) - 1;
+
+    uint64_t *display = malloc(count / 8);
+    uint64_t *display_start = malloc(count / 8);
+    uint32_t *start = malloc(count * sizeof *start);
+    uint32_t *expected = malloc(count * sizeof *expected);
+    uint32_t *pixels = malloc(count * sizeof *pixels);
+    uint32_t *scalar = malloc(count * sizeof *scalar);
+    if (!display || !display_start || !start || !expected || !pixels || !scalar) exit(EXIT_FAILURE);
+
+    for (uint32_t i = 0; i < count / 64; i++) display[i] = next_random();
+    for (uint32_t i = 0; i < count; i++) start[i] = (uint32_t)next_random();
+    memcpy(display_start, display, count / 8);
+
+    // Reference: 1 fade step for accuracy, then timing
+    memcpy(expected, start, count * sizeof *start);
+    fade_reference(expected, display, width, height, fg_color, bg_color, rate);
+    memcpy(scalar, start, count * sizeof *start);
+    fade_pixels(FADE_SCALAR, scalar, display, width, height, all_rows, fg_color, bg_color, rate);
+
+    memcpy(pixels, start, count * sizeof *start);
+    double t0 = now_seconds();
+    for (uint32_t f = 0; f < BENCH_FRAMES; f++) {
+        fade_reference(pixels, display, width, height, fg_color, bg_color, rate);
+        display[f % (count / 64)] ^= 1;     // Keep some pixels fading every frame
+    }
+    const double ref_ns = (now_seconds() - t0) * 1e9 / BENCH_FRAMES;
+    printf("%ux%u reference  %9.1f ns/frame\n", width, height, ref_ns);
+
+    static const struct {
+        fade_kernel_t kernel;
+        const char *name;
+    } kernels[] = {
+        {FADE_SCALAR, "scalar"},
+        {FADE_SSE2,   "sse2"},
+        {FADE_AVX2,   "avx2"},
+    };
+
+    for (uint32_t k = 0; k < sizeof kernels / sizeof kernels[0]; k++) {
+        if (!fade_kernel_supported(kernels[k].kernel)) {
+            printf("%ux%u %-10s unsupported on this host\n", width, height, kernels[k].name);
+            continue;
+        }
+
+        memcpy(pixels, start, count * sizeof *start);
+        memcpy(display, display_start, count / 8);
+        fade_pixels(kernels[k].kernel, pixels, display, width, height, all_rows, fg_color, bg_color, rate);
+        const uint32_t diff = max_channel_diff(pixels, expected, count);
+        const bool identical = !memcmp(pixels, scalar, count * sizeof *pixels);
+
+        t0 = now_seconds();
+        for (uint32_t f = 0; f < BENCH_FRAMES; f++) {
+            fade_pixels(kernels[k].kernel, pixels, display, width, height, all_rows, fg_color, bg_color, rate);
+            display[f % (count / 64)] ^= 1;
+        }
+        const double ns = (now_seconds() - t0) * 1e9 / BENCH_FRAMES;
+
+        printf("%ux%u %-10s %9.1f ns/frame  %5.1fx  max channel diff %u%s\n",
+               width, height, kernels[k].name, ns, ref_ns / ns, diff,
+               identical ? "" : "  MISMATCH vs scalar");
+    }
+
+    free(display);
+    free(display_start);
+    free(start);
+    free(expected);
+    free(pixels);
+    free(scalar);
+}
+
+int main(void) {
+    bench_size(64, 32);
+    bench_size(128, 64);
+    exit(EXIT_SUCCESS);
+}
@@ -1,121 +1,131 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <stdint.h>
-#include <stdbool.h>
+#include <float.h>
+#include <stdatomic.h>
 #include <time.h>
 
 #include "SDL.h"
 
+#include "chip8.h"
+
 // SDL Container object
 typedef struct {
     SDL_Window *window;
     SDL_Renderer *renderer;
+    SDL_Texture *texture;   // CHIP8 pixel colors at native resolution, scaled up on copy
+    SDL_Texture *outlines;  // Pixel outlines at window resolution, transparent elsewhere
     SDL_AudioSpec want, have;
     SDL_AudioDeviceID dev;
 } sdl_t;
 
-// Emulator states
-typedef enum {
-    QUIT,
-    RUNNING,
-    PAUSED,
-} emulator_state_t;
-
-// CHIP-8 extensions/quirks support
-typedef enum {
-    CHIP8,
-    SUPERCHIP,
-    XOCHIP,
-} extension_t;
-
-// Emulator configuration object
-typedef struct {
-    uint32_t window_width;      // SDL window width
-    uint32_t window_height;     // SDL window height
-    uint32_t fg_color;          // Foreground color RGBA8888
-    uint32_t bg_color;          // Background color RGBA8888
-    uint32_t scale_factor;      // Amount to scale a CHIP8 pixel by e.g. 20x will be a 20x larger window
-    bool pixel_outlines;        // Draw pixel "outlines" yes/no
-    uint32_t insts_per_second;  // CHIP8 CPU "clock rate" or hz
-    uint32_t square_wave_freq;  // Frequency of square wave sound e.g. 440hz for middle A
-    uint32_t audio_sample_rate; 
-    int16_t volume;             // How loud or not is the sound
-    float color_lerp_rate;      // Amount to lerp colors by, between [0.1, 1.0]
-    extension_t current_extension;  // Current quirks/extension support for e.g. CHIP8 vs. SUPERCHIP
-} config_t;
-
-// CHIP8 Instruction format
+// Render thread's picture of the display: the newest frame taken from the emulation thread,
+//   and the pixel colors fading towards it
 typedef struct {
-    uint16_t opcode;
-    uint16_t NNN;   // 12 bit address/constant
-    uint8_t NN;     // 8 bit constant
-    uint8_t N;      // 4 bit constant
-    uint8_t X;      // 4 bit register identifier
-    uint8_t Y;      // 4 bit register identifier
-} instruction_t;
-
-// CHIP8 Machine object
+    uint64_t display[32];
+    uint32_t pixel_color[64*32];    // CHIP8 pixel colors to draw
+    uint32_t fading_rows;   // Display rows whose pixel colors are still lerping towards their target
+} screen_t;
+
+// Render (main) thread state, changed by user input
 typedef struct {
     emulator_state_t state;
-    uint8_t ram[4096];
-    bool display[64*32];    // Emulate original CHIP8 resolution pixels
-    uint32_t pixel_color[64*32];    // CHIP8 pixel colors to draw 
-    uint16_t stack[12];     // Subroutine stack
-    uint16_t *stack_ptr;
-    uint8_t V[16];          // Data registers V0-VF
-    uint16_t I;             // Index register
-    uint16_t PC;            // Program Counter
-    uint8_t delay_timer;    // Decrements at 60hz when >0
-    uint8_t sound_timer;    // Decrements at 60hz and plays tone when >0 
-    bool keypad[16];        // Hexadecimal keypad 0x0-0xF
-    const char *rom_name;   // Currently running ROM
-    instruction_t inst;     // Currently executing instruction
-    bool draw;              // Update the screen yes/no
-} chip8_t;
-
-// Color "lerp" helper function
-uint32_t color_lerp(const uint32_t start_color, const uint32_t end_color, const float t) {
-    const uint8_t s_r = (start_color >> 24) & 0xFF;
-    const uint8_t s_g = (start_color >> 16) & 0xFF;
-    const uint8_t s_b = (start_color >>  8) & 0xFF;
-    const uint8_t s_a = (start_color >>  0) & 0xFF;
-
-    const uint8_t e_r = (end_color >> 24) & 0xFF;
-    const uint8_t e_g = (end_color >> 16) & 0xFF;
-    const uint8_t e_b = (end_color >>  8) & 0xFF;
-    const uint8_t e_a = (end_color >>  0) & 0xFF;
-
-    const uint8_t ret_r = ((1-t)*s_r) + (t*e_r);
-    const uint8_t ret_g = ((1-t)*s_g) + (t*e_g);
-    const uint8_t ret_b = ((1-t)*s_b) + (t*e_b);
-    const uint8_t ret_a = ((1-t)*s_a) + (t*e_a);
-
-    return (ret_r << 24) | (ret_g << 16) | (ret_b << 8) | ret_a;
-}
+    bool keypad[16];        // Hexadecimal keypad 0x0-0xF as held by the user
+    bool reset;             // Reset requested, not yet passed on to the emulation thread
+    bool save;              // Quick save requested, not yet passed on
+    bool load;              // Quick load requested, not yet passed on
+    bool rewinding;         // Rewind hotkey held
+    bool profiling;         // Profiling toggled on
+    bool tracing;           // Instruction tracing toggled on
+    bool dump_trace;        // Trace dump requested, not yet passed on
+    screen_t screen;
+} frontend_t;
+
+// Emulation thread, and what it shares with the render thread
+//   The render thread only writes the input fields, the emulation thread only hands over finished
+//   frames. Frames go through a lock-free triple buffer (frames.c), so neither thread ever waits on
+//   the other
+typedef struct {
+    chip8_t chip8;          // Only touched by the emulation thread once it runs
+    config_t config;        // Emulation thread's copy
+    audio_t audio;
+    uint32_t frame_event;   // SDL event type pushed to wake the render thread for a new frame
+
+    SDL_sem *wake;          // Posted after any input change; the emulation thread sleeps on it
+    atomic_uint keys;       // Keypad, 1 bit per key
+    atomic_bool suspended;  // Paused or window minimized, nothing runs
+    _Atomic float speed;    // config.speed as set by the user
+    atomic_bool reset;      // Restart the ROM
+    atomic_bool save;       // Quick save
+    atomic_bool load;       // Quick load
+    chip8_state_t boot;     // Machine as first loaded, restored on reset without reading the ROM again
+    chip8_state_t quick;    // Last quick save
+    bool have_quick;
+    atomic_bool rewinding;  // Step back through history instead of running
+    rewind_t *history;      // Machine state of recent frames, NULL if rewind is off
+    input_log_t *recording; // Keypad input being recorded, NULL if not recording
+    atomic_bool profiling;  // Count what runs into profile
+    profile_t *profile;     // Counts so far, created the first time profiling is turned on
+    atomic_bool tracing;    // Trace what runs into trace
+    atomic_bool dump_trace; // Dump trace to config.trace_file
+    trace_t *trace;         // Newest instructions traced, created the first time tracing is turned on
+    atomic_bool quit;
+
+    frames_t frames;        // Finished displays for the render thread
+} emu_t;
+
+// Timed waits only have millisecond granularity and tend to oversleep, so the emulation thread
+//   sleeps until this long before a frame is due and spins on the performance counter for the rest
+#define SPIN_MARGIN_MS 2
+
+// How far the emulation thread may fall behind and still run the missed frames back to back to
+//   catch up; any further behind (e.g. the host was suspended) and they are dropped instead
+#define MAX_CATCH_UP_MS 100
+
+// Speed multiplier steps of the [ and ] hotkeys, slowest first; 0 = unlimited
+static const float speed_steps[] = { 0.25f, 0.5f, 1.0f, 2.0f, 4.0f, 8.0f, 0.0f };
+#define NUM_SPEED_STEPS (sizeof speed_steps / sizeof speed_steps[0])
 
 // SDL Audio callback
 // Fill out stream/audio buffer with data
 void audio_callback(void *userdata, uint8_t *stream, int len) {
-    config_t *config = (config_t *)userdata;
-
-    int16_t *audio_data = (int16_t *)stream;
-    static uint32_t running_sample_index = 0;
-    const int32_t square_wave_period = config->audio_sample_rate / config->square_wave_freq;
-    const int32_t half_square_wave_period = square_wave_period / 2;
-
-    // We are filling out 2 bytes at a time (int16_t), len is in bytes,
-    //   so divide by 2
-    // If the current chunk of audio for the square wave is the crest of the wave, 
-    //   this will add the volume, otherwise it is the trough of the wave, and will add
-    //   "negative" volume
-    for (int i = 0; i < len / 2; i++)
-        audio_data[i] = ((running_sample_index++ / half_square_wave_period) % 2) ? 
-                        config->volume : 
-                        -config->volume;
+    render_audio(userdata, (int16_t *)stream, len / 2, SDL_GetPerformanceCounter());
+}
+
+// Precompute pixel outlines once into a texture drawn over the whole screen
+bool init_outlines(sdl_t *sdl, const config_t config) {
+    const uint32_t width = config.window_width * config.scale_factor;
+    const uint32_t height = config.window_height * config.scale_factor;
+
+    uint32_t *pixels = calloc(width * height, sizeof *pixels);  // Transparent
+    if (!pixels) {
+        SDL_Log("Could not allocate pixel outlines\n");
+        return false;
+    }
+
+    // Outline each CHIP8 pixel's edge in the background color
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            if (x % config.scale_factor == 0 || x % config.scale_factor == config.scale_factor - 1 ||
+                y % config.scale_factor == 0 || y % config.scale_factor == config.scale_factor - 1)
+                pixels[y * width + x] = config.bg_color;
+        }
+    }
+
+    sdl->outlines = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_RGBA8888, 
+                                      SDL_TEXTUREACCESS_STATIC, width, height);
+    if (!sdl->outlines) {
+        SDL_Log("Could not create SDL outline texture %s\n", SDL_GetError());
+        free(pixels);
+        return false;
+    }
+
+    SDL_UpdateTexture(sdl->outlines, NULL, pixels, width * sizeof *pixels);
+    SDL_SetTextureBlendMode(sdl->outlines, SDL_BLENDMODE_BLEND);
+    free(pixels);
+
+    return true;    // Success
 }
 
 // Initialize SDL
-bool init_sdl(sdl_t *sdl, config_t *config) {
+bool init_sdl(sdl_t *sdl, config_t *config, audio_t *audio) {
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER) != 0) {
         SDL_Log("Could not initialize SDL subsystems! %s\n", SDL_GetError());
         return false;
@@ -137,14 +147,25 @@ bool init_sdl(sdl_t *sdl, config_t *config) {
         return false;
     }
 
+    // 1 texel per CHIP8 pixel, the renderer scales it up to the window
+    sdl->texture = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_RGBA8888, 
+                                     SDL_TEXTUREACCESS_STREAMING, 
+                                     config->window_width, config->window_height);
+    if (!sdl->texture) {
+        SDL_Log("Could not create SDL texture %s\n", SDL_GetError());
+        return false;
+    }
+
+    if (config->pixel_outlines && !init_outlines(sdl, *config)) return false;
+
     // Init Audio stuff
     sdl->want = (SDL_AudioSpec){
-        .freq = 44100,          // 44100hz "CD" quality
+        .freq = config->audio_sample_rate,  // 44100hz "CD" quality by default
         .format = AUDIO_S16LSB, // Signed 16 bit little endian
         .channels = 1,          // Mono, 1 channel
         .samples = 512,
         .callback = audio_callback,
-        .userdata = config,        // Userdata passed to audio callback
+        .userdata = audio,      // Userdata passed to audio callback
     };
 
     sdl->dev = SDL_OpenAudioDevice(NULL, 0, &sdl->want, &sdl->have, 0);
@@ -161,109 +182,21 @@ bool init_sdl(sdl_t *sdl, config_t *config) {
         return false;
     }
 
-    return true;    // Success
-}
-
-// Set up initial emulator configuration from passed in arguments
-bool set_config_from_args(config_t *config, const int argc, char **argv) {
-
-    // Set defaults
-    *config = (config_t){
-        .window_width  = 64,    // CHIP8 original X resolution
-        .window_height = 32,    // CHIP8 original Y resolution
-        .fg_color = 0xFFFFFFFF, // WHITE
-        .bg_color = 0x000000FF, // BLACK
-        .scale_factor = 20,     // Default resolution will be 1280x640
-        .pixel_outlines = true, // Draw pixel "outlines" by default
-        .insts_per_second = 600, // Number of instructions to emulate in 1 second (clock rate of CPU)
-        .square_wave_freq = 440,    // 440hz for middle A
-        .audio_sample_rate = 44100, // CD quality, 44100hz
-        .volume = 3000,             // INT16_MAX would be max volume
-        .color_lerp_rate = 0.7,     // Color lerp rate, between [0.1, 1.0]
-        .current_extension = CHIP8, // Set default quirks/extension to plain OG CHIP-8
-    };
+    // 1 square wave cycle in the pattern, high for the first half, stepped through at the
+    //   pattern's 128 bits per cycle; phase is in 1/2^25ths of a bit
+    audio_init(audio, sdl->have.freq, SDL_GetPerformanceFrequency(), sdl->have.samples,
+               config->square_wave_freq, config->volume);
 
-    // Override defaults from passed in arguments
-    for (int i = 1; i < argc; i++) {
-            (void)argv[i];  // Prevent compiler error from unused variables argc/argv
-            // e.g. set scale factor
-            if (strncmp(argv[i], "--scale-factor", strlen("--scale-factor")) == 0) {
-                // Note: should probably add checks for numeric
-                i++;
-                config->scale_factor = (uint32_t)strtol(argv[i], NULL, 10);
-            }
-    }
+    SDL_PauseAudioDevice(sdl->dev, 0);  // Runs from now on
 
     return true;    // Success
 }
 
-// Initialize CHIP8 machine
-bool init_chip8(chip8_t *chip8, const config_t config, const char rom_name[]) {
-    const uint32_t entry_point = 0x200; // CHIP8 Roms will be loaded to 0x200
-    const uint8_t font[] = {
-        0xF0, 0x90, 0x90, 0x90, 0xF0,   // 0   
-        0x20, 0x60, 0x20, 0x20, 0x70,   // 1  
-        0xF0, 0x10, 0xF0, 0x80, 0xF0,   // 2 
-        0xF0, 0x10, 0xF0, 0x10, 0xF0,   // 3
-        0x90, 0x90, 0xF0, 0x10, 0x10,   // 4    
-        0xF0, 0x80, 0xF0, 0x10, 0xF0,   // 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0,   // 6
-        0xF0, 0x10, 0x20, 0x40, 0x40,   // 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0,   // 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0,   // 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90,   // A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0,   // B
-        0xF0, 0x80, 0x80, 0x80, 0xF0,   // C
-        0xE0, 0x90, 0x90, 0x90, 0xE0,   // D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0,   // E
-        0xF0, 0x80, 0xF0, 0x80, 0x80,   // F
-    };
-
-    // Initialize entire CHIP8 machine
-    memset(chip8, 0, sizeof(chip8_t));
-
-    // Load font 
-    memcpy(&chip8->ram[0], font, sizeof(font));
-   
-    // Open ROM file
-    FILE *rom = fopen(rom_name, "rb");
-    if (!rom) {
-        SDL_Log("Rom file %s is invalid or does not exist\n", rom_name);
-        return false;
-    }
-
-    // Get/check rom size
-    fseek(rom, 0, SEEK_END);
-    const size_t rom_size = ftell(rom);
-    const size_t max_size = sizeof chip8->ram - entry_point;
-    rewind(rom);
-
-    if (rom_size > max_size) {
-        SDL_Log("Rom file %s is too big! Rom size: %llu, Max size allowed: %llu\n", 
-                rom_name, (long long unsigned)rom_size, (long long unsigned)max_size);
-        return false;
-    }
-
-    // Load ROM
-    if (fread(&chip8->ram[entry_point], rom_size, 1, rom) != 1) {
-        SDL_Log("Could not read Rom file %s into CHIP8 memory\n", 
-                rom_name);
-        return false;
-    }
-    fclose(rom);
-
-    // Set chip8 machine defaults
-    chip8->state = RUNNING;     // Default machine state to on/running
-    chip8->PC = entry_point;    // Start program counter at ROM entry point
-    chip8->rom_name = rom_name;
-    chip8->stack_ptr = &chip8->stack[0];
-    memset(&chip8->pixel_color[0], config.bg_color, sizeof chip8->pixel_color); // Init pixels to bg color
-
-    return true;    // Success
-}
 
 // Final cleanup
 void final_cleanup(const sdl_t sdl) {
+    if (sdl.outlines) SDL_DestroyTexture(sdl.outlines);
+    SDL_DestroyTexture(sdl.texture);
     SDL_DestroyRenderer(sdl.renderer);
     SDL_DestroyWindow(sdl.window);
     SDL_CloseAudioDevice(sdl.dev);
@@ -282,67 +215,59 @@ void clear_screen(const sdl_t sdl, const config_t config) {
 }
 
 // Update window with any changes
-void update_screen(const sdl_t sdl, const config_t config, chip8_t *chip8) {
-    SDL_Rect rect = {.x = 0, .y = 0, .w = config.scale_factor, .h = config.scale_factor};
-
-    // Grab bg color values to draw outlines
-    const uint8_t bg_r = (config.bg_color >> 24) & 0xFF;
-    const uint8_t bg_g = (config.bg_color >> 16) & 0xFF;
-    const uint8_t bg_b = (config.bg_color >>  8) & 0xFF;
-    const uint8_t bg_a = (config.bg_color >>  0) & 0xFF;
-
-    // Loop through display pixels, draw a rectangle per pixel to the SDL window
-    for (uint32_t i = 0; i < sizeof chip8->display; i++) {
-        // Translate 1D index i value to 2D X/Y coordinates
-        // X = i % window width
-        // Y = i / window width
-        rect.x = (i % config.window_width) * config.scale_factor;
-        rect.y = (i / config.window_width) * config.scale_factor;
-
-        if (chip8->display[i]) {
-            // Pixel is on, draw foreground color
-            if (chip8->pixel_color[i] != config.fg_color) {
-                // Lerp towards fg_color
-                chip8->pixel_color[i] = color_lerp(chip8->pixel_color[i], 
-                                                   config.fg_color, 
-                                                   config.color_lerp_rate);
-            }
+//   Pixel colors are written to a native resolution texture, which is then scaled up to
+//   the window in 1 copy, instead of drawing each CHIP8 pixel as its own rectangle.
+//   Only the given rows (changed or still fading) are lerped and re-uploaded, and nothing
+//   is presented at all if there are none
+void update_screen(const sdl_t sdl, const config_t config, screen_t *screen, const uint32_t rows) {
+    if (!rows) return;  // Nothing changed since the last present
+
+    // Lerp each pixel color of the given rows towards fg or bg color
+    screen->fading_rows = fade_pixels(FADE_AUTO, screen->pixel_color, screen->display,
+                                     config.window_width, config.window_height, rows,
+                                     config.fg_color, config.bg_color, config.color_lerp_rate);
+
+    // Re-upload each run of consecutive rows with 1 texture update
+    for (uint32_t y = 0; y < config.window_height; ) {
+        if (!(rows & (1u << y))) { y++; continue; }
+
+        uint32_t end = y;
+        while (end < config.window_height && (rows & (1u << end))) end++;
+
+        const SDL_Rect rect = {0, y, config.window_width, end - y};
+        SDL_UpdateTexture(sdl.texture, &rect, &screen->pixel_color[y * config.window_width], 
+                          config.window_width * sizeof screen->pixel_color[0]);
+        y = end;
+    }
 
-            const uint8_t r = (chip8->pixel_color[i] >> 24) & 0xFF;
-            const uint8_t g = (chip8->pixel_color[i] >> 16) & 0xFF;
-            const uint8_t b = (chip8->pixel_color[i] >>  8) & 0xFF;
-            const uint8_t a = (chip8->pixel_color[i] >>  0) & 0xFF;
-
-            SDL_SetRenderDrawColor(sdl.renderer, r, g, b, a);
-            SDL_RenderFillRect(sdl.renderer, &rect);
-        
-            // TODO: Move this outside if/else, and combine lerping or at least reduce duplicate code
-            if (config.pixel_outlines) {
-                // If user requested drawing pixel outlines, draw those here
-                SDL_SetRenderDrawColor(sdl.renderer, bg_r, bg_g, bg_b, bg_a);
-                SDL_RenderDrawRect(sdl.renderer, &rect);
-            }
+    SDL_RenderCopy(sdl.renderer, sdl.texture, NULL, NULL);
 
-        } else {
-            // Pixel is off, draw background color
-            if (chip8->pixel_color[i] != config.bg_color) {
-                // Lerp towards bg_color
-                chip8->pixel_color[i] = color_lerp(chip8->pixel_color[i], 
-                                                   config.bg_color, 
-                                                   config.color_lerp_rate);
-            }
+    // If user requested drawing pixel outlines, draw those on top
+    if (config.pixel_outlines) 
+        SDL_RenderCopy(sdl.renderer, sdl.outlines, NULL, NULL);
+
+    SDL_RenderPresent(sdl.renderer);
+}
 
-            const uint8_t r = (chip8->pixel_color[i] >> 24) & 0xFF;
-            const uint8_t g = (chip8->pixel_color[i] >> 16) & 0xFF;
-            const uint8_t b = (chip8->pixel_color[i] >>  8) & 0xFF;
-            const uint8_t a = (chip8->pixel_color[i] >>  0) & 0xFF;
+// Next speed step faster or slower than the given speed; unlimited (0) is faster than any other
+float next_speed(const float speed, const bool faster) {
+    const float rank = speed ? speed : FLT_MAX;
 
-            SDL_SetRenderDrawColor(sdl.renderer, r, g, b, a);
-            SDL_RenderFillRect(sdl.renderer, &rect);
-        }
+    if (faster) {
+        for (uint32_t i = 0; i < NUM_SPEED_STEPS; i++)
+            if ((speed_steps[i] ? speed_steps[i] : FLT_MAX) > rank) return speed_steps[i];
+    } else {
+        for (uint32_t i = NUM_SPEED_STEPS; i-- > 0; )
+            if ((speed_steps[i] ? speed_steps[i] : FLT_MAX) < rank) return speed_steps[i];
     }
 
-    SDL_RenderPresent(sdl.renderer);
+    return speed;   // Already the fastest/slowest
+}
+
+void set_speed(config_t *config, const float speed) {
+    config->speed = speed;
+    if (speed) printf("==== SPEED %gx ====\n", speed);
+    else puts("==== SPEED UNLIMITED ====");
 }
 
 // Handle user input
@@ -351,36 +276,93 @@ void update_screen(const sdl_t sdl, const config_t config, chip8_t *chip8) {
 // 456D          qwer
 // 789E          asdf
 // A0BF          zxcv
-void handle_input(chip8_t *chip8, config_t *config) {
+//   Sleeps until the first event arrives or timeout_ms passes (-1 = no timeout), then handles
+//   every queued event
+void handle_input(frontend_t *front, config_t *config, const int32_t timeout_ms) {
     SDL_Event event;
+    int have_event = (timeout_ms < 0) ? SDL_WaitEvent(&event) : SDL_WaitEventTimeout(&event, timeout_ms);
 
-    while (SDL_PollEvent(&event)) {
+    for (; have_event; have_event = SDL_PollEvent(&event)) {
         switch (event.type) {
             case SDL_QUIT:
                 // Exit window; End program
-                chip8->state = QUIT; // Will exit main emulator loop
+                front->state = QUIT; // Will exit main emulator loop
+                break;
+
+            case SDL_WINDOWEVENT:
+                // Window contents were lost (e.g. uncovered or resized), redraw every row
+                if (event.window.event == SDL_WINDOWEVENT_EXPOSED ||
+                    event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+                    front->screen.fading_rows = UINT32_MAX;
                 break;
 
             case SDL_KEYDOWN:
                 switch (event.key.keysym.sym) {
                     case SDLK_ESCAPE:
                         // Escape key; Exit window & End program
-                        chip8->state = QUIT;
+                        front->state = QUIT;
                         break;
                         
                     case SDLK_SPACE:
                         // Space bar
-                        if (chip8->state == RUNNING) {
-                            chip8->state = PAUSED;  // Pause
+                        if (front->state == RUNNING) {
+                            front->state = PAUSED;  // Pause
                             puts("==== PAUSED ====");
                         } else {
-                            chip8->state = RUNNING; // Resume
+                            front->state = RUNNING; // Resume
                         }
                         break;
 
                     case SDLK_EQUALS:
                         // '=': Reset CHIP8 machine for the current ROM
-                        init_chip8(chip8, *config, chip8->rom_name);
+                        front->reset = true;
+                        break;
+
+                    case SDLK_F5:
+                        // F5: Quick save, also to the --save-state file if given
+                        front->save = true;
+                        break;
+
+                    case SDLK_F9:
+                        // F9: Quick load the last quick save, or the --load-state file
+                        front->load = true;
+                        break;
+
+                    case SDLK_BACKSPACE:
+                        // Backspace: Rewind while held
+                        front->rewinding = true;
+                        break;
+
+                    case SDLK_F7:
+                        // F7: Start/stop profiling, the report is written at exit
+                        front->profiling = !front->profiling;
+                        puts(front->profiling ? "==== PROFILING ====" : "==== PROFILING STOPPED ====");
+                        break;
+
+                    case SDLK_F6:
+                        // F6: Start/stop instruction tracing, the trace is dumped at exit
+                        front->tracing = !front->tracing;
+                        puts(front->tracing ? "==== TRACING ====" : "==== TRACING STOPPED ====");
+                        break;
+
+                    case SDLK_F8:
+                        // F8: Dump the instruction trace now
+                        front->dump_trace = true;
+                        break;
+
+                    case SDLK_LEFTBRACKET:
+                        // '[': Slower, down to slow motion
+                        set_speed(config, next_speed(config->speed, false));
+                        break;
+
+                    case SDLK_RIGHTBRACKET:
+                        // ']': Faster, up to fast forward 8x and then unlimited
+                        set_speed(config, next_speed(config->speed, true));
+                        break;
+
+                    case SDLK_BACKSLASH:
+                        // '\': Back to real time
+                        set_speed(config, 1.0f);
                         break;
 
                     case SDLK_j:
@@ -408,25 +390,25 @@ void handle_input(chip8_t *chip8, config_t *config) {
                         break;
 
                     // Map qwerty keys to CHIP8 keypad
-                    case SDLK_1: chip8->keypad[0x1] = true; break;
-                    case SDLK_2: chip8->keypad[0x2] = true; break;
-                    case SDLK_3: chip8->keypad[0x3] = true; break;
-                    case SDLK_4: chip8->keypad[0xC] = true; break;
-
-                    case SDLK_q: chip8->keypad[0x4] = true; break;
-                    case SDLK_w: chip8->keypad[0x5] = true; break;
-                    case SDLK_e: chip8->keypad[0x6] = true; break;
-                    case SDLK_r: chip8->keypad[0xD] = true; break;
-
-                    case SDLK_a: chip8->keypad[0x7] = true; break;
-                    case SDLK_s: chip8->keypad[0x8] = true; break;
-                    case SDLK_d: chip8->keypad[0x9] = true; break;
-                    case SDLK_f: chip8->keypad[0xE] = true; break;
-
-                    case SDLK_z: chip8->keypad[0xA] = true; break;
-                    case SDLK_x: chip8->keypad[0x0] = true; break;
-                    case SDLK_c: chip8->keypad[0xB] = true; break;
-                    case SDLK_v: chip8->keypad[0xF] = true; break;
+                    case SDLK_1: front->keypad[0x1] = true; break;
+                    case SDLK_2: front->keypad[0x2] = true; break;
+                    case SDLK_3: front->keypad[0x3] = true; break;
+                    case SDLK_4: front->keypad[0xC] = true; break;
+
+                    case SDLK_q: front->keypad[0x4] = true; break;
+                    case SDLK_w: front->keypad[0x5] = true; break;
+                    case SDLK_e: front->keypad[0x6] = true; break;
+                    case SDLK_r: front->keypad[0xD] = true; break;
+
+                    case SDLK_a: front->keypad[0x7] = true; break;
+                    case SDLK_s: front->keypad[0x8] = true; break;
+                    case SDLK_d: front->keypad[0x9] = true; break;
+                    case SDLK_f: front->keypad[0xE] = true; break;
+
+                    case SDLK_z: front->keypad[0xA] = true; break;
+                    case SDLK_x: front->keypad[0x0] = true; break;
+                    case SDLK_c: front->keypad[0xB] = true; break;
+                    case SDLK_v: front->keypad[0xF] = true; break;
 
                     default: break;
                         
@@ -435,26 +417,28 @@ void handle_input(chip8_t *chip8, config_t *config) {
 
             case SDL_KEYUP:
                 switch (event.key.keysym.sym) {
+                    case SDLK_BACKSPACE: front->rewinding = false; break;
+
                     // Map qwerty keys to CHIP8 keypad
-                    case SDLK_1: chip8->keypad[0x1] = false; break;
-                    case SDLK_2: chip8->keypad[0x2] = false; break;
-                    case SDLK_3: chip8->keypad[0x3] = false; break;
-                    case SDLK_4: chip8->keypad[0xC] = false; break;
-
-                    case SDLK_q: chip8->keypad[0x4] = false; break;
-                    case SDLK_w: chip8->keypad[0x5] = false; break;
-                    case SDLK_e: chip8->keypad[0x6] = false; break;
-                    case SDLK_r: chip8->keypad[0xD] = false; break;
-
-                    case SDLK_a: chip8->keypad[0x7] = false; break;
-                    case SDLK_s: chip8->keypad[0x8] = false; break;
-                    case SDLK_d: chip8->keypad[0x9] = false; break;
-                    case SDLK_f: chip8->keypad[0xE] = false; break;
-
-                    case SDLK_z: chip8->keypad[0xA] = false; break;
-                    case SDLK_x: chip8->keypad[0x0] = false; break;
-                    case SDLK_c: chip8->keypad[0xB] = false; break;
-                    case SDLK_v: chip8->keypad[0xF] = false; break;
+                    case SDLK_1: front->keypad[0x1] = false; break;
+                    case SDLK_2: front->keypad[0x2] = false; break;
+                    case SDLK_3: front->keypad[0x3] = false; break;
+                    case SDLK_4: front->keypad[0xC] = false; break;
+
+                    case SDLK_q: front->keypad[0x4] = false; break;
+                    case SDLK_w: front->keypad[0x5] = false; break;
+                    case SDLK_e: front->keypad[0x6] = false; break;
+                    case SDLK_r: front->keypad[0xD] = false; break;
+
+                    case SDLK_a: front->keypad[0x7] = false; break;
+                    case SDLK_s: front->keypad[0x8] = false; break;
+                    case SDLK_d: front->keypad[0x9] = false; break;
+                    case SDLK_f: front->keypad[0xE] = false; break;
+
+                    case SDLK_z: front->keypad[0xA] = false; break;
+                    case SDLK_x: front->keypad[0x0] = false; break;
+                    case SDLK_c: front->keypad[0xB] = false; break;
+                    case SDLK_v: front->keypad[0xF] = false; break;
 
                     default: break;
                 }
@@ -466,628 +450,309 @@ void handle_input(chip8_t *chip8, config_t *config) {
     }
 }
 
-#ifdef DEBUG
-void print_debug_info(chip8_t *chip8) {
-    printf("Address: 0x%04X, Opcode: 0x%04X Desc: ",
-           chip8->PC-2, chip8->inst.opcode);
-
-    switch ((chip8->inst.opcode >> 12) & 0x0F) {
-        case 0x00:
-            if (chip8->inst.NN == 0xE0) {
-                // 0x00E0: Clear the screen
-                printf("Clear screen\n");
-
-            } else if (chip8->inst.NN == 0xEE) {
-                // 0x00EE: Return from subroutine
-                // Set program counter to last address on subroutine stack ("pop" it off the stack)
-                //   so that next opcode will be gotten from that address.
-                printf("Return from subroutine to address 0x%04X\n",
-                       *(chip8->stack_ptr - 1));
-            } else {
-                printf("Unimplemented Opcode.\n");
-            }
-            break;
-
-        case 0x01:
-            // 0x1NNN: Jump to address NNN
-            printf("Jump to address NNN (0x%04X)\n",
-                   chip8->inst.NNN);   
-            break;
-
-        case 0x02:
-            // 0x2NNN: Call subroutine at NNN
-            // Store current address to return to on subroutine stack ("push" it on the stack)
-            //   and set program counter to subroutine address so that the next opcode
-            //   is gotten from there.
-            printf("Call subroutine at NNN (0x%04X)\n",
-                   chip8->inst.NNN);
-            break;
-
-        case 0x03:
-            // 0x3XNN: Check if VX == NN, if so, skip the next instruction
-            printf("Check if V%X (0x%02X) == NN (0x%02X), skip next instruction if true\n",
-                   chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.NN);
-            break;
-
-        case 0x04:
-            // 0x4XNN: Check if VX != NN, if so, skip the next instruction
-            printf("Check if V%X (0x%02X) != NN (0x%02X), skip next instruction if true\n",
-                   chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.NN);
-            break;
-
-        case 0x05:
-            // 0x5XY0: Check if VX == VY, if so, skip the next instruction
-            printf("Check if V%X (0x%02X) == V%X (0x%02X), skip next instruction if true\n",
-                   chip8->inst.X, chip8->V[chip8->inst.X], 
-                   chip8->inst.Y, chip8->V[chip8->inst.Y]);
-            break;
-
-        case 0x06:
-            // 0x6XNN: Set register VX to NN
-            printf("Set register V%X = NN (0x%02X)\n",
-                   chip8->inst.X, chip8->inst.NN);
-            break;
-
-        case 0x07:
-            // 0x7XNN: Set register VX += NN
-            printf("Set register V%X (0x%02X) += NN (0x%02X). Result: 0x%02X\n",
-                   chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.NN,
-                   chip8->V[chip8->inst.X] + chip8->inst.NN);
-            break;
-
-        case 0x08:
-            switch(chip8->inst.N) {
-                case 0:
-                    // 0x8XY0: Set register VX = VY
-                    printf("Set register V%X = V%X (0x%02X)\n",
-                           chip8->inst.X, chip8->inst.Y, chip8->V[chip8->inst.Y]);
-                    break;
-
-                case 1:
-                    // 0x8XY1: Set register VX |= VY
-                    printf("Set register V%X (0x%02X) |= V%X (0x%02X); Result: 0x%02X\n",
-                           chip8->inst.X, chip8->V[chip8->inst.X],
-                           chip8->inst.Y, chip8->V[chip8->inst.Y],
-                           chip8->V[chip8->inst.X] | chip8->V[chip8->inst.Y]);
-                    break;
-
-                case 2:
-                    // 0x8XY2: Set register VX &= VY
-                    printf("Set register V%X (0x%02X) &= V%X (0x%02X); Result: 0x%02X\n",
-                           chip8->inst.X, chip8->V[chip8->inst.X],
-                           chip8->inst.Y, chip8->V[chip8->inst.Y],
-                           chip8->V[chip8->inst.X] & chip8->V[chip8->inst.Y]);
-                    break;
-
-                case 3:
-                    // 0x8XY3: Set register VX ^= VY
-                    printf("Set register V%X (0x%02X) ^= V%X (0x%02X); Result: 0x%02X\n",
-                           chip8->inst.X, chip8->V[chip8->inst.X],
-                           chip8->inst.Y, chip8->V[chip8->inst.Y],
-                           chip8->V[chip8->inst.X] ^ chip8->V[chip8->inst.Y]);
-                    break;
-
-                case 4:
-                    // 0x8XY4: Set register VX += VY, set VF to 1 if carry
-                    printf("Set register V%X (0x%02X) += V%X (0x%02X), VF = 1 if carry; Result: 0x%02X, VF = %X\n",
-                           chip8->inst.X, chip8->V[chip8->inst.X],
-                           chip8->inst.Y, chip8->V[chip8->inst.Y],
-                           chip8->V[chip8->inst.X] + chip8->V[chip8->inst.Y],
-                           ((uint16_t)(chip8->V[chip8->inst.X] + chip8->V[chip8->inst.Y]) > 255));
-                    break;
-
-                case 5:
-                    // 0x8XY5: Set register VX -= VY, set VF to 1 if there is not a borrow (result is positive/0)
-                    printf("Set register V%X (0x%02X) -= V%X (0x%02X), VF = 1 if no borrow; Result: 0x%02X, VF = %X\n",
-                           chip8->inst.X, chip8->V[chip8->inst.X],
-                           chip8->inst.Y, chip8->V[chip8->inst.Y],
-                           chip8->V[chip8->inst.X] - chip8->V[chip8->inst.Y],
-                           (chip8->V[chip8->inst.Y] <= chip8->V[chip8->inst.X]));
-                    break;
-
-                case 6:
-                    // 0x8XY6: Set register VX >>= 1, store shifted off bit in VF
-                    printf("Set register V%X (0x%02X) >>= 1, VF = shifted off bit (%X); Result: 0x%02X\n",
-                           chip8->inst.X, chip8->V[chip8->inst.X],
-                           chip8->V[chip8->inst.X] & 1,
-                           chip8->V[chip8->inst.X] >> 1);
-                    break;
-
-                case 7:
-                    // 0x8XY7: Set register VX = VY - VX, set VF to 1 if there is not a borrow (result is positive/0)
-                    printf("Set register V%X = V%X (0x%02X) - V%X (0x%02X), VF = 1 if no borrow; Result: 0x%02X, VF = %X\n",
-                           chip8->inst.X, chip8->inst.Y, chip8->V[chip8->inst.Y],
-                           chip8->inst.X, chip8->V[chip8->inst.X],
-                           chip8->V[chip8->inst.Y] - chip8->V[chip8->inst.X],
-                           (chip8->V[chip8->inst.X] <= chip8->V[chip8->inst.Y]));
-                    break;
-
-                case 0xE:
-                    // 0x8XYE: Set register VX <<= 1, store shifted off bit in VF
-                    printf("Set register V%X (0x%02X) <<= 1, VF = shifted off bit (%X); Result: 0x%02X\n",
-                           chip8->inst.X, chip8->V[chip8->inst.X],
-                           (chip8->V[chip8->inst.X] & 0x80) >> 7,
-                           chip8->V[chip8->inst.X] << 1);
-                    break;
-
-                default:
-                    // Wrong/unimplemented opcode
-                    break;
-            }
-            break;
-
-        case 0x09:
-            // 0x9XY0: Check if VX != VY; Skip next instruction if so
-            printf("Check if V%X (0x%02X) != V%X (0x%02X), skip next instruction if true\n",
-                   chip8->inst.X, chip8->V[chip8->inst.X], 
-                   chip8->inst.Y, chip8->V[chip8->inst.Y]);
-            break;
-
-        case 0x0A:
-            // 0xANNN: Set index register I to NNN
-            printf("Set I to NNN (0x%04X)\n",
-                   chip8->inst.NNN);
-            break;
-
-        case 0x0B:
-            // 0xBNNN: Jump to V0 + NNN
-            printf("Set PC to V0 (0x%02X) + NNN (0x%04X); Result PC = 0x%04X\n",
-                   chip8->V[0], chip8->inst.NNN, chip8->V[0] + chip8->inst.NNN);
-            break;
-
-        case 0x0C:
-            // 0xCXNN: Sets register VX = rand() % 256 & NN (bitwise AND)
-            printf("Set V%X = rand() %% 256 & NN (0x%02X)\n",
-                   chip8->inst.X, chip8->inst.NN);
-            break;
-
-        case 0x0D:
-            // 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
-            //   Screen pixels are XOR'd with sprite bits, 
-            //   VF (Carry flag) is set if any screen pixels are set off; This is useful
-            //   for collision detection or other reasons.
-            printf("Draw N (%u) height sprite at coords V%X (0x%02X), V%X (0x%02X) "
-                   "from memory location I (0x%04X). Set VF = 1 if any pixels are turned off.\n",
-                   chip8->inst.N, chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.Y,
-                   chip8->V[chip8->inst.Y], chip8->I);
-            break;
-
-        case 0x0E:
-            if (chip8->inst.NN == 0x9E) {
-                // 0xEX9E: Skip next instruction if key in VX is pressed
-                printf("Skip next instruction if key in V%X (0x%02X) is pressed; Keypad value: %d\n",
-                       chip8->inst.X, chip8->V[chip8->inst.X], chip8->keypad[chip8->V[chip8->inst.X]]);
-
-            } else if (chip8->inst.NN == 0xA1) {
-                // 0xEX9E: Skip next instruction if key in VX is not pressed
-                printf("Skip next instruction if key in V%X (0x%02X) is not pressed; Keypad value: %d\n",
-                       chip8->inst.X, chip8->V[chip8->inst.X], chip8->keypad[chip8->V[chip8->inst.X]]);
-            }
-            break;
-
-        case 0x0F:
-            switch (chip8->inst.NN) {
-                case 0x0A:
-                    // 0xFX0A: VX = get_key(); Await until a keypress, and store in VX
-                    printf("Await until a key is pressed; Store key in V%X\n",
-                           chip8->inst.X);
-                    break;
-
-                case 0x1E:
-                    // 0xFX1E: I += VX; Add VX to register I. For non-Amiga CHIP8, does not affect VF
-                    printf("I (0x%04X) += V%X (0x%02X); Result (I): 0x%04X\n",
-                           chip8->I, chip8->inst.X, chip8->V[chip8->inst.X],
-                           chip8->I + chip8->V[chip8->inst.X]);
-                    break;
-
-                case 0x07:
-                    // 0xFX07: VX = delay timer
-                    printf("Set V%X = delay timer value (0x%02X)\n",
-                           chip8->inst.X, chip8->delay_timer);
-                    break;
-
-                case 0x15:
-                    // 0xFX15: delay timer = VX 
-                    printf("Set delay timer value = V%X (0x%02X)\n",
-                           chip8->inst.X, chip8->V[chip8->inst.X]);
-                    break;
-
-                case 0x18:
-                    // 0xFX18: sound timer = VX 
-                    printf("Set sound timer value = V%X (0x%02X)\n",
-                           chip8->inst.X, chip8->V[chip8->inst.X]);
-                    break;
-
-                case 0x29:
-                    // 0xFX29: Set register I to sprite location in memory for character in VX (0x0-0xF)
-                    printf("Set I to sprite location in memory for character in V%X (0x%02X). Result(VX*5) = (0x%02X)\n",
-                           chip8->inst.X, chip8->V[chip8->inst.X], chip8->V[chip8->inst.X] * 5);
-                    break;
-
-                case 0x33:
-                    // 0xFX33: Store BCD representation of VX at memory offset from I;
-                    //   I = hundred's place, I+1 = ten's place, I+2 = one's place
-                    printf("Store BCD representation of V%X (0x%02X) at memory from I (0x%04X)\n",
-                           chip8->inst.X, chip8->V[chip8->inst.X], chip8->I);
-                    break;
-
-                case 0x55:
-                    // 0xFX55: Register dump V0-VX inclusive to memory offset from I;
-                    //   SCHIP does not inrement I, CHIP8 does increment I
-                    printf("Register dump V0-V%X (0x%02X) inclusive at memory from I (0x%04X)\n",
-                           chip8->inst.X, chip8->V[chip8->inst.X], chip8->I);
-                    break;
-
-                case 0x65:
-                    // 0xFX65: Register load V0-VX inclusive from memory offset from I;
-                    //   SCHIP does not inrement I, CHIP8 does increment I
-                    printf("Register load V0-V%X (0x%02X) inclusive at memory from I (0x%04X)\n",
-                           chip8->inst.X, chip8->V[chip8->inst.X], chip8->I);
-                    break;
-
-                default:
-                    break;
-            }
-            break;
-            
-        default:
-            printf("Unimplemented Opcode.\n");
-            break;  // Unimplemented or invalid opcode
+// Is the window out of sight, so there is no point running the ROM
+bool window_minimized(const sdl_t sdl) {
+    return SDL_GetWindowFlags(sdl.window) & (SDL_WINDOW_MINIMIZED | SDL_WINDOW_HIDDEN);
+}
+
+// Milliseconds from now until a performance counter deadline, rounded up so a wait never ends early
+int32_t ms_until(const uint64_t deadline) {
+    const uint64_t now = SDL_GetPerformanceCounter();
+    if (now >= deadline) return 0;
+
+    const uint64_t freq = SDL_GetPerformanceFrequency();
+    return (int32_t)(((deadline - now) * 1000 + freq - 1) / freq);
+}
+
+// Pass the user's input on to the emulation thread, waking it if anything changed
+void send_input(emu_t *emu, frontend_t *front, const config_t config, const bool suspended) {
+    uint32_t keys = 0;
+    for (uint8_t i = 0; i < 16; i++) keys |= (uint32_t)front->keypad[i] << i;
+
+    bool changed = (atomic_exchange(&emu->keys, keys) != keys);
+    changed |= (atomic_exchange(&emu->suspended, suspended) != suspended);
+    changed |= (atomic_exchange(&emu->speed, config.speed) != config.speed);
+    changed |= (atomic_exchange(&emu->rewinding, front->rewinding) != front->rewinding);
+    changed |= (atomic_exchange(&emu->profiling, front->profiling) != front->profiling);
+    changed |= (atomic_exchange(&emu->tracing, front->tracing) != front->tracing);
+    atomic_store(&emu->audio.volume, config.volume);
+
+    if (front->reset) {
+        atomic_store(&emu->reset, true);
+        front->reset = false;
+        changed = true;
+    }
+
+    if (front->save) {
+        atomic_store(&emu->save, true);
+        front->save = false;
+        changed = true;
+    }
+
+    if (front->load) {
+        atomic_store(&emu->load, true);
+        front->load = false;
+        changed = true;
+    }
+
+    if (front->dump_trace) {
+        atomic_store(&emu->dump_trace, true);
+        front->dump_trace = false;
+        changed = true;
+    }
+
+    if (front->state == QUIT) {
+        atomic_store(&emu->quit, true);
+        changed = true;
+    }
+
+    // 1 pending wake up is enough, the emulation thread reads all input each time it wakes
+    if (changed && SDL_SemValue(emu->wake) == 0) SDL_SemPost(emu->wake);
+}
+
+// Hand the finished display over to the render thread; never waits
+void publish_frame(emu_t *emu) {
+    // Wake the render thread, unless it still has the previous frame's wake up to handle
+    if (frames_publish(&emu->frames, emu->chip8.display)) {
+        SDL_Event event = { .type = emu->frame_event };
+        SDL_PushEvent(&event);
+    }
+}
+
+// Sleep until a performance counter deadline, or until input changes; returns false if woken early
+bool sleep_until(emu_t *emu, const uint64_t deadline) {
+    const uint64_t freq = SDL_GetPerformanceFrequency();
+
+    for (uint64_t now = SDL_GetPerformanceCounter(); now < deadline; now = SDL_GetPerformanceCounter()) {
+        const uint64_t left_ms = (deadline - now) * 1000 / freq;
+        if (left_ms > SPIN_MARGIN_MS && SDL_SemWaitTimeout(emu->wake, left_ms - SPIN_MARGIN_MS) == 0)
+            return false;   // Input changed
     }
+
+    return true;
+}
+
+// Print how fast a stretch of unlimited speed ran, i.e. the raw throughput of the core
+void print_throughput(const uint64_t frames, const uint64_t insts, const uint64_t ticks) {
+    const double seconds = (double)ticks / SDL_GetPerformanceFrequency();
+    if (seconds <= 0) return;
+
+    printf("==== UNLIMITED: %.1fx real time, %.3f mips ====\n", frames / 60.0 / seconds, insts / seconds / 1e6);
 }
-#endif
-
-// Emulate 1 CHIP8 instruction
-void emulate_instruction(chip8_t *chip8, const config_t config) {
-    bool carry;   // Save carry flag/VF value for some instructions
-
-    // Get next opcode from ram 
-    chip8->inst.opcode = (chip8->ram[chip8->PC] << 8) | chip8->ram[chip8->PC+1];
-    chip8->PC += 2; // Pre-increment program counter for next opcode
-
-    // Fill out current instruction format
-    chip8->inst.NNN = chip8->inst.opcode & 0x0FFF;
-    chip8->inst.NN = chip8->inst.opcode & 0x0FF;
-    chip8->inst.N = chip8->inst.opcode & 0x0F;
-    chip8->inst.X = (chip8->inst.opcode >> 8) & 0x0F;
-    chip8->inst.Y = (chip8->inst.opcode >> 4) & 0x0F;
-
-#ifdef DEBUG
-    print_debug_info(chip8);
-#endif
-
-    // Emulate opcode
-    switch ((chip8->inst.opcode >> 12) & 0x0F) {
-        case 0x00:
-            if (chip8->inst.NN == 0xE0) {
-                // 0x00E0: Clear the screen
-                memset(&chip8->display[0], false, sizeof chip8->display);
-                chip8->draw = true; // Will update screen on next 60hz tick
-
-            } else if (chip8->inst.NN == 0xEE) {
-                // 0x00EE: Return from subroutine
-                // Set program counter to last address on subroutine stack ("pop" it off the stack)
-                //   so that next opcode will be gotten from that address.
-                chip8->PC = *--chip8->stack_ptr;
-
-            } else {
-                // Unimplemented/invalid opcode, may be 0xNNN for calling machine code routine for RCA1802
+
+// End an input recording early, as the run it records can't be replayed past going back in time
+void stop_recording(emu_t *emu, const uint64_t frames, const uint64_t insts) {
+    record_close(emu->recording, frames, insts, &emu->chip8);
+    emu->recording = NULL;
+    puts("==== RECORDING STOPPED ====");
+}
+
+// Emulation thread: runs frames at 60hz times the speed multiplier against absolute deadlines,
+//   frame n being due exactly n/(60*speed) seconds after the clock started, so time spent
+//   emulating or rounding never adds up to drift; unlimited speed runs frames back to back.
+//   Sleeps with no timeout when there is nothing to run (paused, minimized, or the ROM only
+//   repeating itself until the next input, e.g. blocked in FX0A with its timers run out)
+int emulation_thread(void *data) {
+    emu_t *emu = data;
+    chip8_t *chip8 = &emu->chip8;
+    const config_t config = emu->config;
+    const uint64_t freq = SDL_GetPerformanceFrequency();
+
+    float speed = config.speed;
+    double frame_ticks = speed ? freq / (60.0 * speed) : 0;    // Performance counter ticks per frame
+    uint64_t unlimited_frames = 0;
+    uint64_t unlimited_insts = 0;
+
+    uint64_t epoch = SDL_GetPerformanceCounter();   // When the clock started
+    uint64_t due = 0;           // Next frame to run, counted from epoch
+    uint64_t frames = 0;        // Frames run or slept through
+    uint64_t insts_run = 0;     // Instructions run in those frames
+    idle_state_t idle = { .regs = UINT64_MAX };   // Machine state at the start of an earlier frame
+    uint32_t effects = chip8->effects - 1;
+    uint64_t idle_trip = 0;     // Frames in the loop the ROM was repeating when it went to sleep
+    uint32_t keys = 0;
+    bool sound = false;
+
+    while (!atomic_load(&emu->quit)) {
+        if (idle_trip) {
+            // Frames slept through only went around the ROM's loop; run the last part trip so it
+            //   is where it would have been without sleeping, then carry on from the next frame
+            //   (at unlimited speed no time passes for the ROM while it sleeps)
+            const uint64_t last_due = speed ? (SDL_GetPerformanceCounter() - epoch) / frame_ticks : 0;
+            const uint64_t slept = (speed && last_due >= due) ? last_due - due + 1 : 0;
+            for (uint64_t i = 0; i < slept % idle_trip; i++) {
+                insts_run += emulate_frame(chip8, config);
+                update_timers(chip8);
             }
+            frames += slept;
+            if (chip8->profile) chip8->profile->frames += slept;   // None of them draw
+            insts_run += (slept - slept % idle_trip) * (config.insts_per_second / 60);
+            chip8->ticks += slept - slept % idle_trip;
+            due += slept;
+            idle_trip = 0;
+        }
+
+        if (atomic_exchange(&emu->save, false)) {
+            snapshot_chip8(chip8, &emu->quick);
+            emu->have_quick = true;
+            if (config.save_state) save_state_file(&emu->quick, config.save_state);
+            puts("==== SAVED ====");
+        }
+
+        // Reset and quick load both jump to a snapshot
+        const bool reset = atomic_exchange(&emu->reset, false);
+        const bool load = atomic_exchange(&emu->load, false);
+        if (load && emu->recording) stop_recording(emu, frames, insts_run);
+        if (reset || load) {
+            if (reset) restore_chip8(chip8, &emu->boot);
+            else if (emu->have_quick) restore_chip8(chip8, &emu->quick);
+            else if (config.load_state) load_state_file(chip8, config.load_state);
+            publish_frame(emu);
+            keys = UINT32_MAX;      // Keypad was restored too, set it again below
+        }
 
-            break;
-
-        case 0x01:
-            // 0x1NNN: Jump to address NNN
-            chip8->PC = chip8->inst.NNN;    // Set program counter so that next opcode is from NNN
-            break;
-
-        case 0x02:
-            // 0x2NNN: Call subroutine at NNN
-            // Store current address to return to on subroutine stack ("push" it on the stack)
-            //   and set program counter to subroutine address so that the next opcode
-            //   is gotten from there.
-            *chip8->stack_ptr++ = chip8->PC;  
-            chip8->PC = chip8->inst.NNN;
-            break;
-
-        case 0x03:
-            // 0x3XNN: Check if VX == NN, if so, skip the next instruction
-            if (chip8->V[chip8->inst.X] == chip8->inst.NN)
-                chip8->PC += 2;       // Skip next opcode/instruction
-            break;
-
-        case 0x04:
-            // 0x4XNN: Check if VX != NN, if so, skip the next instruction
-            if (chip8->V[chip8->inst.X] != chip8->inst.NN)
-                chip8->PC += 2;       // Skip next opcode/instruction
-            break;
-
-        case 0x05:
-            // 0x5XY0: Check if VX == VY, if so, skip the next instruction
-            if (chip8->inst.N != 0) break; // Wrong opcode
-
-            if (chip8->V[chip8->inst.X] == chip8->V[chip8->inst.Y])
-                chip8->PC += 2;       // Skip next opcode/instruction
-            
-            break;
-
-        case 0x06:
-            // 0x6XNN: Set register VX to NN
-            chip8->V[chip8->inst.X] = chip8->inst.NN;
-            break;
-
-        case 0x07:
-            // 0x7XNN: Set register VX += NN
-            chip8->V[chip8->inst.X] += chip8->inst.NN;
-            break;
-
-        case 0x08:
-            switch(chip8->inst.N) {
-                case 0:
-                    // 0x8XY0: Set register VX = VY
-                    chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y];
-                    break;
-
-                case 1:
-                    // 0x8XY1: Set register VX |= VY
-                    chip8->V[chip8->inst.X] |= chip8->V[chip8->inst.Y];
-                    if (config.current_extension == CHIP8)
-                        chip8->V[0xF] = 0;  // Reset VF to 0
-                    break;
-
-                case 2:
-                    // 0x8XY2: Set register VX &= VY
-                    chip8->V[chip8->inst.X] &= chip8->V[chip8->inst.Y];
-                    if (config.current_extension == CHIP8)
-                        chip8->V[0xF] = 0;  // Reset VF to 0
-                    break;
-
-                case 3:
-                    // 0x8XY3: Set register VX ^= VY
-                    chip8->V[chip8->inst.X] ^= chip8->V[chip8->inst.Y];
-                    if (config.current_extension == CHIP8)
-                        chip8->V[0xF] = 0;  // Reset VF to 0
-                    break;
-
-                case 4:
-                    // 0x8XY4: Set register VX += VY, set VF to 1 if carry, 0 if not 
-                    carry = ((uint16_t)(chip8->V[chip8->inst.X] + chip8->V[chip8->inst.Y]) > 255);
-
-                    chip8->V[chip8->inst.X] += chip8->V[chip8->inst.Y];
-                    chip8->V[0xF] = carry; 
-                    break;
-
-                case 5: 
-                    // 0x8XY5: Set register VX -= VY, set VF to 1 if there is not a borrow (result is positive/0)
-                    carry = (chip8->V[chip8->inst.Y] <= chip8->V[chip8->inst.X]);
-
-                    chip8->V[chip8->inst.X] -= chip8->V[chip8->inst.Y];
-                    chip8->V[0xF] = carry;
-                    break;
-
-                case 6:
-                    // 0x8XY6: Set register VX >>= 1, store shifted off bit in VF
-                    if (config.current_extension == CHIP8) {
-                        carry = chip8->V[chip8->inst.Y] & 1;    // Use VY
-                        chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] >> 1; // Set VX = VY result
-                    } else {
-                        carry = chip8->V[chip8->inst.X] & 1;    // Use VX
-                        chip8->V[chip8->inst.X] >>= 1;          // Use VX
-                    }
-
-                    chip8->V[0xF] = carry;
-                    break;
-
-                case 7:
-                    // 0x8XY7: Set register VX = VY - VX, set VF to 1 if there is not a borrow (result is positive/0)
-                    carry = (chip8->V[chip8->inst.X] <= chip8->V[chip8->inst.Y]);
-
-                    chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] - chip8->V[chip8->inst.X];
-                    chip8->V[0xF] = carry;
-                    break;
-
-                case 0xE:
-                    // 0x8XYE: Set register VX <<= 1, store shifted off bit in VF
-                    if (config.current_extension == CHIP8) { 
-                        carry = (chip8->V[chip8->inst.Y] & 0x80) >> 7; // Use VY
-                        chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] << 1; // Set VX = VY result
-                    } else {
-                        carry = (chip8->V[chip8->inst.X] & 0x80) >> 7;  // VX
-                        chip8->V[chip8->inst.X] <<= 1;                  // Use VX
-                    }
-
-                    chip8->V[0xF] = carry;
-                    break;
-
-                default:
-                    // Wrong/unimplemented opcode
-                    break;
+        // Keys only change between frames
+        const uint32_t new_keys = atomic_load(&emu->keys);
+        if (new_keys != keys) {
+            keys = new_keys;
+            for (uint8_t i = 0; i < 16; i++) chip8->keypad[i] = (keys >> i) & 1;
+            if (emu->recording) record_input(emu->recording, frames, insts_run, keys, reset);
+            idle.regs = UINT64_MAX; // Repeats seen with the old keys say nothing about the new ones
+        }
+
+        // Profiling toggled: the interpreter counts into the profile while the machine has one,
+        //   decoding everything it runs again as it does
+        if (atomic_load(&emu->profiling) != (chip8->profile != NULL)) {
+            if (!emu->profile) emu->profile = calloc(1, sizeof *emu->profile);
+            chip8->profile = chip8->profile ? NULL : emu->profile;
+            if (chip8->profile) flush_icache(chip8, chip8->icache_extension);
+        }
+
+        // Tracing toggled: same, into a ring of the --trace size (1M instructions by default),
+        //   dumped if the process crashes while it has records
+        if (atomic_load(&emu->tracing) != (chip8->trace != NULL)) {
+            if (!emu->trace) {
+                emu->trace = trace_create(config.trace ? config.trace : 1 << 20);
+                if (emu->trace) trace_dump_on_crash(emu->trace, config.trace_file);
             }
-            break;
-
-        case 0x09:
-            // 0x9XY0: Check if VX != VY; Skip next instruction if so
-            if (chip8->V[chip8->inst.X] != chip8->V[chip8->inst.Y])
-                chip8->PC += 2;
-            break;
-
-        case 0x0A:
-            // 0xANNN: Set index register I to NNN
-            chip8->I = chip8->inst.NNN;
-            break;
-
-        case 0x0B:
-            // 0xBNNN: Jump to V0 + NNN
-            chip8->PC = chip8->V[0] + chip8->inst.NNN;
-            break;
-
-        case 0x0C:
-            // 0xCXNN: Sets register VX = rand() % 256 & NN (bitwise AND)
-            chip8->V[chip8->inst.X] = (rand() % 256) & chip8->inst.NN;
-            break;
-
-        case 0x0D: {
-            // 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
-            //   Screen pixels are XOR'd with sprite bits, 
-            //   VF (Carry flag) is set if any screen pixels are set off; This is useful
-            //   for collision detection or other reasons.
-            uint8_t X_coord = chip8->V[chip8->inst.X] % config.window_width;
-            uint8_t Y_coord = chip8->V[chip8->inst.Y] % config.window_height;
-            const uint8_t orig_X = X_coord; // Original X value
-
-            chip8->V[0xF] = 0;  // Initialize carry flag to 0
-
-            // Loop over all N rows of the sprite
-            for (uint8_t i = 0; i < chip8->inst.N; i++) {
-                // Get next byte/row of sprite data
-                const uint8_t sprite_data = chip8->ram[chip8->I + i];
-                X_coord = orig_X;   // Reset X for next row to draw
-
-                for (int8_t j = 7; j >= 0; j--) {
-                    // If sprite pixel/bit is on and display pixel is on, set carry flag
-                    bool *pixel = &chip8->display[Y_coord * config.window_width + X_coord]; 
-                    const bool sprite_bit = (sprite_data & (1 << j));
-
-                    if (sprite_bit && *pixel) {
-                        chip8->V[0xF] = 1;  
-                    }
-
-                    // XOR display pixel with sprite pixel/bit to set it on or off
-                    *pixel ^= sprite_bit;
-
-                    // Stop drawing this row if hit right edge of screen
-                    if (++X_coord >= config.window_width) break;
-                }
+            chip8->trace = chip8->trace ? NULL : emu->trace;
+        }
+
+        // Only this thread writes the trace, so only it can dump it
+        if (atomic_exchange(&emu->dump_trace, false)) {
+            if (!emu->trace) puts("==== NO TRACE TO DUMP ====");
+            else if (trace_dump(emu->trace, config.trace_file)) printf("Trace dumped to %s\n", config.trace_file);
+        }
+
+        // New speed: the clock starts again from now at the new rate
+        const float new_speed = atomic_load(&emu->speed);
+        if (new_speed != speed) {
+            const uint64_t now = SDL_GetPerformanceCounter();
+            if (!speed) print_throughput(unlimited_frames, unlimited_insts, now - epoch);
+
+            speed = new_speed;
+            frame_ticks = speed ? freq / (60.0 * speed) : 0;
+            unlimited_frames = unlimited_insts = 0;
+            epoch = now;
+            due = 0;
+        }
 
-                // Stop drawing entire sprite if hit bottom edge of screen
-                if (++Y_coord >= config.window_height) break;
+        if (atomic_load(&emu->suspended)) {
+            // No sound while nothing runs
+            if (sound && queue_sound(&emu->audio, SDL_GetPerformanceCounter(), false)) sound = false;
+
+            SDL_SemWait(emu->wake);
+            if (!speed) print_throughput(unlimited_frames, unlimited_insts, SDL_GetPerformanceCounter() - epoch);
+            unlimited_frames = unlimited_insts = 0;
+            epoch = SDL_GetPerformanceCounter();    // Restart the clock from when it runs again
+            due = 0;
+            continue;
+        }
+
+        if (speed) {
+            // Sleep until the next frame is due; input wakes it early, to be picked up first
+            const uint64_t deadline = epoch + (uint64_t)(due * frame_ticks);
+            if (!sleep_until(emu, deadline)) continue;
+
+            // Missed frames run back to back until caught up, unless too far behind
+            const uint64_t now = SDL_GetPerformanceCounter();
+            if ((now - deadline) * 1000 / freq > MAX_CATCH_UP_MS) {
+                epoch = now;
+                due = 0;
             }
-            chip8->draw = true; // Will update screen on next 60hz tick
-            break;
         }
 
-        case 0x0E:
-            if (chip8->inst.NN == 0x9E) {
-                // 0xEX9E: Skip next instruction if key in VX is pressed
-                if (chip8->keypad[chip8->V[chip8->inst.X]])
-                    chip8->PC += 2;
+        // Rewind hotkey held: each frame steps back 1 frame instead of running one, until the
+        //   history runs out; then sleep until the hotkey is let go
+        if (emu->history && atomic_load(&emu->rewinding)) {
+            if (emu->recording) stop_recording(emu, frames, insts_run);
+            if (sound && queue_sound(&emu->audio, SDL_GetPerformanceCounter(), false)) sound = false;
 
-            } else if (chip8->inst.NN == 0xA1) {
-                // 0xEX9E: Skip next instruction if key in VX is not pressed
-                if (!chip8->keypad[chip8->V[chip8->inst.X]])
-                    chip8->PC += 2;
+            if (!rewind_pop(emu->history, chip8)) {
+                SDL_SemWait(emu->wake);
+                continue;
             }
-            break;
-
-        case 0x0F:
-            switch (chip8->inst.NN) {
-                case 0x0A: {
-                    // 0xFX0A: VX = get_key(); Await until a keypress, and store in VX
-                    static bool any_key_pressed = false;
-                    static uint8_t key = 0xFF;
-
-                    for (uint8_t i = 0; key == 0xFF && i < sizeof chip8->keypad; i++) 
-                        if (chip8->keypad[i]) {
-                            key = i;    // Save pressed key to check until it is released
-                            any_key_pressed = true;
-                            break;
-                        }
 
-                    // If no key has been pressed yet, keep getting the current opcode & running this instruction
-                    if (!any_key_pressed) chip8->PC -= 2; 
-                    else {
-                        // A key has been pressed, also wait until it is released to set the key in VX
-                        if (chip8->keypad[key])     // "Busy loop" CHIP8 emulation until key is released
-                            chip8->PC -= 2;
-                        else {
-                            chip8->V[chip8->inst.X] = key;     // VX = key 
-                            key = 0xFF;                        // Reset key to not found 
-                            any_key_pressed = false;           // Reset to nothing pressed yet
-                        }
-                    }
-                    break;
-                }
+            if (take_changed_rows(chip8)) publish_frame(emu);
+            chip8->draw = false;
+            keys = UINT32_MAX;      // Keypad was restored too, set it again next frame
+            due++;
+            frames++;
+            continue;
+        }
 
-                case 0x1E:
-                    // 0xFX1E: I += VX; Add VX to register I. For non-Amiga CHIP8, does not affect VF
-                    chip8->I += chip8->V[chip8->inst.X];
-                    break;
-
-                case 0x07:
-                    // 0xFX07: VX = delay timer
-                    chip8->V[chip8->inst.X] = chip8->delay_timer;
-                    break;
-
-                case 0x15:
-                    // 0xFX15: delay timer = VX 
-                    chip8->delay_timer = chip8->V[chip8->inst.X];
-                    break;
-
-                case 0x18:
-                    // 0xFX18: sound timer = VX 
-                    chip8->sound_timer = chip8->V[chip8->inst.X];
-                    break;
-
-                case 0x29:
-                    // 0xFX29: Set register I to sprite location in memory for character in VX (0x0-0xF)
-                    chip8->I = chip8->V[chip8->inst.X] * 5;
-                    break;
-
-                case 0x33: {
-                    // 0xFX33: Store BCD representation of VX at memory offset from I;
-                    //   I = hundred's place, I+1 = ten's place, I+2 = one's place
-                    uint8_t bcd = chip8->V[chip8->inst.X]; 
-                    chip8->ram[chip8->I+2] = bcd % 10;
-                    bcd /= 10;
-                    chip8->ram[chip8->I+1] = bcd % 10;
-                    bcd /= 10;
-                    chip8->ram[chip8->I] = bcd;
-                    break;
-                }
+        // A frame starting in the same state as an earlier one, with no RAM, stack, display or
+        //   RNG writes since and the keys unchanged, starts a repeat of the frames in between
+        //   until the next input; sleep until then instead of running them, unless profiling or tracing them
+        const bool idle_frame = (chip8->effects == effects);
+        effects = chip8->effects;
 
-                case 0x55:
-                    // 0xFX55: Register dump V0-VX inclusive to memory offset from I;
-                    // CHIP8 does increment I
-                    for (uint8_t i = 0; i <= chip8->inst.X; i++)  {
-                        if (config.current_extension == CHIP8) 
-                            chip8->ram[chip8->I++] = chip8->V[i]; // Increment I each time
-                        else
-                            chip8->ram[chip8->I + i] = chip8->V[i]; 
-                    }
-                    break;
-
-                case 0x65:
-                    // 0xFX65: Register load V0-VX inclusive from memory offset from I;
-                    //   SCHIP does not increment I, CHIP8 does increment I
-                    for (uint8_t i = 0; i <= chip8->inst.X; i++) {
-                        if (config.current_extension == CHIP8) 
-                            chip8->V[i] = chip8->ram[chip8->I++]; // Increment I each time
-                        else
-                            chip8->V[i] = chip8->ram[chip8->I + i];
-                    }
-                    break;
-
-                default:
-                    break;
-            }
-            break;
-            
-        default:
-            break;  // Unimplemented or invalid opcode
+        if (config.idle_skip && !chip8->profile && !chip8->trace && idle_frame && idle_repeat(chip8, &idle, chip8->PC)) {
+            idle_trip = frames - idle.count;
+            SDL_SemWait(emu->wake);
+            continue;
+        }
+        if (idle_frame) idle.count = frames;
+
+        due++;
+        frames++;
+
+        // Keep the state this frame starts in, to rewind to
+        if (emu->history) rewind_push(emu->history, chip8);
+
+        // Emulate CHIP8 Instructions for this emulator "frame" (60hz), and hand the display to
+        //   the render thread if it changed; rows that were drawn but ended up unchanged (e.g. a
+        //   sprite erased and redrawn in place) don't count
+        const uint32_t insts = emulate_frame(chip8, config);
+        insts_run += insts;
+        if (take_changed_rows(chip8)) publish_frame(emu);
+        profile_frame(chip8);
+        chip8->draw = false;
+
+        // Update delay & sound timers every 60hz, and start or stop the tone at the time the frame
+        //   was due; a change that doesn't fit in the queue is tried again next frame
+        const uint64_t frame_start = speed ? epoch + (uint64_t)((due - 1) * frame_ticks) : SDL_GetPerformanceCounter();
+        const bool beep = update_timers(chip8);
+        if (beep != sound && queue_sound(&emu->audio, frame_start, beep)) sound = beep;
+
+        if (!speed) {
+            unlimited_frames++;
+            unlimited_insts += insts;
+        }
     }
-}
 
-// Update CHIP8 delay and sound timers every 60hz
-void update_timers(const sdl_t sdl, chip8_t *chip8) {
-    if (chip8->delay_timer > 0) 
-        chip8->delay_timer--;
+    if (!speed) print_throughput(unlimited_frames, unlimited_insts, SDL_GetPerformanceCounter() - epoch);
+    if (emu->recording) record_close(emu->recording, frames, insts_run, chip8);
 
-    if (chip8->sound_timer > 0) {
-        chip8->sound_timer--;
-        SDL_PauseAudioDevice(sdl.dev, 0); // Play sound
-    } else {
-        SDL_PauseAudioDevice(sdl.dev, 1); // Pause sound
+    // Traced at some point: dump the newest instructions
+    if (emu->trace) {
+        chip8->trace = NULL;
+        trace_dump_on_crash(NULL, NULL);
+        if (trace_dump(emu->trace, config.trace_file)) printf("Trace dumped to %s\n", config.trace_file);
+        trace_destroy(emu->trace);
     }
+
+    return 0;
 }
 
 // Da main squeeze
@@ -1102,60 +767,103 @@ int main(int argc, char **argv) {
     config_t config = {0};
     if (!set_config_from_args(&config, argc, argv)) exit(EXIT_FAILURE);
 
-    // Initialize SDL
-    sdl_t sdl = {0};
-    if (!init_sdl(&sdl, &config)) exit(EXIT_FAILURE);
+    // Seed random number generator, unless given a seed to repeat a run with
+    if (!config.rng_seed) config.rng_seed = (uint32_t)time(NULL);
+
+    // Headless runs can play back recorded input, with the settings it was recorded with
+    input_log_t *replay = NULL;
+    if (config.headless && config.replay && !(replay = replay_open(config.replay, &config)))
+        exit(EXIT_FAILURE);
 
     // Initialize CHIP8 machine
-    chip8_t chip8 = {0};
+    emu_t *emu = calloc(1, sizeof *emu);
+    if (!emu) exit(EXIT_FAILURE);
     const char *rom_name = argv[1];
-    if (!init_chip8(&chip8, config, rom_name)) exit(EXIT_FAILURE);
-
-    // Initial screen clear to background color
-    clear_screen(sdl, config);
-
-    // Seed random number generator
-    srand(time(NULL));
-
-    // Main emulator loop
-    while (chip8.state != QUIT) {
-        // Handle user input
-        handle_input(&chip8, &config);
-
-        if (chip8.state == PAUSED) continue;
-
-        // Get time before running instructions 
-        const uint64_t start_frame_time = SDL_GetPerformanceCounter();
-        
-        // Emulate CHIP8 Instructions for this emulator "frame" (60hz)
-        for (uint32_t i = 0; i < config.insts_per_second / 60; i++) {
-            emulate_instruction(&chip8, config);
+    if (!init_chip8(&emu->chip8, config, rom_name)) exit(EXIT_FAILURE);
+    snapshot_chip8(&emu->chip8, &emu->boot);
+    if (replay) replay->boot = emu->boot;
+    if (config.load_state && !load_state_file(&emu->chip8, config.load_state)) exit(EXIT_FAILURE);
+
+    // Headless runs never touch SDL
+    if (config.headless) {
+        const bool ok = run_headless(&emu->chip8, config, replay);
+        replay_close(replay);
+        exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
 
-            // If drawing on CHIP8, only draw 1 sprite this frame (display wait)
-            if ((config.current_extension == CHIP8) && 
-                (chip8.inst.opcode >> 12 == 0xD)) 
-                break;  
-        }
+    if (config.rewind_mb) emu->history = rewind_create((size_t)config.rewind_mb << 20);
+    if (config.record && !(emu->recording = record_open(config.record, config))) exit(EXIT_FAILURE);
 
-        // Get time elapsed after running instructions
-        const uint64_t end_frame_time = SDL_GetPerformanceCounter();
+    // Initialize SDL
+    sdl_t sdl = {0};
+    if (!init_sdl(&sdl, &config, &emu->audio)) exit(EXIT_FAILURE);
 
-        // Delay for approximately 60hz/60fps (16.67ms) or actual time elapsed
-        const double time_elapsed = (double)((end_frame_time - start_frame_time) * 1000) / SDL_GetPerformanceFrequency();
+    // Initial screen clear to background color
+    clear_screen(sdl, config);
 
-        SDL_Delay(16.67f > time_elapsed ? 16.67f - time_elapsed : 0);
+    // Pixels start out at the background color, whole screen is drawn on the first present
+    frontend_t front = {
+        .state = RUNNING,
+        .profiling = (config.profile || config.heatmap),
+        .tracing = (config.trace != 0),
+    };
+    for (uint32_t i = 0; i < 64*32; i++) front.screen.pixel_color[i] = config.bg_color;
+    front.screen.fading_rows = UINT32_MAX;
+
+    // Start emulating on its own thread
+    emu->config = config;
+    emu->speed = config.speed;
+    emu->profiling = front.profiling;
+    emu->tracing = front.tracing;
+    emu->frame_event = SDL_RegisterEvents(1);
+    emu->wake = SDL_CreateSemaphore(0);
+    frames_init(&emu->frames);
+
+    SDL_Thread *thread = emu->wake ? SDL_CreateThread(emulation_thread, "emulation", emu) : NULL;
+    if (!thread) {
+        SDL_Log("Could not start emulation thread %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
 
-        // Update window with changes every 60hz
-        if (chip8.draw) {
-          update_screen(sdl, config, &chip8);
-          chip8.draw = false;
+    // Main (render) loop, event driven: sleeps until input or a new frame arrives. Presents at
+    //   most every 60hz, so frames arriving faster (fast forward, or catching up after falling
+    //   behind) are skipped and only the newest is drawn; rows still fading are faded every 60hz
+    const uint64_t frame_time = SDL_GetPerformanceFrequency() / 60;
+    uint64_t next_present = SDL_GetPerformanceCounter();
+
+    while (front.state != QUIT) {
+        // Handle user input, waiting for the next present when there is something to present
+        const bool pending = frames_pending(&emu->frames) || front.screen.fading_rows;
+        handle_input(&front, &config, pending ? ms_until(next_present) : -1);
+        send_input(emu, &front, config, front.state == PAUSED || window_minimized(sdl));
+
+        const uint64_t now = SDL_GetPerformanceCounter();
+        if (now < next_present) continue;
+
+        // Update window with the newest frame's changes and the rows still fading
+        const uint32_t rows = frames_take(&emu->frames, front.screen.display) | front.screen.fading_rows;
+        if (rows) {
+            update_screen(sdl, config, &front.screen, rows);
+            next_present = now + frame_time;
         }
-        
-        // Update delay & sound timers every 60hz
-        update_timers(sdl, &chip8);
     }
 
     // Final cleanup
+    SDL_WaitThread(thread, NULL);
+
+    // Profiled at some point: write the report (to profile.json if only turned on with F7)
+    //   and heatmap asked for
+    if (emu->profile) {
+        const char *report = config.profile ? config.profile : (config.heatmap ? NULL : "profile.json");
+        if (report && write_profile(emu->profile, &emu->chip8, report)) printf("Profile written to %s\n", report);
+        if (config.heatmap) write_heatmap(emu->profile, config.heatmap);
+        free(emu->profile);
+    }
+
+    SDL_DestroySemaphore(emu->wake);
+    jit_destroy(&emu->chip8);
+    rewind_destroy(emu->history);
+    free(emu);
     final_cleanup(sdl); 
 
     exit(EXIT_SUCCESS);
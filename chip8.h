@@ -0,0 +1,793 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Emulator states
+typedef enum {
+    QUIT,
+    RUNNING,
+    PAUSED,
+} emulator_state_t;
+
+// CHIP-8 extensions/quirks support
+typedef enum {
+    CHIP8,
+    SUPERCHIP,
+    XOCHIP,
+} extension_t;
+
+// CPU engine used to run CHIP8 code
+typedef enum {
+    INTERPRETER,    // Interpreter only (threaded or switch dispatch, chosen at build time)
+    JIT,            // x86-64 dynamic recompiler, falls back to the interpreter when it can't compile
+    JIT_LOCKSTEP,   // JIT, with every compiled block checked against the interpreter
+} engine_t;
+
+// Phosphor fade kernel used to lerp pixel colors
+typedef enum {
+    FADE_AUTO,      // Fastest one the host CPU supports
+    FADE_SCALAR,
+    FADE_SSE2,
+    FADE_AVX2,
+} fade_kernel_t;
+
+// JIT code cache, opaque outside jit.c
+typedef struct jit jit_t;
+
+// Rewind history, opaque outside rewind.c
+typedef struct rewind rewind_t;
+
+// Emulator configuration object
+typedef struct {
+    uint32_t window_width;      // SDL window width
+    uint32_t window_height;     // SDL window height
+    uint32_t fg_color;          // Foreground color RGBA8888
+    uint32_t bg_color;          // Background color RGBA8888
+    uint32_t scale_factor;      // Amount to scale a CHIP8 pixel by e.g. 20x will be a 20x larger window
+    bool pixel_outlines;        // Draw pixel "outlines" yes/no
+    uint32_t insts_per_second;  // CHIP8 CPU "clock rate" or hz
+    float speed;                // Emulated time per real time, e.g. 2 = fast forward 2x (0 = unlimited)
+    uint32_t square_wave_freq;  // Frequency of square wave sound e.g. 440hz for middle A
+    uint32_t audio_sample_rate;
+    int16_t volume;             // How loud or not is the sound
+    float color_lerp_rate;      // Amount to lerp colors by, between [0.1, 1.0]
+    extension_t current_extension;  // Current quirks/extension support for e.g. CHIP8 vs. SUPERCHIP
+    engine_t engine;            // Interpreter or JIT
+    bool headless;              // Run without window/audio, as fast as the host allows
+    bool fuse;                  // Fuse common instruction sequences into superinstructions
+    bool idle_skip;             // Skip the rest of a frame spent in a loop waiting on a timer/key
+    uint64_t max_frames;        // Headless: stop after this many 60hz frames (0 = no limit)
+    uint64_t max_insts;         // Headless: stop after this many instructions (0 = no limit)
+    uint32_t rng_seed;          // Seed for CXNN random numbers (0 = fixed default seed)
+    const char *load_state;     // Save state file to resume from once the ROM is loaded (NULL = none)
+    const char *save_state;     // Save state file written at the end of a headless run or on F5
+    uint32_t rewind_mb;         // Rewind history size in MB (0 = no rewind)
+    const char *record;         // Input recording file to write (NULL = don't record)
+    const char *replay;         // Headless: input recording file to play back (NULL = none)
+    const char *profile;        // Profile report written at the end of the run, JSON or .csv (NULL = none)
+    const char *heatmap;        // PC heatmap image written at the end of the run, PGM (NULL = none)
+    uint32_t trace;             // Instructions kept in the trace ring buffer (0 = no tracing)
+    const char *trace_file;     // File the trace is dumped to on demand, at exit or on a crash
+} config_t;
+
+// CHIP8 Instruction format
+typedef struct {
+    uint16_t opcode;
+    uint16_t NNN;   // 12 bit address/constant
+    uint8_t NN;     // 8 bit constant
+    uint8_t N;      // 4 bit constant
+    uint8_t X;      // 4 bit register identifier
+    uint8_t Y;      // 4 bit register identifier
+} instruction_t;
+
+// Decoded instruction operations, one per distinct CHIP8 behavior with quirks already resolved
+typedef enum {
+    OP_DECODE,          // Predecode cache entry not decoded yet (or invalidated by a RAM write)
+    OP_NOP,             // Unimplemented/invalid opcode, e.g. 0NNN
+    OP_CLS,             // 00E0
+    OP_RET,             // 00EE
+    OP_JP,              // 1NNN
+    OP_CALL,            // 2NNN
+    OP_SE_VX_NN,        // 3XNN
+    OP_SNE_VX_NN,       // 4XNN
+    OP_SE_VX_VY,        // 5XY0
+    OP_LD_VX_NN,        // 6XNN
+    OP_ADD_VX_NN,       // 7XNN
+    OP_LD_VX_VY,        // 8XY0
+    OP_OR,              // 8XY1
+    OP_OR_VF_RESET,     // 8XY1, CHIP8: VF = 0
+    OP_AND,             // 8XY2
+    OP_AND_VF_RESET,    // 8XY2, CHIP8: VF = 0
+    OP_XOR,             // 8XY3
+    OP_XOR_VF_RESET,    // 8XY3, CHIP8: VF = 0
+    OP_ADD_VX_VY,       // 8XY4
+    OP_SUB,             // 8XY5
+    OP_SHR_VX,          // 8XY6
+    OP_SHR_VY,          // 8XY6, CHIP8: VX = VY >> 1
+    OP_SUBN,            // 8XY7
+    OP_SHL_VX,          // 8XYE
+    OP_SHL_VY,          // 8XYE, CHIP8: VX = VY << 1
+    OP_SNE_VX_VY,       // 9XY0
+    OP_LD_I,            // ANNN
+    OP_JP_V0,           // BNNN
+    OP_RND,             // CXNN
+    OP_DRW,             // DXYN
+    OP_DRW_WAIT,        // DXYN, CHIP8: end the frame after drawing (display wait)
+    OP_SKP,             // EX9E
+    OP_SKNP,            // EXA1
+    OP_LD_VX_DT,        // FX07
+    OP_LD_VX_K,         // FX0A
+    OP_LD_DT_VX,        // FX15
+    OP_LD_ST_VX,        // FX18
+    OP_ADD_I_VX,        // FX1E
+    OP_LD_F_VX,         // FX29
+    OP_LD_B_VX,         // FX33
+    OP_STORE,           // FX55
+    OP_STORE_INC_I,     // FX55, CHIP8: I is incremented
+    OP_LOAD,            // FX65
+    OP_LOAD_INC_I,      // FX65, CHIP8: I is incremented
+
+    // Fused superinstructions, only ever made by the threaded interpreter's predecode
+    OP_FUSED_ADD_SKIP_JP,   // 7XNN + 3XNN/4XNN + 1NNN, loop counter back edge
+    OP_FUSED_DT_SKIP_JP,    // FX07 + 3XNN/4XNN + 1NNN, delay timer polling
+    OP_FUSED_LD_I_DRW,      // ANNN + DXYN, sprite draw
+    OP_FUSED_ADD_I_LOAD,    // FX1E + FX65, table load
+    OP_COUNT,
+} op_t;
+
+#define OP_FUSED_FIRST OP_FUSED_ADD_SKIP_JP
+#define NUM_FUSED_OPS (OP_COUNT - OP_FUSED_FIRST)
+
+// Pre-decoded instruction; operation plus already extracted operands
+typedef struct {
+    uint8_t op;     // op_t
+    uint8_t X;      // 4 bit register identifier
+    uint8_t Y;      // 4 bit register identifier
+    uint8_t N;      // 4 bit constant
+    uint8_t NN;     // 8 bit constant
+    uint16_t NNN;   // 12 bit address/constant
+} decoded_t;
+
+// Idle loop detection, shared by the interpreters and the headless runner
+//   Timers only tick and keys only change between interpreter runs, so if a loop comes back
+//   around to the same instruction with the machine in the same state, with no RAM, stack,
+//   display or RNG writes in between, it will keep doing exactly that until the run ends.
+//   Machine state last seen at a loop's back edge, packed so comparing it is a few word compares:
+typedef struct {
+    uint64_t V[2];          // V0-VF
+    uint64_t regs;          // PC of the back edge, I, timers and FX0A state; UINT64_MAX = none yet
+    uint16_t *stack_ptr;
+    uint32_t effects;
+    uint64_t count;         // Instructions (or frames) run so far when seen
+} idle_state_t;
+
+// Execution profile of a machine (profile.c), counted only while chip8->profile points at one
+typedef struct {
+    int64_t runs[4096 + 2];         // Straight runs of instructions (no jump, skip or stop in between)
+                                    //   starting (+) at the address of their first and ending (-) 2
+                                    //   past their last, wrapped; ones going past the end of RAM end
+                                    //   there and start again at 0. Reports sum these into
+                                    //   instructions run per address, even and odd addresses apart
+    uint64_t ops[OP_COUNT];         // Instructions run per operation, but for the ones run from the
+                                    //   icache: those are counted by what each entry was decoded as
+    uint8_t cached[4096/2];         // Operation each icache entry was last decoded as while profiling,
+                                    //   OP_DECODE if never
+    uint64_t cached_from[4096/2];   // Instructions run at its address before it was decoded as that
+    uint64_t reads[17][4096];       // Data reads (sprite rows, FX65), not fetches, by how many bytes
+                                    //   (0-16) and the address they start at, running off the end of
+                                    //   RAM to its start; reports sum these into reads per address
+    uint64_t writes[17][4096];      // Writes (FX33, FX55), the same way
+    uint64_t collisions;            // Sprites drawn that turned a pixel off
+    uint64_t frames;                // Frames run while profiling
+    uint64_t draw_frames;           // Frames that drew to the display
+} profile_t;
+
+// Instruction trace record (trace.c), 1 per instruction run while chip8->trace is set
+//   What the instruction did beyond this (e.g. where 00EE returned to, whether a skip skipped)
+//   shows in the PC of the record after it
+typedef struct {
+    uint16_t PC;        // Address the instruction ran at
+    uint16_t opcode;
+    uint16_t I;         // I before it ran
+    uint8_t VX;         // VX before it ran
+    uint8_t VY;         // VY before it ran
+    uint8_t result;     // VX after it ran, the register most instructions change
+    uint8_t VF;         // VF after it ran
+    uint8_t depth;      // Subroutine stack depth before it ran
+    uint8_t reserved;   // Zero
+    uint32_t tick;      // 60hz timer tick it ran in (low 32 bits)
+} trace_record_t;
+
+_Static_assert(sizeof(trace_record_t) == 16, "trace_record_t layout is part of the trace file format");
+
+// Ring of the newest trace records; only ever written by the thread running the machine, which is
+//   also the only one to dump it (or its signal handler, on a crash), so it needs no locking
+typedef struct {
+    trace_record_t *records;
+    uint64_t mask;          // Records in the ring - 1, a power of 2 - 1
+    uint64_t head;          // Records written so far; the newest is records[(head - 1) & mask]
+    trace_record_t *last;   // Newest record if its result and VF are still to be filled in
+} trace_t;
+
+// Subroutine stack entries; the stack is a ring, so a call nested deeper than that wraps around
+//   to its first entry and overwrites it, and a return with nothing pushed pops its last entry
+#define STACK_SIZE 12
+
+// CHIP8 Machine object
+typedef struct {
+    emulator_state_t state;
+    uint8_t ram[4096];
+    uint64_t display[32];   // Emulate original CHIP8 resolution pixels, 1 bit per pixel, 1 word per row
+    uint16_t stack[STACK_SIZE];     // Subroutine stack, through stack_push()/stack_pop()
+    uint16_t *stack_ptr;
+    uint8_t V[16];          // Data registers V0-VF
+    uint16_t I;             // Index register
+    uint16_t PC;            // Program Counter
+    uint64_t ticks;         // 60hz timer ticks so far, i.e. emulated time in frames
+    uint64_t delay_end;     // Tick the delay timer runs out at; read through read_delay_timer()
+    uint64_t sound_end;     // Tick the sound timer runs out at, tone plays until then
+    bool keypad[16];        // Hexadecimal keypad 0x0-0xF
+    uint8_t wait_key;       // FX0A: key pressed while waiting for its release, 0xFF = none yet
+    uint32_t rng;           // CXNN random number generator state (xorshift32)
+    const char *rom_name;   // Currently running ROM
+    instruction_t inst;     // Currently executing instruction
+    bool draw;              // Update the screen yes/no
+    uint32_t dirty_rows;    // Display rows touched by 00E0/DXYN since the last present, 1 bit per row
+    uint64_t presented[32]; // Display contents as of the last present
+    decoded_t icache[4096/2];       // Predecoded instructions, 1 per even RAM address
+    extension_t icache_extension;   // Extension/quirks the icache entries were decoded for
+    bool fuse;              // Predecode common instruction sequences as fused superinstructions
+    uint64_t fused_insts[NUM_FUSED_OPS];    // Instructions run inside each kind of superinstruction
+    bool idle_skip;         // Skip instructions of idle loops (see idle_skip())
+    uint32_t effects;       // Bumped by every RAM, stack, display and RNG write
+    uint64_t idle_insts;    // Instructions skipped as idle
+    idle_state_t idle;      // Last loop back edge of the current interpreter run, for idle_skip()
+    jit_t *jit;             // JIT compiled code for this machine, created on first JIT run
+    profile_t *profile;     // Execution counts, NULL when not profiling; runs at full speed then
+    trace_t *trace;         // Instruction trace, NULL when not tracing; same
+} chip8_t;
+
+// Is the display pixel at X,Y on; the leftmost pixel of a row is its most significant bit
+static inline bool display_pixel(const chip8_t *chip8, const uint32_t x, const uint32_t y) {
+    return (chip8->display[y] >> (63 - x)) & 1;
+}
+
+// Delay and sound timers count down at 60hz. Rather than being decremented every tick, each is kept
+//   as the tick it runs out at, and its value worked out only when something reads it (FX07, the
+//   audio path), so time can pass in any steps at no cost and timers stay exact at any speed
+static inline uint8_t read_delay_timer(const chip8_t *chip8) {
+    return (chip8->delay_end > chip8->ticks) ? chip8->delay_end - chip8->ticks : 0;
+}
+
+static inline uint8_t read_sound_timer(const chip8_t *chip8) {
+    return (chip8->sound_end > chip8->ticks) ? chip8->sound_end - chip8->ticks : 0;
+}
+
+static inline void set_delay_timer(chip8_t *chip8, const uint8_t value) {
+    chip8->delay_end = chip8->ticks + value;
+}
+
+static inline void set_sound_timer(chip8_t *chip8, const uint8_t value) {
+    chip8->sound_end = chip8->ticks + value;
+}
+
+// Store a byte to CHIP8 RAM; every RAM write must go through here so that the
+//   predecoded instruction covering that address is decoded again before it runs
+static inline void write_ram(chip8_t *chip8, const uint16_t address, const uint8_t value) {
+    chip8->ram[address & 0xFFF] = value;
+    chip8->effects++;
+    chip8->icache[(address >> 1) & (sizeof chip8->icache / sizeof chip8->icache[0] - 1)].op = OP_DECODE;
+}
+
+// Push a return address on the subroutine stack (2NNN)
+static inline void stack_push(chip8_t *chip8, const uint16_t address) {
+    *chip8->stack_ptr++ = address;
+    if (chip8->stack_ptr == &chip8->stack[STACK_SIZE]) chip8->stack_ptr = chip8->stack;
+}
+
+// Pop the last return address off the subroutine stack (00EE)
+static inline uint16_t stack_pop(chip8_t *chip8) {
+    if (chip8->stack_ptr == chip8->stack) chip8->stack_ptr = &chip8->stack[STACK_SIZE];
+    return *--chip8->stack_ptr;
+}
+
+// Position independent copy of a machine's state, for save states and fast resets
+//   No pointers and no host caches (icache, JIT), so it can be copied with memcpy, written to
+//   disk as is, and memory mapped back in. Only what changes how the ROM runs from here on is kept
+typedef struct {
+    uint8_t ram[4096];
+    uint64_t display[32];   // Same packed rows as chip8_t display
+    uint64_t ticks;         // 60hz timer ticks so far
+    uint64_t delay_end;     // Tick the delay timer runs out at
+    uint64_t sound_end;     // Tick the sound timer runs out at
+    uint16_t stack[STACK_SIZE];     // Subroutine stack
+    uint16_t I;             // Index register
+    uint16_t PC;            // Program Counter
+    uint8_t V[16];          // Data registers V0-VF
+    uint16_t keypad;        // Keys held, 1 bit per key 0x0-0xF
+    uint8_t stack_depth;    // Entry of the subroutine stack ring the next call goes in, instead of stack_ptr
+    uint8_t wait_key;       // FX0A: key pressed while waiting for its release, 0xFF = none yet
+    uint32_t rng;           // CXNN random number generator state (xorshift32)
+    uint8_t state;          // emulator_state_t
+    uint8_t reserved[3];    // Zero, keeps the size a multiple of 8
+} chip8_state_t;
+
+_Static_assert(sizeof(chip8_state_t) == 4432, "chip8_state_t layout is part of the save state format");
+
+// Keypad change in an input recording
+typedef struct {
+    uint64_t frame;     // Frame the change happens before
+    uint64_t insts;     // Instructions run before that frame, to check a replay is still in step
+    uint16_t keys;      // Keys held from then on, 1 bit per key 0x0-0xF
+    bool reset;         // Machine was reset before the keys changed
+} input_event_t;
+
+// Input recording being written, or read back for replay (input.c)
+typedef struct {
+    uint32_t rng_seed;          // Settings the recording was made with
+    uint32_t insts_per_second;
+    extension_t extension;
+    uint64_t frames;            // Replay: length of the recording; recording: frame of the last event
+    uint64_t insts;             // Same, for instructions run
+    uint64_t display_hash;      // Replay: display hash the recording ended with
+    input_event_t *events;      // Replay: all events, in order
+    uint32_t num_events;
+    chip8_state_t boot;         // Replay: machine as first loaded, restored on reset events
+    FILE *file;                 // Recording: file being written
+} input_log_t;
+
+// Machines per SIMD group in the multi-machine engine (envs.c)
+#define ENV_LANES 32
+
+// ENV_LANES machines running the same ROM, stored as structure of arrays: [register][machine]
+typedef struct {
+    _Alignas(64) uint8_t V[16][ENV_LANES];      // Data registers V0-VF
+    _Alignas(64) uint16_t I[ENV_LANES];         // Index registers
+    _Alignas(64) uint16_t PC[ENV_LANES];        // Program counters
+    _Alignas(64) uint8_t delay_timer[ENV_LANES];
+    _Alignas(64) uint8_t sound_timer[ENV_LANES];
+    _Alignas(64) uint16_t keypad[ENV_LANES];    // Keys held, 1 bit per key 0x0-0xF
+    _Alignas(64) uint8_t wait_key[ENV_LANES];   // FX0A: key pressed while waiting for its release, 0xFF = none yet
+    _Alignas(64) uint32_t rng[ENV_LANES];       // CXNN random number generator states (xorshift32)
+    _Alignas(64) uint8_t stack_depth[ENV_LANES];
+    _Alignas(64) uint16_t stack[STACK_SIZE][ENV_LANES];     // Subroutine stacks
+    _Alignas(64) uint8_t display[32][8][ENV_LANES]; // chip8_t display rows as 8 byte columns each, left to right
+    _Alignas(64) uint8_t ram[4096][ENV_LANES];  // Interleaved, so 1 address across the group is 1 vector
+} env_group_t;
+
+// Many machines running the same ROM, stepped together for e.g. reinforcement learning
+typedef struct {
+    uint32_t count;         // Number of machines (environments)
+    uint32_t num_groups;    // count / ENV_LANES, rounded up
+    env_group_t *groups;    // Machine n is lane n % ENV_LANES of group n / ENV_LANES
+    config_t config;
+    chip8_t *initial;       // Freshly loaded machine, copied on reset
+} envs_t;
+
+// Finished displays handed from the emulation thread to the render thread (frames.c)
+typedef struct {
+    uint64_t frames[3][32];
+    atomic_uint middle;     // Index of the middle frame, | FRAME_NEW until the render thread takes it
+    uint32_t back;          // Frame the emulation thread fills next, only touched by it
+    uint32_t front;         // Frame the render thread took last, only touched by it
+} frames_t;
+
+#define SOUND_QUEUE_SIZE 256     // Power of 2
+#define SOUND_RAMP_SAMPLES 64    // Tone fades in/out over this many samples instead of clicking on/off
+
+// Sound timer turning on or off, stamped with the host clock time it happened at
+typedef struct {
+    uint64_t time;
+    bool on;
+} sound_event_t;
+
+// Audio engine (audio.c)
+//   The emulation thread queues sound on/off changes through a lock-free single producer, single
+//   consumer queue, and the audio callback renders each one at the sample it falls on, a fixed
+//   delay of a little over 1 buffer later so all changes within a buffer are in before it is
+//   rendered. The device is never paused; silence is just the tone being off.
+//   The tone is a 128 bit pattern played on a loop, laid out like XO-CHIP's audio pattern buffer;
+//   1 cycle of a square wave at square_wave_freq
+typedef struct {
+    sound_event_t events[SOUND_QUEUE_SIZE];
+    atomic_uint head;       // Next event to write, only written by the emulation thread
+    atomic_uint tail;       // Next event to read, only written by the audio callback
+    atomic_int volume;      // config.volume, written by the render thread
+
+    // Audio callback only
+    uint8_t pattern[16];    // 1 = high, most significant bit of byte 0 first
+    uint32_t phase;         // Position in the pattern, the top 7 bits are the bit index
+    uint32_t phase_step;    // Pattern position advanced per sample
+    bool on;                // Tone on or off as of the last event rendered
+    int32_t gain;           // Fade in/out envelope, 0 to SOUND_RAMP_SAMPLES
+    int64_t base;           // Host clock time of sample 0 of the current second
+    int64_t samples;        // Samples rendered since base
+    int64_t delay;          // How long after an event it is rendered, in host clock ticks
+    int64_t sample_rate;
+    int64_t freq;           // Host clock ticks per second (performance counter frequency)
+} audio_t;
+
+// Next random byte for CXNN; per machine so machines on different threads don't share state
+static inline uint8_t random_byte(chip8_t *chip8) {
+    uint32_t x = chip8->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    chip8->rng = x;
+    chip8->effects++;
+    return x >> 24;
+}
+
+// 0xDXYN helper, shared by all instruction dispatch engines
+//   wrap: XO-CHIP wraps sprites around the screen edges, others clip; pass a constant so it folds away
+static inline void draw_sprite(chip8_t *chip8, const uint8_t X, const uint8_t Y, const uint8_t N, const bool wrap) {
+    // 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
+    //   Screen pixels are XOR'd with sprite bits, 
+    //   VF (Carry flag) is set if any screen pixels are set off; This is useful
+    //   for collision detection or other reasons.
+    //   Each sprite row is shifted into place and XOR'd with a whole display row at once.
+    const uint8_t width = 64;   // Packed display size, 1 bit per pixel, 1 word per row
+    const uint8_t height = 32;
+    const uint8_t X_coord = chip8->V[X] % width;
+    const uint8_t Y_coord = chip8->V[Y] % height;
+    uint64_t collisions = 0;
+
+    // Loop over all N rows of the sprite
+    for (uint8_t i = 0; i < N; i++) {
+        uint8_t row = Y_coord + i;
+        if (row >= height) {
+            if (!wrap) break;   // Stop drawing entire sprite if hit bottom edge of screen
+            row %= height;
+        }
+
+        // Get next byte/row of sprite data, lined up with its X position on the display row;
+        //   bits shifted past the right edge of the screen are clipped (or wrapped)
+        const uint64_t sprite_data = (uint64_t)chip8->ram[(chip8->I + i) & 0xFFF] << 56;
+        uint64_t sprite_row = sprite_data >> X_coord;
+        if (wrap && X_coord) sprite_row |= sprite_data << (64 - X_coord);
+
+        // Any sprite bit landing on a set display pixel is a collision
+        collisions |= chip8->display[row] & sprite_row;
+
+        // XOR display pixels with sprite bits to set them on or off
+        chip8->display[row] ^= sprite_row;
+        chip8->dirty_rows |= 1u << row;
+    }
+
+    chip8->V[0xF] = (collisions != 0);  // Set carry flag if any pixel was turned off
+    chip8->draw = true; // Will update screen on next 60hz tick
+    chip8->effects++;
+}
+
+// Count a change of flow into a profile: the straight run before it ends with the instruction
+//   before from (the address after it), the next one starts at PC
+static inline void profile_jump(profile_t *profile, const uint16_t from, const uint16_t PC) {
+    profile->runs[from & 0xFFF]--;
+    profile->runs[PC & 0xFFF]++;
+}
+
+// Count 1 instruction about to run at the odd address PC, decoded as op, into a profile; one
+//   going on past the end of RAM starts a new straight run at its start
+static inline void profile_odd(profile_t *profile, const uint16_t PC, const uint8_t op) {
+    profile->ops[op]++;
+    if ((PC & 0xFFF) == 0xFFF) profile->runs[1]++;
+}
+
+// Count 1 instruction about to run at PC, decoded as op, into a profile on its own
+static inline void profile_instruction(profile_t *profile, const uint16_t PC, const uint8_t op) {
+    profile->runs[PC & 0xFFF]++;
+    profile->runs[(PC & 0xFFF) + 2]--;
+    profile->ops[op]++;
+}
+
+// Count the instructions run so far at the even address PC as the operation its icache entry was
+//   decoded as until now, the one about to run there not included (profile.c)
+void profile_recount(profile_t *profile, const uint16_t PC);
+
+// Count the instructions run from the icache entry of PC as op from now on, including the one
+//   about to run; only a change of operation (self modifying code) counts anything
+static inline void profile_decode(profile_t *profile, const uint16_t PC, const uint8_t op) {
+    uint8_t *cached = &profile->cached[(PC >> 1) & 0x7FF];
+    if (*cached == op) return;
+    if (*cached != OP_DECODE) profile_recount(profile, PC);
+    *cached = op;
+}
+
+// Count the RAM an instruction about to run (before it changes I) reads or writes; pass op as a
+//   constant where it is known so all but its own case fold away.
+//   Only 1 count for the bytes from I on, whatever their length
+static inline void profile_access(profile_t *profile, const chip8_t *chip8, const uint8_t op,
+                                  const decoded_t *inst) {
+    uint64_t (*access)[4096] = NULL;    // RAM counts by length of the bytes from I on
+    uint8_t length = 0;
+
+    switch (op) {
+        case OP_DRW: case OP_DRW_WAIT:
+            access = profile->reads; length = inst->N; break;
+        case OP_LOAD: case OP_LOAD_INC_I:
+            access = profile->reads; length = inst->X + 1; break;
+        case OP_STORE: case OP_STORE_INC_I:
+            access = profile->writes; length = inst->X + 1; break;
+        case OP_LD_B_VX:
+            access = profile->writes; length = 3; break;
+        default:
+            break;
+    }
+
+    if (access) access[length][chip8->I & 0xFFF]++;
+}
+
+// Start the trace record of an instruction about to run at PC
+static inline void trace_instruction(trace_t *trace, const chip8_t *chip8, const uint16_t PC) {
+    const uint16_t opcode = chip8->ram[PC & 0xFFF] << 8 | chip8->ram[(PC + 1) & 0xFFF];
+    trace_record_t *record = &trace->records[trace->head++ & trace->mask];
+
+    *record = (trace_record_t){
+        .PC = PC,
+        .opcode = opcode,
+        .I = chip8->I,
+        .VX = chip8->V[(opcode >> 8) & 0x0F],
+        .VY = chip8->V[(opcode >> 4) & 0x0F],
+        .depth = chip8->stack_ptr - chip8->stack,
+        .tick = (uint32_t)chip8->ticks,
+    };
+    trace->last = record;
+}
+
+// Finish the newest trace record once its instruction has run
+static inline void trace_finish(trace_t *trace, const chip8_t *chip8) {
+    if (!trace->last) return;
+
+    trace->last->result = chip8->V[(trace->last->opcode >> 8) & 0x0F];
+    trace->last->VF = chip8->V[0xF];
+    trace->last = NULL;
+}
+
+// Count the end of a frame into the machine's profile, if it is being profiled
+static inline void profile_frame(chip8_t *chip8) {
+    if (!chip8->profile) return;
+
+    chip8->profile->frames++;
+    chip8->profile->draw_frames += chip8->draw;
+}
+
+// Is the machine at PC in the same state as last time; if not, remember this state instead
+static inline bool idle_repeat(const chip8_t *chip8, idle_state_t *last, const uint16_t PC) {
+    uint64_t V[2];
+    memcpy(V, chip8->V, sizeof V);
+    const uint64_t regs = PC | (uint64_t)chip8->I << 16 | (uint64_t)read_delay_timer(chip8) << 32 |
+                          (uint64_t)read_sound_timer(chip8) << 40 | (uint64_t)chip8->wait_key << 48;
+
+    if (last->regs == regs && last->V[0] == V[0] && last->V[1] == V[1] &&
+        last->effects == chip8->effects && last->stack_ptr == chip8->stack_ptr)
+        return true;
+
+    last->V[0] = V[0];
+    last->V[1] = V[1];
+    last->regs = regs;
+    last->stack_ptr = chip8->stack_ptr;
+    last->effects = chip8->effects;
+    return false;
+}
+
+// Fewest instructions left in an interpreter run for idle_skip() to look for an idle loop;
+//   shorter runs (e.g. 1 frame at the default 600hz) are left to the headless runner's frame skip
+#define IDLE_MIN_SKIP 32
+
+// Call at a loop back edge at PC, after count of max_insts instructions. Returns how many
+//   instructions can be skipped: whole trips around the loop if it is idle, leaving the last part
+//   trip to run normally so the run still ends at the same PC as without skipping
+static inline uint32_t idle_skip(chip8_t *chip8, idle_state_t *last, const uint16_t PC,
+                                 const uint32_t count, const uint32_t max_insts) {
+    uint32_t skip = 0;
+    if (max_insts - count < IDLE_MIN_SKIP) return 0;    // Not worth checking for
+
+    if (idle_repeat(chip8, last, PC)) {
+        const uint32_t trip = count - last->count;
+        skip = (max_insts - count) / trip * trip;
+        chip8->idle_insts += skip;
+    }
+
+    last->count = count + skip;
+    return skip;
+}
+
+// Set up initial emulator configuration from passed in arguments
+bool set_config_from_args(config_t *config, const int argc, char **argv);
+
+// Initialize CHIP8 machine; chip8 must be zeroed or previously initialized
+bool init_chip8(chip8_t *chip8, const config_t config, const char rom_name[]);
+
+// Emulate 1 CHIP8 instruction
+void emulate_instruction(chip8_t *chip8, const config_t config);
+
+// Emulate up to max_insts CHIP8 instructions with the configured CPU engine,
+//   returns instructions run. Stops early after a sprite draw on CHIP8 (display wait)
+uint32_t emulate_instructions(chip8_t *chip8, const config_t config, const uint32_t max_insts);
+
+// Same as above, always using the interpreter (threaded or switch dispatch)
+uint32_t interpret_instructions(chip8_t *chip8, const config_t config, const uint32_t max_insts);
+
+// Interpreter specialized for 1 extension: no config, no quirk checks while running
+typedef uint32_t (*interpreter_t)(chip8_t *chip8, const uint32_t max_insts);
+
+// Get the interpreter for an extension, once at startup or when switching extension/quirks;
+//   drops any instructions predecoded for another extension
+interpreter_t select_interpreter(chip8_t *chip8, const extension_t extension);
+
+// Same as above, using JIT compiled blocks where possible (config.engine JIT/JIT_LOCKSTEP)
+uint32_t jit_emulate_instructions(chip8_t *chip8, const config_t config, const uint32_t max_insts);
+
+// Free a machine's JIT code cache
+void jit_destroy(chip8_t *chip8);
+
+// Drop any JIT compiled code covering length bytes of RAM from address on
+void jit_invalidate(chip8_t *chip8, const uint16_t address, const uint16_t length);
+
+// Emulate 1 frame (1/60th of a second) worth of instructions, returns instructions run
+uint32_t emulate_frame(chip8_t *chip8, const config_t config);
+
+// Decode a raw opcode once into its operation and operands for the given extension
+decoded_t decode_instruction(const uint16_t opcode, const extension_t extension);
+
+// Table of every opcode decoded for an extension, indexed by opcode; built on first use
+const decoded_t *get_decode_table(const extension_t extension);
+
+// Drop all predecoded instructions, e.g. after switching extension/quirks
+void flush_icache(chip8_t *chip8, const extension_t extension);
+
+// Instruction helpers shared by all dispatch engines
+bool wait_for_key(chip8_t *chip8, const uint8_t X);
+
+// Advance CHIP8 delay and sound timers by 1 60hz tick, returns true if sound should play
+bool update_timers(chip8_t *chip8);
+
+// Lerp a color towards another by t in [0.0, 1.0] (float reference for fade_pixels)
+uint32_t color_lerp(const uint32_t start_color, const uint32_t end_color, const float t);
+
+// Fade pixel colors of the given rows (1 bit per row) towards fg/bg color per the packed display
+//   (width / 64 words per row), in fixed point; returns the rows still fading afterwards
+uint64_t fade_pixels(const fade_kernel_t kernel, uint32_t *pixel_color, const uint64_t *display,
+                     const uint32_t width, const uint32_t height, const uint64_t rows,
+                     const uint32_t fg_color, const uint32_t bg_color, const float rate);
+
+// Can this host run the given fade kernel
+bool fade_kernel_supported(const fade_kernel_t kernel);
+
+// Create count machines with the same ROM loaded, NULL on error
+envs_t *envs_create(const config_t config, const char rom_name[], const uint32_t count);
+
+// Free all machines
+void envs_destroy(envs_t *envs);
+
+// Put 1 machine back in its freshly loaded state
+void envs_reset(envs_t *envs, const uint32_t env);
+
+// Run n_frames 60hz frames on every machine, holding the keys in actions[env] (1 bit per key)
+void envs_step(envs_t *envs, const uint16_t *actions, const uint32_t n_frames);
+
+// Copy 1 machine's state out to a chip8_t, e.g. to observe it or run it on another engine
+void envs_get(const envs_t *envs, const uint32_t env, chip8_t *chip8);
+
+// Rows that really changed since the last call (touched and different from what was
+//   presented), 1 bit per row; marks them as presented
+uint32_t take_changed_rows(chip8_t *chip8);
+
+// Hash of the display contents, for comparing runs (FNV-1a)
+uint64_t display_hash(const chip8_t *chip8);
+
+// Copy a machine's state out, e.g. as a checkpoint to go back to
+void snapshot_chip8(const chip8_t *chip8, chip8_state_t *state);
+
+// Put a machine back in a snapshotted state; only RAM that differs is written, so predecoded
+//   and JIT compiled code for the rest stays valid
+void restore_chip8(chip8_t *chip8, const chip8_state_t *state);
+
+// Write a snapshot to a save state file
+bool save_state_file(const chip8_state_t *state, const char path[]);
+
+// Memory map a save state file read only, NULL if it is invalid; the state can be restored
+//   from as often as needed until unmapped
+const chip8_state_t *map_state_file(const char path[]);
+
+void unmap_state_file(const chip8_state_t *state);
+
+// Restore a machine from a save state file
+bool load_state_file(chip8_t *chip8, const char path[]);
+
+// Create a rewind history of the given size in bytes, NULL on error
+rewind_t *rewind_create(const size_t size);
+
+void rewind_destroy(rewind_t *history);
+
+// Push a machine's current state as the newest frame, dropping the oldest ones if out of room
+void rewind_push(rewind_t *history, const chip8_t *chip8);
+
+// Take the newest frame off the history and put the machine back in it; false if there is none
+bool rewind_pop(rewind_t *history, chip8_t *chip8);
+
+// Frames in the history, and optionally the bytes they take up
+uint32_t rewind_frames(const rewind_t *history, size_t *bytes);
+
+// Start recording input to a file, for a machine about to run with config; NULL on error
+input_log_t *record_open(const char path[], const config_t config);
+
+// Record the keys held from a frame on (1 bit per key), and whether the machine was reset first;
+//   insts is the instructions run before that frame
+void record_input(input_log_t *log, const uint64_t frame, const uint64_t insts,
+                  const uint16_t keys, const bool reset);
+
+// Finish a recording that ran for frames frames and insts instructions, ending with chip8's display
+bool record_close(input_log_t *log, const uint64_t frames, const uint64_t insts, const chip8_t *chip8);
+
+// Read a whole input recording to replay, and set config up to run it the way it was recorded;
+//   NULL on error. Snapshot the freshly loaded machine into its boot state before running it
+input_log_t *replay_open(const char path[], config_t *config);
+
+void replay_close(input_log_t *log);
+
+// Set up a triple buffer: frame 0 starts as the middle, 1 as the back and 2 as the front
+void frames_init(frames_t *frames);
+
+// Hand a finished display over to the render thread; never waits. Returns true if the render
+//   thread had already taken the previous frame, i.e. it needs waking up for this one
+bool frames_publish(frames_t *frames, const uint64_t display[32]);
+
+// Is there a frame the render thread hasn't taken yet
+bool frames_pending(frames_t *frames);
+
+// Take the newest frame into display, if there is one; returns the rows it changed
+uint32_t frames_take(frames_t *frames, uint64_t display[32]);
+
+// Set up the audio engine for a device playing sample_rate samples per second, buffer_samples at a
+//   time, with a host clock of freq ticks per second: silent, empty queue, tone off
+void audio_init(audio_t *audio, const int64_t sample_rate, const int64_t freq, const uint32_t buffer_samples,
+                const uint32_t square_wave_freq, const int16_t volume);
+
+// Queue a sound on/off change for the audio callback, stamped with its host clock time; false if
+//   the queue is full
+bool queue_sound(audio_t *audio, const uint64_t time, const bool on);
+
+// Fill out count samples of audio, the first of them played at host clock time now
+void render_audio(audio_t *audio, int16_t *samples, const int32_t count, const int64_t now);
+
+// Write a profile as a report: CSV if path ends in .csv, JSON otherwise
+bool write_profile(const profile_t *profile, const chip8_t *chip8, const char path[]);
+
+// Write a profile's instructions run per address as a 64x64 grayscale PGM image, 1 pixel per
+//   address row by row from 0x000, brighter for more (log scale)
+bool write_heatmap(const profile_t *profile, const char path[]);
+
+// Create a trace ring keeping at least the newest records instructions, NULL on error
+trace_t *trace_create(const uint64_t records);
+
+void trace_destroy(trace_t *trace);
+
+// Write a trace's records to a trace file, oldest first
+bool trace_dump(const trace_t *trace, const char path[]);
+
+// Dump a trace to path if the process crashes (fatal signal), NULL trace to stop; Unix only
+void trace_dump_on_crash(const trace_t *trace, const char path[]);
+
+// Read all records of a trace file; first is set to how many instructions were traced before
+//   the first of them. NULL on error, free() the records after use
+trace_record_t *read_trace_file(const char path[], uint64_t *count, uint64_t *first);
+
+// Print what a traced instruction did, given the record after it if there is one (else NULL)
+void describe_instruction(FILE *out, const trace_record_t *record, const trace_record_t *next);
+
+// Run a loaded ROM without SDL until QUIT or the configured frame/instruction limit, holding
+//   the keys from a recording if replay isn't NULL; returns frames and instructions run
+void run_until_limit(chip8_t *chip8, const config_t config, input_log_t *replay,
+                     uint64_t *frames, uint64_t *insts);
+
+// Same as above, printing the results; false if a replay did not end like its recording
+bool run_headless(chip8_t *chip8, const config_t config, input_log_t *replay);
+
+#endif // CHIP8_H
@@ -0,0 +1,831 @@
+#include <time.h>
+
+#include "chip8.h"
+
+// Set up initial emulator configuration from passed in arguments
+bool set_config_from_args(config_t *config, const int argc, char **argv) {
+
+    // Set defaults
+    *config = (config_t){
+        .window_width  = 64,    // CHIP8 original X resolution
+        .window_height = 32,    // CHIP8 original Y resolution
+        .fg_color = 0xFFFFFFFF, // WHITE
+        .bg_color = 0x000000FF, // BLACK
+        .scale_factor = 20,     // Default resolution will be 1280x640
+        .pixel_outlines = true, // Draw pixel "outlines" by default
+        .insts_per_second = 600, // Number of instructions to emulate in 1 second (clock rate of CPU)
+        .speed = 1.0,           // Real time
+        .square_wave_freq = 440,    // 440hz for middle A
+        .audio_sample_rate = 44100, // CD quality, 44100hz
+        .volume = 3000,             // INT16_MAX would be max volume
+        .color_lerp_rate = 0.7,     // Color lerp rate, between [0.1, 1.0]
+        .current_extension = CHIP8, // Set default quirks/extension to plain OG CHIP-8
+        .engine = INTERPRETER,      // JIT is opt in
+        .rewind_mb = 4,             // Several minutes of rewind history
+#ifdef DEBUG
+        .fuse = false,              // Debug builds run instructions 1 handler each, as they are traced
+        .idle_skip = false,         // Debug builds run every instruction, so stepping and traces see them all
+        .trace = 1 << 20,           // Debug builds trace the last 1M instructions from the start
+#else
+        .fuse = true,               // Superinstructions on, --no-fuse to measure without them
+        .idle_skip = true,          // Idle loop skipping on, --no-idle-skip to run every instruction
+#endif
+        .trace_file = "trace.bin",
+    };
+
+    // Override defaults from passed in arguments
+    for (int i = 1; i < argc; i++) {
+            (void)argv[i];  // Prevent compiler error from unused variables argc/argv
+            // e.g. set scale factor
+            if (strncmp(argv[i], "--scale-factor", strlen("--scale-factor")) == 0) {
+                // Note: should probably add checks for numeric
+                i++;
+                config->scale_factor = (uint32_t)strtol(argv[i], NULL, 10);
+            } else if (strncmp(argv[i], "--ips", strlen("--ips")) == 0) {
+                // Instructions per emulated second, run 1/60th of them per frame
+                if (++i >= argc) return false;
+                config->insts_per_second = (uint32_t)strtoul(argv[i], NULL, 10);
+                if (config->insts_per_second < 60) {
+                    fprintf(stderr, "--ips must be at least 60, 1 instruction per frame\n");
+                    return false;
+                }
+            } else if (strncmp(argv[i], "--speed", strlen("--speed")) == 0) {
+                // Speed multiplier: 2, 4, 8 fast forward, 0.5 slow motion, unlimited runs unthrottled
+                if (++i >= argc) return false;
+                config->speed = (strcmp(argv[i], "unlimited") == 0) ? 0.0f : strtof(argv[i], NULL);
+                if (!(config->speed > 0.0f) && strcmp(argv[i], "unlimited") != 0) {
+                    fprintf(stderr, "--speed must be a positive multiplier or unlimited\n");
+                    return false;
+                }
+            } else if (strncmp(argv[i], "--jit-lockstep", strlen("--jit-lockstep")) == 0) {
+                // Use the JIT, verifying every compiled block against the interpreter
+                config->engine = JIT_LOCKSTEP;
+            } else if (strncmp(argv[i], "--jit", strlen("--jit")) == 0) {
+                // Use the JIT recompiler instead of the interpreter
+                config->engine = JIT;
+            } else if (strncmp(argv[i], "--no-fuse", strlen("--no-fuse")) == 0) {
+                // Run every instruction on its own, without superinstructions
+                config->fuse = false;
+            } else if (strncmp(argv[i], "--no-idle-skip", strlen("--no-idle-skip")) == 0) {
+                // Run idle loops waiting on a timer/key instruction by instruction
+                config->idle_skip = false;
+            } else if (strncmp(argv[i], "--headless", strlen("--headless")) == 0) {
+                // Run without SDL window/audio, unthrottled
+                config->headless = true;
+            } else if (strncmp(argv[i], "--max-frames", strlen("--max-frames")) == 0) {
+                // Headless: number of 60hz frames to run for
+                if (++i >= argc) return false;
+                config->max_frames = strtoull(argv[i], NULL, 10);
+            } else if (strncmp(argv[i], "--max-insts", strlen("--max-insts")) == 0) {
+                // Headless: number of instructions to run for
+                if (++i >= argc) return false;
+                config->max_insts = strtoull(argv[i], NULL, 10);
+            } else if (strncmp(argv[i], "--seed", strlen("--seed")) == 0) {
+                // Seed for CXNN random numbers, to repeat a run exactly
+                if (++i >= argc) return false;
+                config->rng_seed = (uint32_t)strtoul(argv[i], NULL, 10);
+            } else if (strncmp(argv[i], "--record", strlen("--record")) == 0) {
+                // Record keypad input, to replay the run later
+                if (++i >= argc) return false;
+                config->record = argv[i];
+            } else if (strncmp(argv[i], "--replay", strlen("--replay")) == 0) {
+                // Headless: play back recorded keypad input
+                if (++i >= argc) return false;
+                config->replay = argv[i];
+            } else if (strncmp(argv[i], "--profile", strlen("--profile")) == 0) {
+                // Count instructions per operation/address, RAM accesses and draws; report at exit
+                if (++i >= argc) return false;
+                config->profile = argv[i];
+            } else if (strncmp(argv[i], "--heatmap", strlen("--heatmap")) == 0) {
+                // Profile, and write instructions run per address as an image at exit
+                if (++i >= argc) return false;
+                config->heatmap = argv[i];
+            } else if (strncmp(argv[i], "--trace-file", strlen("--trace-file")) == 0) {
+                // Where the instruction trace is dumped
+                if (++i >= argc) return false;
+                config->trace_file = argv[i];
+            } else if (strncmp(argv[i], "--trace", strlen("--trace")) == 0) {
+                // Trace every instruction, keeping the last N for a dump at exit or on a crash
+                if (++i >= argc) return false;
+                config->trace = (uint32_t)strtoul(argv[i], NULL, 10);
+            } else if (strncmp(argv[i], "--rewind-mb", strlen("--rewind-mb")) == 0) {
+                // Rewind history size, 0 to turn rewind off
+                if (++i >= argc) return false;
+                config->rewind_mb = (uint32_t)strtoul(argv[i], NULL, 10);
+            } else if (strncmp(argv[i], "--load-state", strlen("--load-state")) == 0) {
+                // Resume from a save state file instead of the start of the ROM
+                if (++i >= argc) return false;
+                config->load_state = argv[i];
+            } else if (strncmp(argv[i], "--save-state", strlen("--save-state")) == 0) {
+                // Save state file to write
+                if (++i >= argc) return false;
+                config->save_state = argv[i];
+            }
+    }
+
+    // Headless runs can not be closed by the user, so always give them an end
+    if (config->headless && config->max_frames == 0 && config->max_insts == 0)
+        config->max_frames = 600;   // 10 seconds of emulated time
+
+    return true;    // Success
+}
+
+// Initialize CHIP8 machine
+bool init_chip8(chip8_t *chip8, const config_t config, const char rom_name[]) {
+    const uint32_t entry_point = 0x200; // CHIP8 Roms will be loaded to 0x200
+    const uint8_t font[] = {
+        0xF0, 0x90, 0x90, 0x90, 0xF0,   // 0   
+        0x20, 0x60, 0x20, 0x20, 0x70,   // 1  
+        0xF0, 0x10, 0xF0, 0x80, 0xF0,   // 2 
+        0xF0, 0x10, 0xF0, 0x10, 0xF0,   // 3
+        0x90, 0x90, 0xF0, 0x10, 0x10,   // 4    
+        0xF0, 0x80, 0xF0, 0x10, 0xF0,   // 5
+        0xF0, 0x80, 0xF0, 0x90, 0xF0,   // 6
+        0xF0, 0x10, 0x20, 0x40, 0x40,   // 7
+        0xF0, 0x90, 0xF0, 0x90, 0xF0,   // 8
+        0xF0, 0x90, 0xF0, 0x10, 0xF0,   // 9
+        0xF0, 0x90, 0xF0, 0x90, 0x90,   // A
+        0xE0, 0x90, 0xE0, 0x90, 0xE0,   // B
+        0xF0, 0x80, 0x80, 0x80, 0xF0,   // C
+        0xE0, 0x90, 0x90, 0x90, 0xE0,   // D
+        0xF0, 0x80, 0xF0, 0x80, 0xF0,   // E
+        0xF0, 0x80, 0xF0, 0x80, 0x80,   // F
+    };
+
+    // Initialize entire CHIP8 machine, dropping any code compiled for a previous ROM
+    jit_destroy(chip8);
+    memset(chip8, 0, sizeof(chip8_t));
+
+    // Load font 
+    memcpy(&chip8->ram[0], font, sizeof(font));
+   
+    // Open ROM file
+    FILE *rom = fopen(rom_name, "rb");
+    if (!rom) {
+        fprintf(stderr, "Rom file %s is invalid or does not exist\n", rom_name);
+        return false;
+    }
+
+    // Get/check rom size
+    fseek(rom, 0, SEEK_END);
+    const size_t rom_size = ftell(rom);
+    const size_t max_size = sizeof chip8->ram - entry_point;
+    rewind(rom);
+
+    if (rom_size > max_size) {
+        fprintf(stderr, "Rom file %s is too big! Rom size: %llu, Max size allowed: %llu\n", 
+                rom_name, (long long unsigned)rom_size, (long long unsigned)max_size);
+        return false;
+    }
+
+    // Load ROM
+    if (fread(&chip8->ram[entry_point], rom_size, 1, rom) != 1) {
+        fprintf(stderr, "Could not read Rom file %s into CHIP8 memory\n", 
+                rom_name);
+        return false;
+    }
+    fclose(rom);
+
+    // Set chip8 machine defaults
+    chip8->state = RUNNING;     // Default machine state to on/running
+    chip8->PC = entry_point;    // Start program counter at ROM entry point
+    chip8->rom_name = rom_name;
+    chip8->stack_ptr = &chip8->stack[0];
+    chip8->wait_key = 0xFF;     // Not waiting on a key press
+    chip8->fuse = config.fuse;
+    chip8->idle_skip = config.idle_skip;
+    chip8->rng = config.rng_seed ? config.rng_seed : 0x2545F491;    // xorshift state must be non zero
+
+    return true;    // Success
+}
+
+// 0xFX0A helper, shared by all instruction dispatch engines
+//   Returns true while still waiting (PC set back to run FX0A again)
+bool wait_for_key(chip8_t *chip8, const uint8_t X) {
+    for (uint8_t i = 0; chip8->wait_key == 0xFF && i < sizeof chip8->keypad; i++) 
+        if (chip8->keypad[i]) {
+            chip8->wait_key = i;    // Save pressed key to check until it is released
+            break;
+        }
+
+    // If no key has been pressed yet, keep getting the current opcode & running this instruction
+    if (chip8->wait_key == 0xFF) chip8->PC -= 2; 
+    else {
+        // A key has been pressed, also wait until it is released to set the key in VX
+        if (chip8->keypad[chip8->wait_key])     // "Busy loop" CHIP8 emulation until key is released
+            chip8->PC -= 2;
+        else {
+            chip8->V[X] = chip8->wait_key;  // VX = key 
+            chip8->wait_key = 0xFF;         // Reset key to not found 
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Emulate 1 CHIP8 instruction with the given extension's quirks; always inlined so that
+//   the quirk checks fold away wherever extension is a constant
+static inline __attribute__((always_inline)) void execute_instruction(chip8_t *chip8, const extension_t extension) {
+    bool carry;   // Save carry flag/VF value for some instructions
+
+    // Get next opcode from ram 
+    chip8->inst.opcode = (chip8->ram[chip8->PC & 0xFFF] << 8) | chip8->ram[(chip8->PC+1) & 0xFFF];
+    chip8->PC += 2; // Pre-increment program counter for next opcode
+
+    // Fill out current instruction format
+    chip8->inst.NNN = chip8->inst.opcode & 0x0FFF;
+    chip8->inst.NN = chip8->inst.opcode & 0x0FF;
+    chip8->inst.N = chip8->inst.opcode & 0x0F;
+    chip8->inst.X = (chip8->inst.opcode >> 8) & 0x0F;
+    chip8->inst.Y = (chip8->inst.opcode >> 4) & 0x0F;
+
+    // Emulate opcode
+    switch ((chip8->inst.opcode >> 12) & 0x0F) {
+        case 0x00:
+            if (chip8->inst.NN == 0xE0) {
+                // 0x00E0: Clear the screen
+                memset(&chip8->display[0], false, sizeof chip8->display);
+                chip8->dirty_rows = UINT32_MAX;
+                chip8->draw = true; // Will update screen on next 60hz tick
+                chip8->effects++;
+
+            } else if (chip8->inst.NN == 0xEE) {
+                // 0x00EE: Return from subroutine
+                // Set program counter to last address on subroutine stack ("pop" it off the stack)
+                //   so that next opcode will be gotten from that address.
+                chip8->PC = stack_pop(chip8);
+
+            } else {
+                // Unimplemented/invalid opcode, may be 0xNNN for calling machine code routine for RCA1802
+            }
+
+            break;
+
+        case 0x01:
+            // 0x1NNN: Jump to address NNN
+            chip8->PC = chip8->inst.NNN;    // Set program counter so that next opcode is from NNN
+            break;
+
+        case 0x02:
+            // 0x2NNN: Call subroutine at NNN
+            // Store current address to return to on subroutine stack ("push" it on the stack)
+            //   and set program counter to subroutine address so that the next opcode
+            //   is gotten from there.
+            stack_push(chip8, chip8->PC);
+            chip8->PC = chip8->inst.NNN;
+            chip8->effects++;
+            break;
+
+        case 0x03:
+            // 0x3XNN: Check if VX == NN, if so, skip the next instruction
+            if (chip8->V[chip8->inst.X] == chip8->inst.NN)
+                chip8->PC += 2;       // Skip next opcode/instruction
+            break;
+
+        case 0x04:
+            // 0x4XNN: Check if VX != NN, if so, skip the next instruction
+            if (chip8->V[chip8->inst.X] != chip8->inst.NN)
+                chip8->PC += 2;       // Skip next opcode/instruction
+            break;
+
+        case 0x05:
+            // 0x5XY0: Check if VX == VY, if so, skip the next instruction
+            if (chip8->inst.N != 0) break; // Wrong opcode
+
+            if (chip8->V[chip8->inst.X] == chip8->V[chip8->inst.Y])
+                chip8->PC += 2;       // Skip next opcode/instruction
+            
+            break;
+
+        case 0x06:
+            // 0x6XNN: Set register VX to NN
+            chip8->V[chip8->inst.X] = chip8->inst.NN;
+            break;
+
+        case 0x07:
+            // 0x7XNN: Set register VX += NN
+            chip8->V[chip8->inst.X] += chip8->inst.NN;
+            break;
+
+        case 0x08:
+            switch(chip8->inst.N) {
+                case 0:
+                    // 0x8XY0: Set register VX = VY
+                    chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y];
+                    break;
+
+                case 1:
+                    // 0x8XY1: Set register VX |= VY
+                    chip8->V[chip8->inst.X] |= chip8->V[chip8->inst.Y];
+                    if (extension == CHIP8)
+                        chip8->V[0xF] = 0;  // Reset VF to 0
+                    break;
+
+                case 2:
+                    // 0x8XY2: Set register VX &= VY
+                    chip8->V[chip8->inst.X] &= chip8->V[chip8->inst.Y];
+                    if (extension == CHIP8)
+                        chip8->V[0xF] = 0;  // Reset VF to 0
+                    break;
+
+                case 3:
+                    // 0x8XY3: Set register VX ^= VY
+                    chip8->V[chip8->inst.X] ^= chip8->V[chip8->inst.Y];
+                    if (extension == CHIP8)
+                        chip8->V[0xF] = 0;  // Reset VF to 0
+                    break;
+
+                case 4:
+                    // 0x8XY4: Set register VX += VY, set VF to 1 if carry, 0 if not 
+                    carry = ((uint16_t)(chip8->V[chip8->inst.X] + chip8->V[chip8->inst.Y]) > 255);
+
+                    chip8->V[chip8->inst.X] += chip8->V[chip8->inst.Y];
+                    chip8->V[0xF] = carry; 
+                    break;
+
+                case 5: 
+                    // 0x8XY5: Set register VX -= VY, set VF to 1 if there is not a borrow (result is positive/0)
+                    carry = (chip8->V[chip8->inst.Y] <= chip8->V[chip8->inst.X]);
+
+                    chip8->V[chip8->inst.X] -= chip8->V[chip8->inst.Y];
+                    chip8->V[0xF] = carry;
+                    break;
+
+                case 6:
+                    // 0x8XY6: Set register VX >>= 1, store shifted off bit in VF
+                    if (extension == CHIP8) {
+                        carry = chip8->V[chip8->inst.Y] & 1;    // Use VY
+                        chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] >> 1; // Set VX = VY result
+                    } else {
+                        carry = chip8->V[chip8->inst.X] & 1;    // Use VX
+                        chip8->V[chip8->inst.X] >>= 1;          // Use VX
+                    }
+
+                    chip8->V[0xF] = carry;
+                    break;
+
+                case 7:
+                    // 0x8XY7: Set register VX = VY - VX, set VF to 1 if there is not a borrow (result is positive/0)
+                    carry = (chip8->V[chip8->inst.X] <= chip8->V[chip8->inst.Y]);
+
+                    chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] - chip8->V[chip8->inst.X];
+                    chip8->V[0xF] = carry;
+                    break;
+
+                case 0xE:
+                    // 0x8XYE: Set register VX <<= 1, store shifted off bit in VF
+                    if (extension == CHIP8) { 
+                        carry = (chip8->V[chip8->inst.Y] & 0x80) >> 7; // Use VY
+                        chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] << 1; // Set VX = VY result
+                    } else {
+                        carry = (chip8->V[chip8->inst.X] & 0x80) >> 7;  // VX
+                        chip8->V[chip8->inst.X] <<= 1;                  // Use VX
+                    }
+
+                    chip8->V[0xF] = carry;
+                    break;
+
+                default:
+                    // Wrong/unimplemented opcode
+                    break;
+            }
+            break;
+
+        case 0x09:
+            // 0x9XY0: Check if VX != VY; Skip next instruction if so
+            if (chip8->V[chip8->inst.X] != chip8->V[chip8->inst.Y])
+                chip8->PC += 2;
+            break;
+
+        case 0x0A:
+            // 0xANNN: Set index register I to NNN
+            chip8->I = chip8->inst.NNN;
+            break;
+
+        case 0x0B:
+            // 0xBNNN: Jump to V0 + NNN
+            chip8->PC = chip8->V[0] + chip8->inst.NNN;
+            break;
+
+        case 0x0C:
+            // 0xCXNN: Sets register VX = random byte & NN (bitwise AND)
+            chip8->V[chip8->inst.X] = random_byte(chip8) & chip8->inst.NN;
+            break;
+
+        case 0x0D:
+            // 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
+            //   Screen pixels are XOR'd with sprite bits, 
+            //   VF (Carry flag) is set if any screen pixels are set off; This is useful
+            //   for collision detection or other reasons.
+            draw_sprite(chip8, chip8->inst.X, chip8->inst.Y, chip8->inst.N, extension == XOCHIP);
+            break;
+
+        case 0x0E:
+            if (chip8->inst.NN == 0x9E) {
+                // 0xEX9E: Skip next instruction if key in VX is pressed
+                if (chip8->keypad[chip8->V[chip8->inst.X] & 0xF])
+                    chip8->PC += 2;
+
+            } else if (chip8->inst.NN == 0xA1) {
+                // 0xEX9E: Skip next instruction if key in VX is not pressed
+                if (!chip8->keypad[chip8->V[chip8->inst.X] & 0xF])
+                    chip8->PC += 2;
+            }
+            break;
+
+        case 0x0F:
+            switch (chip8->inst.NN) {
+                case 0x0A:
+                    // 0xFX0A: VX = get_key(); Await until a keypress, and store in VX
+                    wait_for_key(chip8, chip8->inst.X);
+                    break;
+
+                case 0x1E:
+                    // 0xFX1E: I += VX; Add VX to register I. For non-Amiga CHIP8, does not affect VF
+                    chip8->I += chip8->V[chip8->inst.X];
+                    break;
+
+                case 0x07:
+                    // 0xFX07: VX = delay timer
+                    chip8->V[chip8->inst.X] = read_delay_timer(chip8);
+                    break;
+
+                case 0x15:
+                    // 0xFX15: delay timer = VX 
+                    set_delay_timer(chip8, chip8->V[chip8->inst.X]);
+                    break;
+
+                case 0x18:
+                    // 0xFX18: sound timer = VX 
+                    set_sound_timer(chip8, chip8->V[chip8->inst.X]);
+                    break;
+
+                case 0x29:
+                    // 0xFX29: Set register I to sprite location in memory for character in VX (0x0-0xF)
+                    chip8->I = chip8->V[chip8->inst.X] * 5;
+                    break;
+
+                case 0x33: {
+                    // 0xFX33: Store BCD representation of VX at memory offset from I;
+                    //   I = hundred's place, I+1 = ten's place, I+2 = one's place
+                    uint8_t bcd = chip8->V[chip8->inst.X]; 
+                    write_ram(chip8, chip8->I+2, bcd % 10);
+                    bcd /= 10;
+                    write_ram(chip8, chip8->I+1, bcd % 10);
+                    bcd /= 10;
+                    write_ram(chip8, chip8->I, bcd);
+                    break;
+                }
+
+                case 0x55:
+                    // 0xFX55: Register dump V0-VX inclusive to memory offset from I;
+                    // CHIP8 does increment I
+                    for (uint8_t i = 0; i <= chip8->inst.X; i++)  {
+                        if (extension == CHIP8) 
+                            write_ram(chip8, chip8->I++, chip8->V[i]); // Increment I each time
+                        else
+                            write_ram(chip8, chip8->I + i, chip8->V[i]);
+                    }
+                    break;
+
+                case 0x65:
+                    // 0xFX65: Register load V0-VX inclusive from memory offset from I;
+                    //   SCHIP does not increment I, CHIP8 does increment I
+                    for (uint8_t i = 0; i <= chip8->inst.X; i++) {
+                        if (extension == CHIP8) 
+                            chip8->V[i] = chip8->ram[chip8->I++ & 0xFFF]; // Increment I each time
+                        else
+                            chip8->V[i] = chip8->ram[(chip8->I + i) & 0xFFF];
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+            break;
+            
+        default:
+            break;  // Unimplemented or invalid opcode
+    }
+}
+
+// Advance CHIP8 delay and sound timers by 1 60hz tick; both are read lazily against the tick
+//   count, so this is all there is to it
+//   Returns true if the frontend should be playing sound this frame
+bool update_timers(chip8_t *chip8) {
+    const bool sound = read_sound_timer(chip8) > 0;
+    chip8->ticks++;
+
+    return sound;   // Play or pause sound
+}
+
+// Emulate 1 CHIP8 instruction
+void emulate_instruction(chip8_t *chip8, const config_t config) {
+    execute_instruction(chip8, config.current_extension);
+}
+
+#ifdef SWITCH_DISPATCH
+// Interpret up to max_insts CHIP8 instructions, returns instructions run
+//   Stops early after a sprite draw on CHIP8 (display wait)
+//   instrument: profile/trace each instruction into chip8->profile/trace if set; pass a constant
+//   so it folds away
+static inline __attribute__((always_inline)) uint32_t run_switch(chip8_t *chip8, const extension_t extension,
+                                                                 const uint32_t max_insts, const bool instrument) {
+    uint32_t i = 0;
+
+    chip8->idle.regs = UINT64_MAX;  // No loop back edge seen yet in this run
+
+    while (i < max_insts) {
+        const uint16_t PC = chip8->PC;
+        if (instrument && chip8->profile) {
+            const decoded_t inst = decode_instruction((chip8->ram[PC & 0xFFF] << 8) | chip8->ram[(PC+1) & 0xFFF], extension);
+            profile_instruction(chip8->profile, PC, inst.op);
+            profile_access(chip8->profile, chip8, inst.op, &inst);
+        }
+        if (instrument && chip8->trace) trace_instruction(chip8->trace, chip8, PC);
+
+        execute_instruction(chip8, extension);
+        i++;
+
+        if (instrument && chip8->profile && chip8->inst.opcode >> 12 == 0xD)
+            chip8->profile->collisions += chip8->V[0xF];
+        if (instrument && chip8->trace) trace_finish(chip8->trace, chip8);
+
+        // If drawing on CHIP8, only draw 1 sprite this frame (display wait)
+        if ((extension == CHIP8) && 
+            (chip8->inst.opcode >> 12 == 0xD)) 
+            break;  
+
+        // Loop back edge (jump/return backwards, or FX0A still waiting): skip idle loops, but
+        //   not while profiling or tracing, which count and keep every instruction
+        if (chip8->PC <= PC && chip8->idle_skip && !instrument)
+            i += idle_skip(chip8, &chip8->idle, PC, i, max_insts);
+    }
+
+    return i;
+}
+
+// 1 switch interpreter per extension, each with its quirks resolved at compile time, and an
+//   instrumented twin of each
+static uint32_t interpret_chip8(chip8_t *chip8, const uint32_t max_insts)     { return run_switch(chip8, CHIP8, max_insts, false); }
+static uint32_t interpret_superchip(chip8_t *chip8, const uint32_t max_insts) { return run_switch(chip8, SUPERCHIP, max_insts, false); }
+static uint32_t interpret_xochip(chip8_t *chip8, const uint32_t max_insts)    { return run_switch(chip8, XOCHIP, max_insts, false); }
+static uint32_t instrumented_chip8(chip8_t *chip8, const uint32_t max_insts)  { return run_switch(chip8, CHIP8, max_insts, true); }
+static uint32_t instrumented_superchip(chip8_t *chip8, const uint32_t max_insts) { return run_switch(chip8, SUPERCHIP, max_insts, true); }
+static uint32_t instrumented_xochip(chip8_t *chip8, const uint32_t max_insts) { return run_switch(chip8, XOCHIP, max_insts, true); }
+
+// Get the interpreter for an extension, the instrumented one while the machine is being
+//   profiled or traced
+interpreter_t select_interpreter(chip8_t *chip8, const extension_t extension) {
+    static const interpreter_t interpreters[2][XOCHIP+1] = {
+        [false] = {
+            [CHIP8]     = interpret_chip8,
+            [SUPERCHIP] = interpret_superchip,
+            [XOCHIP]    = interpret_xochip,
+        },
+        [true] = {
+            [CHIP8]     = instrumented_chip8,
+            [SUPERCHIP] = instrumented_superchip,
+            [XOCHIP]    = instrumented_xochip,
+        },
+    };
+
+    if (chip8->icache_extension != extension)
+        flush_icache(chip8, extension);
+
+    return interpreters[chip8->profile || chip8->trace][extension];
+}
+#endif
+
+// Interpret up to max_insts CHIP8 instructions with the interpreter for config's extension
+uint32_t interpret_instructions(chip8_t *chip8, const config_t config, const uint32_t max_insts) {
+    return select_interpreter(chip8, config.current_extension)(chip8, max_insts);
+}
+
+// Emulate up to max_insts CHIP8 instructions with the configured CPU engine,
+//   returns instructions run. Stops early after a sprite draw on CHIP8 (display wait)
+//   Compiled code can't count or trace what it runs, so a machine being profiled or traced is
+//   always interpreted
+uint32_t emulate_instructions(chip8_t *chip8, const config_t config, const uint32_t max_insts) {
+    if (config.engine != INTERPRETER && !chip8->profile && !chip8->trace)
+        return jit_emulate_instructions(chip8, config, max_insts);
+
+    return interpret_instructions(chip8, config, max_insts);
+}
+
+// Emulate 1 frame (1/60th of a second) worth of instructions, returns instructions run
+uint32_t emulate_frame(chip8_t *chip8, const config_t config) {
+    return emulate_instructions(chip8, config, config.insts_per_second / 60);
+}
+
+// Rows that really changed since the last present; a sprite drawn and then erased again in the
+//   same frame touches its rows but leaves them as they were, so only touched rows are compared
+uint32_t take_changed_rows(chip8_t *chip8) {
+    uint32_t changed = 0;
+
+    for (uint32_t rows = chip8->dirty_rows; rows; rows &= rows - 1) {
+        const uint32_t row = __builtin_ctz(rows);
+        if (chip8->display[row] != chip8->presented[row]) {
+            chip8->presented[row] = chip8->display[row];
+            changed |= 1u << row;
+        }
+    }
+
+    chip8->dirty_rows = 0;
+    return changed;
+}
+
+// Hash of the display contents, for comparing runs (FNV-1a)
+uint64_t display_hash(const chip8_t *chip8) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    // Hash rows byte by byte, left to right, so the result does not depend on host endianness
+    for (uint8_t y = 0; y < sizeof chip8->display / sizeof chip8->display[0]; y++) {
+        for (int8_t shift = 56; shift >= 0; shift -= 8) {
+            hash ^= (chip8->display[y] >> shift) & 0xFF;
+            hash *= 0x100000001B3ULL;
+        }
+    }
+
+    return hash;
+}
+
+// Get current host time in seconds, used for headless throughput reporting
+static double host_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Run a loaded ROM without SDL until QUIT or the configured frame/instruction limit
+//   Frames are not throttled to 60hz, emulated time still advances 1 timer tick per frame
+//   A replay's keys are set at the start of the frame they were recorded before
+void run_until_limit(chip8_t *chip8, const config_t config, input_log_t *replay,
+                     uint64_t *frames_run, uint64_t *insts_run) {
+    uint64_t frames = 0;
+    uint64_t insts = 0;
+    const uint32_t frame_insts = config.insts_per_second / 60;
+    idle_state_t idle = { .regs = UINT64_MAX };   // Machine state at the start of an earlier frame
+    uint32_t effects = chip8->effects - 1;
+    uint32_t next_event = 0;
+    bool in_step = true;    // Replay has run the same instructions as the recording so far
+
+    while (chip8->state != QUIT) {
+        if (config.max_frames && frames >= config.max_frames) break;
+        if (config.max_insts && insts >= config.max_insts) break;
+
+        // Replay: set the keys recorded for this frame, resetting first if the recording did
+        while (replay && next_event < replay->num_events && replay->events[next_event].frame <= frames) {
+            const input_event_t *event = &replay->events[next_event++];
+            if (event->insts != insts && in_step) {
+                fprintf(stderr, "Replay out of step at frame %llu: %llu instructions run, %llu recorded\n",
+                        (long long unsigned)frames, (long long unsigned)insts, (long long unsigned)event->insts);
+                in_step = false;
+            }
+
+            if (event->reset) restore_chip8(chip8, &replay->boot);
+            for (uint8_t i = 0; i < 16; i++) chip8->keypad[i] = (event->keys >> i) & 1;
+            idle.regs = UINT64_MAX; // Repeats seen with the old keys say nothing about the new ones
+        }
+
+        // Keys never change here, so a frame starting in the same state as an earlier one (timers
+        //   run out, idle or waiting on FX0A) starts a repeat of the frames in between, each a full
+        //   frame_insts long; jump straight over whole repeats, up to the limits. Only checked
+        //   after a frame without RAM, stack, display or RNG writes, as a repeat needs those. Never
+        //   while profiling or tracing, which count and keep every instruction
+        const bool idle_frame = (chip8->effects == effects);
+        effects = chip8->effects;
+
+        if (config.idle_skip && !chip8->profile && !chip8->trace && idle_frame && idle_repeat(chip8, &idle, chip8->PC)) {
+            const uint64_t trip = frames - idle.count;
+            uint64_t left = config.max_frames ? config.max_frames - frames : UINT64_MAX;
+            if (config.max_insts && frame_insts && (config.max_insts - insts) / frame_insts < left)
+                left = (config.max_insts - insts) / frame_insts;
+            // The frame after a skip runs with the keys as they are, so stop 1 short of the next change
+            if (replay && next_event < replay->num_events && replay->events[next_event].frame - frames - 1 < left)
+                left = replay->events[next_event].frame - frames - 1;
+            if (left == UINT64_MAX) left = 0;   // No limit to jump to
+
+            const uint64_t skip = left / trip * trip;
+            frames += skip;
+            chip8->ticks += skip;
+            insts += skip * frame_insts;
+            chip8->idle_insts += skip * frame_insts;
+            if (config.max_frames && frames >= config.max_frames) break;
+        }
+        if (idle_frame) idle.count = frames;
+
+        // Last frame may be cut short by the instruction limit
+        uint32_t budget = frame_insts;
+        if (config.max_insts && config.max_insts - insts < budget)
+            budget = config.max_insts - insts;
+
+        insts += emulate_instructions(chip8, config, budget);
+        chip8->ticks++;         // Timers are read against this, nothing to update
+        profile_frame(chip8);
+        chip8->draw = false;    // Nothing to draw to
+        frames++;
+    }
+
+    *frames_run = frames;
+    *insts_run = insts;
+}
+
+// Run a loaded ROM headless and print the results
+bool run_headless(chip8_t *chip8, const config_t config, input_log_t *replay) {
+    uint64_t frames = 0;
+    uint64_t insts = 0;
+    bool ok = true;
+
+    // Profile the whole run if asked for a report or heatmap
+    profile_t *profile = NULL;
+    if (config.profile || config.heatmap) {
+        profile = calloc(1, sizeof *profile);
+        if (!profile) return false;
+        chip8->profile = profile;
+        flush_icache(chip8, chip8->icache_extension);  // Decode everything while profiling
+    }
+
+    // Keep the last instructions run, to dump at the end or if the run crashes
+    trace_t *trace = NULL;
+    if (config.trace) {
+        trace = trace_create(config.trace);
+        if (!trace) {
+            chip8->profile = NULL;
+            free(profile);
+            return false;
+        }
+        chip8->trace = trace;
+        trace_dump_on_crash(trace, config.trace_file);
+    }
+
+    const double start_time = host_seconds();
+
+    run_until_limit(chip8, config, replay, &frames, &insts);
+
+    const double elapsed = host_seconds() - start_time;
+
+    if (trace) {
+        chip8->trace = NULL;
+        trace_dump_on_crash(NULL, NULL);
+        ok &= trace_dump(trace, config.trace_file);
+        trace_destroy(trace);
+    }
+
+    if (profile) {
+        chip8->profile = NULL;
+        if (config.profile) ok &= write_profile(profile, chip8, config.profile);
+        if (config.heatmap) ok &= write_heatmap(profile, config.heatmap);
+        free(profile);
+    }
+
+    printf("rom: %s\n", chip8->rom_name);
+    printf("frames: %llu\n", (long long unsigned)frames);
+    printf("instructions: %llu\n", (long long unsigned)insts);
+    printf("seconds: %.6f\n", elapsed);
+    printf("mips: %.3f\n", elapsed > 0 ? insts / elapsed / 1e6 : 0.0);
+    // Share of instructions run inside superinstructions, per kind
+    static const char *fused_names[NUM_FUSED_OPS] = {
+        [OP_FUSED_ADD_SKIP_JP - OP_FUSED_FIRST] = "add_skip_jp",
+        [OP_FUSED_DT_SKIP_JP - OP_FUSED_FIRST]  = "dt_skip_jp",
+        [OP_FUSED_LD_I_DRW - OP_FUSED_FIRST]    = "ld_i_drw",
+        [OP_FUSED_ADD_I_LOAD - OP_FUSED_FIRST]  = "add_i_load",
+    };
+    uint64_t fused = 0;
+    for (uint8_t i = 0; i < NUM_FUSED_OPS; i++) fused += chip8->fused_insts[i];
+    printf("fused: %llu (%.1f%%)\n", (long long unsigned)fused, insts ? 100.0 * fused / insts : 0.0);
+    for (uint8_t i = 0; i < NUM_FUSED_OPS; i++)
+        printf("fused_%s: %llu\n", fused_names[i], (long long unsigned)chip8->fused_insts[i]);
+    printf("idle: %llu (%.1f%%)\n", (long long unsigned)chip8->idle_insts,
+           insts ? 100.0 * chip8->idle_insts / insts : 0.0);
+
+    printf("display_hash: 0x%016llX\n", (long long unsigned)display_hash(chip8));
+    printf("PC: 0x%04X I: 0x%04X V:", chip8->PC, chip8->I);
+    for (uint8_t i = 0; i < 16; i++) printf(" %02X", chip8->V[i]);
+    printf("\n");
+
+    // A replay must end exactly where its recording did
+    if (replay) {
+        const bool same = (frames == replay->frames && insts == replay->insts &&
+                           display_hash(chip8) == replay->display_hash);
+        printf("replay: %s\n", same ? "ok" : "mismatch");
+        if (!same) {
+            fprintf(stderr, "Replay ended at %llu frames, %llu instructions, display_hash 0x%016llX; "
+                    "recording at %llu, %llu, 0x%016llX\n",
+                    (long long unsigned)frames, (long long unsigned)insts, (long long unsigned)display_hash(chip8),
+                    (long long unsigned)replay->frames, (long long unsigned)replay->insts,
+                    (long long unsigned)replay->display_hash);
+            return false;
+        }
+    }
+
+    // Save where the run ended up, to carry on from later with --load-state
+    if (config.save_state) {
+        chip8_state_t state;
+        snapshot_chip8(chip8, &state);
+        if (!save_state_file(&state, config.save_state)) return false;
+    }
+
+    return ok;
+}
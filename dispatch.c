@@ -0,0 +1,272 @@
+#include <pthread.h>
+
+#include "chip8.h"
+
+// Threaded dispatch engine
+//   Every 16 bit opcode is decoded only once per extension into a 64K entry table of
+//   operation + operands. The interpreter loop then jumps straight from handler to handler
+//   (computed goto), without any per-instruction decode or quirk checks.
+//   Instructions at even addresses are additionally cached per machine in chip8->icache,
+//   so they run without re-fetching from RAM until a RAM write (write_ram) invalidates them.
+
+// Decode a raw opcode once into its operation and operands for the given extension
+decoded_t decode_instruction(const uint16_t opcode, const extension_t extension) {
+    const bool chip8_quirks = (extension == CHIP8);
+    decoded_t inst = {
+        .op = OP_NOP,
+        .X = (opcode >> 8) & 0x0F,
+        .Y = (opcode >> 4) & 0x0F,
+        .N = opcode & 0x0F,
+        .NN = opcode & 0x0FF,
+        .NNN = opcode & 0x0FFF,
+    };
+
+    switch ((opcode >> 12) & 0x0F) {
+        case 0x00:
+            if (inst.NN == 0xE0) inst.op = OP_CLS;
+            else if (inst.NN == 0xEE) inst.op = OP_RET;
+            break;
+
+        case 0x01: inst.op = OP_JP; break;
+        case 0x02: inst.op = OP_CALL; break;
+        case 0x03: inst.op = OP_SE_VX_NN; break;
+        case 0x04: inst.op = OP_SNE_VX_NN; break;
+        case 0x05: if (inst.N == 0) inst.op = OP_SE_VX_VY; break;
+        case 0x06: inst.op = OP_LD_VX_NN; break;
+        case 0x07: inst.op = OP_ADD_VX_NN; break;
+
+        case 0x08:
+            switch (inst.N) {
+                case 0x0: inst.op = OP_LD_VX_VY; break;
+                case 0x1: inst.op = chip8_quirks ? OP_OR_VF_RESET : OP_OR; break;
+                case 0x2: inst.op = chip8_quirks ? OP_AND_VF_RESET : OP_AND; break;
+                case 0x3: inst.op = chip8_quirks ? OP_XOR_VF_RESET : OP_XOR; break;
+                case 0x4: inst.op = OP_ADD_VX_VY; break;
+                case 0x5: inst.op = OP_SUB; break;
+                case 0x6: inst.op = chip8_quirks ? OP_SHR_VY : OP_SHR_VX; break;
+                case 0x7: inst.op = OP_SUBN; break;
+                case 0xE: inst.op = chip8_quirks ? OP_SHL_VY : OP_SHL_VX; break;
+                default: break;
+            }
+            break;
+
+        case 0x09: inst.op = OP_SNE_VX_VY; break;
+        case 0x0A: inst.op = OP_LD_I; break;
+        case 0x0B: inst.op = OP_JP_V0; break;
+        case 0x0C: inst.op = OP_RND; break;
+        case 0x0D: inst.op = chip8_quirks ? OP_DRW_WAIT : OP_DRW; break;
+
+        case 0x0E:
+            if (inst.NN == 0x9E) inst.op = OP_SKP;
+            else if (inst.NN == 0xA1) inst.op = OP_SKNP;
+            break;
+
+        case 0x0F:
+            switch (inst.NN) {
+                case 0x07: inst.op = OP_LD_VX_DT; break;
+                case 0x0A: inst.op = OP_LD_VX_K; break;
+                case 0x15: inst.op = OP_LD_DT_VX; break;
+                case 0x18: inst.op = OP_LD_ST_VX; break;
+                case 0x1E: inst.op = OP_ADD_I_VX; break;
+                case 0x29: inst.op = OP_LD_F_VX; break;
+                case 0x33: inst.op = OP_LD_B_VX; break;
+                case 0x55: inst.op = chip8_quirks ? OP_STORE_INC_I : OP_STORE; break;
+                case 0x65: inst.op = chip8_quirks ? OP_LOAD_INC_I : OP_LOAD; break;
+                default: break;
+            }
+            break;
+
+        default:
+            break;  // Unimplemented or invalid opcode
+    }
+
+    return inst;
+}
+
+// Drop all predecoded instructions, e.g. after switching extension/quirks
+void flush_icache(chip8_t *chip8, const extension_t extension) {
+    memset(chip8->icache, 0, sizeof chip8->icache);     // All entries become OP_DECODE
+    chip8->icache_extension = extension;
+}
+
+// Fully decoded opcode tables, 1 per extension, built the first time any machine runs;
+//   shared read only by all machines/threads afterwards
+static decoded_t decode_table[XOCHIP+1][0x10000];
+static pthread_once_t decode_table_once = PTHREAD_ONCE_INIT;
+
+static void build_decode_tables(void) {
+    for (extension_t extension = CHIP8; extension <= XOCHIP; extension++)
+        for (uint32_t opcode = 0; opcode <= 0xFFFF; opcode++)
+            decode_table[extension][opcode] = decode_instruction(opcode, extension);
+}
+
+// Get the decode table for an extension, building all tables on first use
+const decoded_t *get_decode_table(const extension_t extension) {
+    pthread_once(&decode_table_once, build_decode_tables);
+    return decode_table[extension];
+}
+
+#ifndef SWITCH_DISPATCH
+
+// Superinstruction fusion: turn a just predecoded instruction into a fused handler if it starts
+//   1 of the common sequences below. Only the first instruction's entry changes; fused handlers
+//   check the following (predecoded) entries every time they run, and run just the first
+//   instruction if those changed or have not been decoded yet, so RAM writes stay safe.
+static void fuse_instruction(decoded_t *entry, const uint8_t *ram, const decoded_t *table, const uint16_t address) {
+    if (address + 4 > 4096) return;     // Room for at least 2 instructions
+
+    const uint8_t next = table[(ram[address+2] << 8) | ram[address+3]].op;
+    const uint8_t after = (address + 6 <= 4096) ? table[(ram[address+4] << 8) | ram[address+5]].op : OP_NOP;
+    const bool skip_jp = (next == OP_SE_VX_NN || next == OP_SNE_VX_NN) && after == OP_JP;
+
+    switch (entry->op) {
+        case OP_ADD_VX_NN:
+            if (skip_jp) entry->op = OP_FUSED_ADD_SKIP_JP;
+            break;
+
+        case OP_LD_VX_DT:
+            if (skip_jp) entry->op = OP_FUSED_DT_SKIP_JP;
+            break;
+
+        case OP_LD_I:
+            if (next == OP_DRW || next == OP_DRW_WAIT) entry->op = OP_FUSED_LD_I_DRW;
+            break;
+
+        case OP_ADD_I_VX:
+            if (next == OP_LOAD || next == OP_LOAD_INC_I) entry->op = OP_FUSED_ADD_I_LOAD;
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Raw opcode at a RAM address; addresses wrap around at the end of RAM
+#define FETCH(address) ((ram[(address) & 0xFFF] << 8) | ram[((address)+1) & 0xFFF])
+
+// Predecoded instruction at an even RAM address, wrapping around like FETCH
+#define ICACHE(address) (&icache[((address) >> 1) & (sizeof chip8->icache / sizeof chip8->icache[0] - 1)])
+
+// Look up the next instruction and jump straight to its handler
+//   Even addresses come from the per machine predecode cache, odd ones (rare) from the table
+//   Profiled interpreters count the ones not run from the cache by themselves; instrumented ones
+//   also trace it
+#define DISPATCH() do { \
+        if (count >= max_insts) goto done; \
+        inst = (chip8->PC & 1) ? &table[FETCH(chip8->PC)] : ICACHE(chip8->PC); \
+        if (PROFILING && (chip8->PC & 1)) profile_odd(profile, chip8->PC, inst->op); \
+        if (TRACE && trace) { trace_finish(trace, chip8); trace_instruction(trace, chip8, chip8->PC); } \
+        chip8->PC += 2; /* Pre-increment program counter for next opcode */ \
+        count++; \
+        goto *handlers[inst->op]; \
+    } while (0)
+
+// Change chip8->PC with statement; profiled interpreters count that as the end of a straight run
+//   after the instruction changing it and the start of one where it goes
+#define JUMP(statement) do { \
+        const uint16_t from = chip8->PC; \
+        statement; \
+        if (PROFILING) profile_jump(profile, from, chip8->PC); \
+    } while (0)
+
+// Whether an interpreter counts into chip8->profile: profiled ones only ever run while profiling,
+//   so need not check for it, instrumented ones (TRACE) only while tracing, and may profile too
+#define PROFILING (INSTRUMENT && (!TRACE || profile))
+
+// Whether an interpreter skips idle loops: instrumented ones never do, as profiles count and
+//   traces keep every instruction
+#define IDLE_SKIP (!INSTRUMENT && chip8->idle_skip)
+
+// 1 interpreter per extension, each with its quirks resolved at compile time, a profiled twin of
+//   each only ever run while the machine is being profiled, and an instrumented twin of each only
+//   ever run while it is being traced
+#define INSTRUMENT 0
+#define TRACE 0
+#define EXTENSION CHIP8
+#define INTERPRETER_NAME interpret_chip8
+#include "interpreter.inc"
+#undef EXTENSION
+#undef INTERPRETER_NAME
+
+#define EXTENSION SUPERCHIP
+#define INTERPRETER_NAME interpret_superchip
+#include "interpreter.inc"
+#undef EXTENSION
+#undef INTERPRETER_NAME
+
+#define EXTENSION XOCHIP
+#define INTERPRETER_NAME interpret_xochip
+#include "interpreter.inc"
+#undef EXTENSION
+#undef INTERPRETER_NAME
+#undef INSTRUMENT
+
+#define INSTRUMENT 1
+#define EXTENSION CHIP8
+#define INTERPRETER_NAME profiled_chip8
+#include "interpreter.inc"
+#undef EXTENSION
+#undef INTERPRETER_NAME
+
+#define EXTENSION SUPERCHIP
+#define INTERPRETER_NAME profiled_superchip
+#include "interpreter.inc"
+#undef EXTENSION
+#undef INTERPRETER_NAME
+
+#define EXTENSION XOCHIP
+#define INTERPRETER_NAME profiled_xochip
+#include "interpreter.inc"
+#undef EXTENSION
+#undef INTERPRETER_NAME
+#undef TRACE
+
+#define TRACE 1
+#define EXTENSION CHIP8
+#define INTERPRETER_NAME instrumented_chip8
+#include "interpreter.inc"
+#undef EXTENSION
+#undef INTERPRETER_NAME
+
+#define EXTENSION SUPERCHIP
+#define INTERPRETER_NAME instrumented_superchip
+#include "interpreter.inc"
+#undef EXTENSION
+#undef INTERPRETER_NAME
+
+#define EXTENSION XOCHIP
+#define INTERPRETER_NAME instrumented_xochip
+#include "interpreter.inc"
+#undef EXTENSION
+#undef INTERPRETER_NAME
+#undef TRACE
+#undef INSTRUMENT
+
+// Get the interpreter for an extension, a twin while the machine is being profiled or traced;
+//   switching extension drops code decoded for the old one
+interpreter_t select_interpreter(chip8_t *chip8, const extension_t extension) {
+    static const interpreter_t interpreters[3][XOCHIP+1] = {
+        [0] = {
+            [CHIP8]     = interpret_chip8,
+            [SUPERCHIP] = interpret_superchip,
+            [XOCHIP]    = interpret_xochip,
+        },
+        [1] = {
+            [CHIP8]     = profiled_chip8,
+            [SUPERCHIP] = profiled_superchip,
+            [XOCHIP]    = profiled_xochip,
+        },
+        [2] = {
+            [CHIP8]     = instrumented_chip8,
+            [SUPERCHIP] = instrumented_superchip,
+            [XOCHIP]    = instrumented_xochip,
+        },
+    };
+
+    // Cached instructions are only valid for the extension they were decoded for
+    if (chip8->icache_extension != extension)
+        flush_icache(chip8, extension);
+
+    return interpreters[chip8->trace ? 2 : chip8->profile ? 1 : 0][extension];
+}
+#endif
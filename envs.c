@@ -0,0 +1,543 @@
+#include "chip8.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Multi-machine (SoA) engine
+//   Machines are stored ENV_LANES to a group, with every register held as an array across the
+//   group (env_group_t). Each step, the lanes of a group that share a PC (and opcode) run that
+//   instruction together: the opcode is decoded once and executed on all of them with vector
+//   operations under a lane mask. Lanes whose PCs diverged are regrouped and run the same way,
+//   1 PC at a time. RAM is interleaved by lane, so lanes that agree on I (and stack depth, sprite
+//   coordinates) do their stack, sprite draw and RAM load/store with vector operations too; when
+//   they disagree, those instructions loop over the masked lanes.
+//   The vector code is written with GCC vector extensions; on x86-64 Linux it is also built for
+//   AVX2 and picked at runtime.
+
+// Vectors only ever pass between always inlined static helpers, so their calling convention never matters
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+typedef uint8_t  lane8_t  __attribute__((vector_size(ENV_LANES)));
+typedef int8_t   mask8_t  __attribute__((vector_size(ENV_LANES)));
+typedef uint16_t lane16_t __attribute__((vector_size(ENV_LANES * 2)));
+typedef int16_t  mask16_t __attribute__((vector_size(ENV_LANES * 2)));
+typedef uint32_t lane32_t __attribute__((vector_size(ENV_LANES * 4)));
+typedef int32_t  mask32_t __attribute__((vector_size(ENV_LANES * 4)));
+
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__)
+#define ENV_TARGETS __attribute__((target_clones("arch=x86-64-v4", "avx2", "default")))
+#else
+#define ENV_TARGETS
+#endif
+
+#define ENV_INLINE static inline __attribute__((always_inline))
+
+// Lanes as loaded/stored vectors; memcpy keeps this free of aliasing issues and compiles to 1 move
+ENV_INLINE lane8_t  load8(const uint8_t *p)   { lane8_t v;  memcpy(&v, p, sizeof v); return v; }
+ENV_INLINE lane16_t load16(const uint16_t *p) { lane16_t v; memcpy(&v, p, sizeof v); return v; }
+ENV_INLINE lane32_t load32(const uint32_t *p) { lane32_t v; memcpy(&v, p, sizeof v); return v; }
+
+// Masked store of lane vector v to array p, only lanes set in mask m are changed
+//   (a macro so wide vectors are never passed by value)
+#define STORE_MASKED(p, m, v) do { \
+        __typeof__((v) + 0) old_, new_; \
+        memcpy(&old_, (p), sizeof old_); \
+        new_ = ((v) & (__typeof__(old_))(m)) | (old_ & ~(__typeof__(old_))(m)); \
+        memcpy((p), &new_, sizeof new_); \
+    } while (0)
+
+// Skip the next instruction on the executing lanes where cond is set
+#define SKIP_IF(cond) STORE_MASKED(g->PC, __builtin_convertvector(m & (cond), mask16_t), load16(g->PC) + 2)
+
+// Set VX to result and VF to carry (in that order, VF wins if X is F) on the executing lanes
+#define SET_VX_VF(result, carry) do { \
+        STORE_MASKED(g->V[inst.X], m, (result)); \
+        STORE_MASKED(g->V[0xF], m, (carry) & 1); \
+    } while (0)
+
+// True if no lane is set in mask *m
+ENV_INLINE bool none(const mask8_t *m) {
+    uint64_t words[ENV_LANES / 8], any = 0;
+    memcpy(words, m, sizeof words);
+    for (uint32_t i = 0; i < ENV_LANES / 8; i++) any |= words[i];
+    return any == 0;
+}
+
+// Lanes set in mask *m as bits, lane n at bit n: the sign bits of 16 bytes at a time (SSE2, so
+//   any x86-64), else masking keeps bit n of byte n in each 8 lanes and the multiply adds those 8
+//   bytes up into the top one
+ENV_INLINE uint32_t lane_bits(const mask8_t *m) {
+    uint32_t bits = 0;
+#ifdef __SSE2__
+    for (uint32_t i = 0; i < ENV_LANES / 16; i++) {
+        __m128i part;
+        memcpy(&part, (const int8_t *)m + i * 16, sizeof part);
+        bits |= (uint32_t)_mm_movemask_epi8(part) << (i * 16);
+    }
+#else
+    uint64_t words[ENV_LANES / 8];
+    memcpy(words, m, sizeof words);
+    for (uint32_t i = 0; i < ENV_LANES / 8; i++)
+        bits |= (uint32_t)(((words[i] & 0x8040201008040201) * 0x0101010101010101) >> 56) << (i * 8);
+#endif
+    return bits;
+}
+
+// GCC lowers compares of vectors wider than the target's registers 1 lane at a time, so 16 bit
+//   lanes are compared 32 bytes (1 AVX2 register) at a time into their part of a byte mask
+typedef uint16_t part16_t __attribute__((vector_size(32)));
+typedef int8_t   part16_mask8_t __attribute__((vector_size(32 / 2)));
+
+// Lanes of 16 bit array p that differ from value; the 2 halves are joined in registers, as
+//   storing them apart and loading them back as 1 vector stalls on store forwarding
+_Static_assert(ENV_LANES == 2 * sizeof(part16_t) / 2, "differ16() joins 2 parts");
+ENV_INLINE mask8_t differ16(const uint16_t *p, const uint16_t value) {
+    part16_t low, high;
+    memcpy(&low, p, sizeof low);
+    memcpy(&high, p + ENV_LANES / 2, sizeof high);
+    return __builtin_shufflevector(__builtin_convertvector(low != value, part16_mask8_t),
+                                   __builtin_convertvector(high != value, part16_mask8_t),
+                                   0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                   16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+}
+
+// Raw opcode at a lane's PC
+ENV_INLINE uint16_t fetch(const env_group_t *g, const uint32_t lane, const uint16_t PC) {
+    return (g->ram[PC & 0xFFF][lane] << 8) | g->ram[(PC + 1) & 0xFFF][lane];
+}
+
+// DXYN for 1 lane, same as draw_sprite(); a sprite row lands on the byte column of its X
+//   position, and spills over into the next one unless X is a multiple of 8
+static void draw_sprite_lane(env_group_t *g, const config_t config, const uint32_t lane,
+                             const uint8_t X, const uint8_t Y, const uint8_t N) {
+    const uint8_t X_coord = g->V[X][lane] % config.window_width;
+    const uint8_t Y_coord = g->V[Y][lane] % config.window_height;
+    const bool wrap = (config.current_extension == XOCHIP);
+    const uint8_t column = X_coord / 8, shift = X_coord % 8;
+    const bool spill = shift && (wrap || column < 7);   // Past the right edge is clipped (or wrapped)
+    uint8_t collisions = 0;
+
+    for (uint8_t i = 0; i < N; i++) {
+        uint8_t row = Y_coord + i;
+        if (row >= config.window_height) {
+            if (!wrap) break;
+            row %= config.window_height;
+        }
+
+        const uint8_t sprite_data = g->ram[(g->I[lane] + i) & 0xFFF][lane];
+        uint8_t *left = &g->display[row][column][lane];
+        collisions |= *left & (sprite_data >> shift);
+        *left ^= sprite_data >> shift;
+        if (spill) {
+            uint8_t *right = &g->display[row][(column + 1) % 8][lane];
+            collisions |= *right & (uint8_t)(sprite_data << (8 - shift));
+            *right ^= (uint8_t)(sprite_data << (8 - shift));
+        }
+    }
+
+    g->V[0xF][lane] = (collisions != 0);
+}
+
+// DXYN for the lanes in *mask, which all have the same I, VX and VY; only their sprite data can
+//   differ. Each sprite row is 1 or 2 byte columns of the display, 1 vector across the lanes each
+ENV_INLINE void draw_sprite_lanes(env_group_t *g, const config_t config, const mask8_t *mask, const uint32_t leader,
+                                  const uint8_t X, const uint8_t Y, const uint8_t N) {
+    const uint8_t X_coord = g->V[X][leader] % config.window_width;
+    const uint8_t Y_coord = g->V[Y][leader] % config.window_height;
+    const uint16_t I = g->I[leader];
+    const bool wrap = (config.current_extension == XOCHIP);
+    const uint8_t column = X_coord / 8, shift = X_coord % 8;
+    const bool spill = shift && (wrap || column < 7);   // As draw_sprite_lane()
+    lane8_t collisions = {0};
+
+    for (uint8_t i = 0; i < N; i++) {
+        uint8_t row = Y_coord + i;
+        if (row >= config.window_height) {
+            if (!wrap) break;
+            row %= config.window_height;
+        }
+
+        const lane8_t sprite_data = load8(g->ram[(I + i) & 0xFFF]) & (lane8_t)*mask;   // Executing lanes only
+        lane8_t display = load8(g->display[row][column]);
+        collisions |= display & (sprite_data >> shift);
+        display ^= sprite_data >> shift;
+        memcpy(g->display[row][column], &display, sizeof display);
+        if (spill) {
+            display = load8(g->display[row][(column + 1) % 8]);
+            collisions |= display & (sprite_data << (8 - shift));
+            display ^= sprite_data << (8 - shift);
+            memcpy(g->display[row][(column + 1) % 8], &display, sizeof display);
+        }
+    }
+
+    STORE_MASKED(g->V[0xF], *mask, (lane8_t)(collisions != 0) & 1);
+}
+
+// Run 1 decoded instruction on the lanes set in `lanes` (also given as vector mask *mask), whose
+//   PCs are already past it. Returns true if those lanes are done for this frame (CHIP8 display wait)
+ENV_INLINE bool execute(env_group_t *g, const config_t config, const decoded_t inst,
+                        const uint32_t lanes, const mask8_t *mask) {
+    const mask8_t m = *mask;
+    const mask16_t m16 = __builtin_convertvector(m, mask16_t);
+    const lane8_t VX = load8(g->V[inst.X]);
+    const lane8_t VY = load8(g->V[inst.Y]);
+    const uint32_t leader = __builtin_ctz(lanes);
+
+    switch (inst.op) {
+        case OP_CLS:
+            // 0x00E0: Clear the screen
+            if (lanes == UINT32_MAX) {
+                memset(g->display, 0, sizeof g->display);
+                break;
+            }
+            for (uint8_t row = 0; row < 32; row++)
+                for (uint8_t column = 0; column < 8; column++)
+                    STORE_MASKED(g->display[row][column], m, (lane8_t){0});
+            break;
+
+        case OP_RET: {
+            // 0x00EE: Return from subroutine
+            const lane8_t depth = load8(g->stack_depth);
+            const mask8_t differ = m & (depth != depth[leader]);
+            if (none(&differ)) {
+                const uint8_t top = (depth[leader] ? depth[leader] : STACK_SIZE) - 1;  // Ring, as stack_pop()
+                STORE_MASKED(g->stack_depth, m, (lane8_t){0} + top);
+                STORE_MASKED(g->PC, m16, load16(g->stack[top]));
+                break;
+            }
+            for (uint32_t l = lanes; l; l &= l - 1) {
+                const uint32_t lane = __builtin_ctz(l);
+                if (g->stack_depth[lane] == 0) g->stack_depth[lane] = STACK_SIZE;
+                g->PC[lane] = g->stack[--g->stack_depth[lane]][lane];
+            }
+            break;
+        }
+
+        case OP_JP:
+            // 0x1NNN: Jump to address NNN
+            STORE_MASKED(g->PC, m16, (lane16_t){0} + inst.NNN);
+            break;
+
+        case OP_CALL: {
+            // 0x2NNN: Call subroutine at NNN
+            const lane8_t depth = load8(g->stack_depth);
+            const mask8_t differ = m & (depth != depth[leader]);
+            if (none(&differ)) {
+                STORE_MASKED(g->stack[depth[leader]], m16, load16(g->PC));
+                STORE_MASKED(g->stack_depth, m, (lane8_t){0} + (uint8_t)((depth[leader] + 1) % STACK_SIZE));  // Ring, as stack_push()
+                STORE_MASKED(g->PC, m16, (lane16_t){0} + inst.NNN);
+                break;
+            }
+            for (uint32_t l = lanes; l; l &= l - 1) {
+                const uint32_t lane = __builtin_ctz(l);
+                g->stack[g->stack_depth[lane]][lane] = g->PC[lane];
+                g->stack_depth[lane] = (g->stack_depth[lane] + 1) % STACK_SIZE;
+                g->PC[lane] = inst.NNN;
+            }
+            break;
+        }
+
+        case OP_SE_VX_NN:   SKIP_IF(VX == inst.NN); break;
+        case OP_SNE_VX_NN:  SKIP_IF(VX != inst.NN); break;
+        case OP_SE_VX_VY:   SKIP_IF(VX == VY); break;
+        case OP_SNE_VX_VY:  SKIP_IF(VX != VY); break;
+        case OP_LD_VX_NN:   STORE_MASKED(g->V[inst.X], m, (lane8_t){0} + inst.NN); break;
+        case OP_ADD_VX_NN:  STORE_MASKED(g->V[inst.X], m, VX + inst.NN); break;
+        case OP_LD_VX_VY:   STORE_MASKED(g->V[inst.X], m, VY); break;
+        case OP_OR:         STORE_MASKED(g->V[inst.X], m, VX | VY); break;
+        case OP_AND:        STORE_MASKED(g->V[inst.X], m, VX & VY); break;
+        case OP_XOR:        STORE_MASKED(g->V[inst.X], m, VX ^ VY); break;
+        case OP_OR_VF_RESET:    SET_VX_VF(VX | VY, (lane8_t){0}); break;
+        case OP_AND_VF_RESET:   SET_VX_VF(VX & VY, (lane8_t){0}); break;
+        case OP_XOR_VF_RESET:   SET_VX_VF(VX ^ VY, (lane8_t){0}); break;
+        case OP_ADD_VX_VY:  SET_VX_VF(VX + VY, (lane8_t)((lane8_t)(VX + VY) < VX)); break;
+        case OP_SUB:        SET_VX_VF(VX - VY, (lane8_t)(VY <= VX)); break;
+        case OP_SHR_VX:     SET_VX_VF(VX >> 1, VX); break;
+        case OP_SHR_VY:     SET_VX_VF(VY >> 1, VY); break;
+        case OP_SUBN:       SET_VX_VF(VY - VX, (lane8_t)(VX <= VY)); break;
+        case OP_SHL_VX:     SET_VX_VF(VX << 1, VX >> 7); break;
+        case OP_SHL_VY:     SET_VX_VF(VY << 1, VY >> 7); break;
+
+        case OP_LD_I:
+            // 0xANNN: Set index register I to NNN
+            STORE_MASKED(g->I, m16, (lane16_t){0} + inst.NNN);
+            break;
+
+        case OP_JP_V0:
+            // 0xBNNN: Jump to V0 + NNN
+            STORE_MASKED(g->PC, m16, __builtin_convertvector(load8(g->V[0]), lane16_t) + inst.NNN);
+            break;
+
+        case OP_RND: {
+            // 0xCXNN: Sets register VX = random byte & NN, xorshift32 on every lane at once
+            lane32_t x = load32(g->rng);
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            STORE_MASKED(g->rng, __builtin_convertvector(m, mask32_t), x);
+            STORE_MASKED(g->V[inst.X], m, __builtin_convertvector(x >> 24, lane8_t) & inst.NN);
+            break;
+        }
+
+        case OP_DRW:
+        case OP_DRW_WAIT: {
+            // 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I
+            const mask8_t differ = m & ((VX != VX[leader]) | (VY != VY[leader]) | differ16(g->I, g->I[leader]));
+            if (none(&differ))
+                draw_sprite_lanes(g, config, mask, leader, inst.X, inst.Y, inst.N);
+            else for (uint32_t l = lanes; l; l &= l - 1)
+                draw_sprite_lane(g, config, __builtin_ctz(l), inst.X, inst.Y, inst.N);
+            return inst.op == OP_DRW_WAIT;  // Only draw 1 sprite this frame (display wait)
+        }
+
+        case OP_SKP:
+        case OP_SKNP: {
+            // 0xEX9E/0xEXA1: Skip next instruction if key in VX is (not) pressed
+            const lane16_t pressed = (load16(g->keypad) >> (__builtin_convertvector(VX, lane16_t) & 0xF)) & 1;
+            const mask8_t cond = __builtin_convertvector(pressed, mask8_t) != 0;
+            SKIP_IF((inst.op == OP_SKP) ? cond : ~cond);
+            break;
+        }
+
+        case OP_LD_VX_DT:   STORE_MASKED(g->V[inst.X], m, load8(g->delay_timer)); break;
+        case OP_LD_DT_VX:   STORE_MASKED(g->delay_timer, m, VX); break;
+        case OP_LD_ST_VX:   STORE_MASKED(g->sound_timer, m, VX); break;
+
+        case OP_LD_VX_K:
+            // 0xFX0A: VX = get_key(); same as wait_for_key() per lane
+            for (uint32_t l = lanes; l; l &= l - 1) {
+                const uint32_t lane = __builtin_ctz(l);
+                if (g->wait_key[lane] == 0xFF && g->keypad[lane])
+                    g->wait_key[lane] = __builtin_ctz(g->keypad[lane]);
+
+                if (g->wait_key[lane] == 0xFF || (g->keypad[lane] >> g->wait_key[lane]) & 1)
+                    g->PC[lane] -= 2;   // Keep waiting for a press, then for its release
+                else {
+                    g->V[inst.X][lane] = g->wait_key[lane];
+                    g->wait_key[lane] = 0xFF;
+                }
+            }
+            break;
+
+        case OP_ADD_I_VX:
+            // 0xFX1E: I += VX
+            STORE_MASKED(g->I, m16, load16(g->I) + __builtin_convertvector(VX, lane16_t));
+            break;
+
+        case OP_LD_F_VX:
+            // 0xFX29: Set register I to sprite location in memory for character in VX
+            STORE_MASKED(g->I, m16, __builtin_convertvector(VX, lane16_t) * 5);
+            break;
+
+        case OP_LD_B_VX:
+            // 0xFX33: Store BCD representation of VX at memory offset from I
+            const mask8_t differ = m & differ16(g->I, g->I[leader]);
+            if (none(&differ)) {
+                const uint16_t I = g->I[leader];
+                STORE_MASKED(g->ram[(I + 2) & 0xFFF], m, VX % 10);
+                STORE_MASKED(g->ram[(I + 1) & 0xFFF], m, VX / 10 % 10);
+                STORE_MASKED(g->ram[I & 0xFFF], m, VX / 100);
+                break;
+            }
+            for (uint32_t l = lanes; l; l &= l - 1) {
+                const uint32_t lane = __builtin_ctz(l);
+                const uint8_t bcd = g->V[inst.X][lane];
+                const uint16_t I = g->I[lane];
+                g->ram[(I + 2) & 0xFFF][lane] = bcd % 10;
+                g->ram[(I + 1) & 0xFFF][lane] = bcd / 10 % 10;
+                g->ram[I & 0xFFF][lane] = bcd / 100;
+            }
+            break;
+
+        case OP_STORE:
+        case OP_STORE_INC_I: {
+            // 0xFX55: Register dump V0-VX inclusive to memory offset from I
+            const mask8_t differ = m & differ16(g->I, g->I[leader]);
+            if (none(&differ)) {
+                for (uint8_t i = 0; i <= inst.X; i++)
+                    STORE_MASKED(g->ram[(g->I[leader] + i) & 0xFFF], m, load8(g->V[i]));
+                if (inst.op == OP_STORE_INC_I) STORE_MASKED(g->I, m16, load16(g->I) + inst.X + 1);
+                break;
+            }
+            for (uint32_t l = lanes; l; l &= l - 1) {
+                const uint32_t lane = __builtin_ctz(l);
+                for (uint8_t i = 0; i <= inst.X; i++)
+                    g->ram[(g->I[lane] + i) & 0xFFF][lane] = g->V[i][lane];
+                if (inst.op == OP_STORE_INC_I) g->I[lane] += inst.X + 1;   // CHIP8 does increment I
+            }
+            break;
+        }
+
+        case OP_LOAD:
+        case OP_LOAD_INC_I: {
+            // 0xFX65: Register load V0-VX inclusive from memory offset from I
+            const mask8_t differ = m & differ16(g->I, g->I[leader]);
+            if (none(&differ)) {
+                for (uint8_t i = 0; i <= inst.X; i++)
+                    STORE_MASKED(g->V[i], m, load8(g->ram[(g->I[leader] + i) & 0xFFF]));
+                if (inst.op == OP_LOAD_INC_I) STORE_MASKED(g->I, m16, load16(g->I) + inst.X + 1);
+                break;
+            }
+            for (uint32_t l = lanes; l; l &= l - 1) {
+                const uint32_t lane = __builtin_ctz(l);
+                for (uint8_t i = 0; i <= inst.X; i++)
+                    g->V[i][lane] = g->ram[(g->I[lane] + i) & 0xFFF][lane];
+                if (inst.op == OP_LOAD_INC_I) g->I[lane] += inst.X + 1;
+            }
+            break;
+        }
+
+        default:
+            break;  // Unimplemented/invalid opcode
+    }
+
+    return false;
+}
+
+// Run 1 frame on the live lanes of a group
+ENV_TARGETS
+static void step_group(env_group_t *g, const config_t config, const uint32_t live) {
+    // Lane sets are kept both as bits and as vector masks, so neither is rebuilt from the other per step
+    uint32_t running = live;
+    mask8_t running_mask;
+    for (uint32_t lane = 0; lane < ENV_LANES; lane++) running_mask[lane] = -(int8_t)((live >> lane) & 1);
+    const decoded_t *table = get_decode_table(config.current_extension);
+
+    for (uint32_t n = 0; n < config.insts_per_second / 60 && running; n++) {
+        // Every running lane runs 1 instruction, 1 group of lanes sharing a PC at a time
+        mask8_t pending_mask = running_mask;
+        for (uint32_t pending = running; pending; ) {
+            const uint32_t leader = __builtin_ctz(pending);
+            const uint16_t PC = g->PC[leader];
+            const uint16_t opcode = fetch(g, leader, PC);
+
+            // Self modifying/data writing code: lanes at the same PC may hold different opcodes
+            const mask8_t m = pending_mask & ~differ16(g->PC, PC) &
+                              (load8(g->ram[PC & 0xFFF]) == (uint8_t)(opcode >> 8)) &
+                              (load8(g->ram[(PC + 1) & 0xFFF]) == (uint8_t)opcode);
+            const uint32_t lanes = lane_bits(&m);
+
+            STORE_MASKED(g->PC, __builtin_convertvector(m, mask16_t), load16(g->PC) + 2);
+
+            if (execute(g, config, table[opcode], lanes, &m)) {
+                running &= ~lanes;
+                running_mask &= ~m;
+            }
+            pending &= ~lanes;
+            pending_mask &= ~m;
+        }
+    }
+
+    // Update delay & sound timers every 60hz
+    const lane8_t delay = load8(g->delay_timer);
+    const lane8_t sound = load8(g->sound_timer);
+    const lane8_t all = ~(lane8_t){0};
+    STORE_MASKED(g->delay_timer, (mask8_t)all, delay + (lane8_t)(delay != 0));    // -1 where > 0
+    STORE_MASKED(g->sound_timer, (mask8_t)all, sound + (lane8_t)(sound != 0));
+}
+
+// Copy a machine's state into 1 lane of a group
+static void put_lane(env_group_t *g, const uint32_t lane, const chip8_t *chip8) {
+    for (uint8_t i = 0; i < 16; i++) g->V[i][lane] = chip8->V[i];
+    g->I[lane] = chip8->I;
+    g->PC[lane] = chip8->PC;
+    g->delay_timer[lane] = read_delay_timer(chip8);
+    g->sound_timer[lane] = read_sound_timer(chip8);
+    g->wait_key[lane] = chip8->wait_key;
+    g->rng[lane] = chip8->rng;
+
+    g->keypad[lane] = 0;
+    for (uint8_t i = 0; i < 16; i++) g->keypad[lane] |= chip8->keypad[i] << i;
+
+    g->stack_depth[lane] = chip8->stack_ptr - chip8->stack;
+    for (uint8_t i = 0; i < STACK_SIZE; i++) g->stack[i][lane] = chip8->stack[i];
+
+    for (uint8_t row = 0; row < 32; row++)
+        for (uint8_t column = 0; column < 8; column++)
+            g->display[row][column][lane] = chip8->display[row] >> (56 - column * 8);
+    for (uint16_t address = 0; address < 4096; address++) g->ram[address][lane] = chip8->ram[address];
+}
+
+// Create count machines with the same ROM loaded, NULL on error
+envs_t *envs_create(const config_t config, const char rom_name[], const uint32_t count) {
+    envs_t *envs = calloc(1, sizeof *envs);
+    if (!envs) return NULL;
+
+    envs->count = count;
+    envs->num_groups = (count + ENV_LANES - 1) / ENV_LANES;
+    envs->config = config;
+    envs->initial = calloc(1, sizeof *envs->initial);
+    envs->groups = aligned_alloc(_Alignof(env_group_t), envs->num_groups * sizeof *envs->groups);
+
+    if (!envs->initial || !envs->groups || !init_chip8(envs->initial, config, rom_name)) {
+        envs_destroy(envs);
+        return NULL;
+    }
+
+    memset(envs->groups, 0, envs->num_groups * sizeof *envs->groups);
+    for (uint32_t env = 0; env < envs->num_groups * ENV_LANES; env++)
+        put_lane(&envs->groups[env / ENV_LANES], env % ENV_LANES, envs->initial);
+
+    get_decode_table(config.current_extension);    // Built now rather than in the first step
+    return envs;
+}
+
+// Free all machines
+void envs_destroy(envs_t *envs) {
+    if (!envs) return;
+
+    free(envs->initial);
+    free(envs->groups);
+    free(envs);
+}
+
+// Put 1 machine back in its freshly loaded state
+void envs_reset(envs_t *envs, const uint32_t env) {
+    put_lane(&envs->groups[env / ENV_LANES], env % ENV_LANES, envs->initial);
+}
+
+// Run n_frames 60hz frames on every machine, holding the keys in actions[env] (1 bit per key)
+void envs_step(envs_t *envs, const uint16_t *actions, const uint32_t n_frames) {
+    for (uint32_t i = 0; i < envs->num_groups; i++) {
+        env_group_t *g = &envs->groups[i];
+
+        // Lanes past the last machine are never run
+        const uint32_t lanes_used = envs->count - i * ENV_LANES;
+        const uint32_t live = (lanes_used >= ENV_LANES) ? UINT32_MAX : (1u << lanes_used) - 1;
+
+        for (uint32_t lane = 0; lane < ENV_LANES && (live >> lane) & 1; lane++)
+            g->keypad[lane] = actions ? actions[i * ENV_LANES + lane] : 0;
+
+        for (uint32_t frame = 0; frame < n_frames; frame++)
+            step_group(g, envs->config, live);
+    }
+}
+
+// Copy 1 machine's state out to a chip8_t, e.g. to observe it or run it on another engine
+void envs_get(const envs_t *envs, const uint32_t env, chip8_t *chip8) {
+    const env_group_t *g = &envs->groups[env / ENV_LANES];
+    const uint32_t lane = env % ENV_LANES;
+
+    jit_destroy(chip8);
+    memset(chip8, 0, sizeof *chip8);
+
+    chip8->state = RUNNING;
+    chip8->rom_name = envs->initial->rom_name;
+    for (uint8_t i = 0; i < 16; i++) chip8->V[i] = g->V[i][lane];
+    chip8->I = g->I[lane];
+    chip8->PC = g->PC[lane];
+    set_delay_timer(chip8, g->delay_timer[lane]);
+    set_sound_timer(chip8, g->sound_timer[lane]);
+    chip8->wait_key = g->wait_key[lane];
+    chip8->rng = g->rng[lane];
+    for (uint8_t i = 0; i < 16; i++) chip8->keypad[i] = (g->keypad[lane] >> i) & 1;
+
+    for (uint8_t i = 0; i < STACK_SIZE; i++) chip8->stack[i] = g->stack[i][lane];
+    chip8->stack_ptr = &chip8->stack[g->stack_depth[lane]];
+
+    for (uint8_t row = 0; row < 32; row++)
+        for (uint8_t column = 0; column < 8; column++)
+            chip8->display[row] |= (uint64_t)g->display[row][column][lane] << (56 - column * 8);
+    for (uint16_t address = 0; address < 4096; address++) chip8->ram[address] = g->ram[address][lane];
+}
@@ -0,0 +1,194 @@
+#include "chip8.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Phosphor fade
+//   Every pixel color is lerped towards its target color: fg where the packed display bit is on,
+//   bg where it is off (picked per pixel with a mask, no branches). The lerp is done in 8.8 fixed
+//   point on all 4 channels at once:
+//       out = (start * (256 - w) + target * w) >> 8,  w = round(color_lerp_rate * 256)
+//   Per channel this is within 1 of the float color_lerp() below, and all kernels (scalar, SSE2,
+//   AVX2) give bit-identical results. A lerp that stops making progress due to rounding snaps
+//   straight to its target, so every fade settles.
+
+// Color "lerp" helper function, float reference for the fixed point kernels
+uint32_t color_lerp(const uint32_t start_color, const uint32_t end_color, const float t) {
+    const uint8_t s_r = (start_color >> 24) & 0xFF;
+    const uint8_t s_g = (start_color >> 16) & 0xFF;
+    const uint8_t s_b = (start_color >>  8) & 0xFF;
+    const uint8_t s_a = (start_color >>  0) & 0xFF;
+
+    const uint8_t e_r = (end_color >> 24) & 0xFF;
+    const uint8_t e_g = (end_color >> 16) & 0xFF;
+    const uint8_t e_b = (end_color >>  8) & 0xFF;
+    const uint8_t e_a = (end_color >>  0) & 0xFF;
+
+    const uint8_t ret_r = ((1-t)*s_r) + (t*e_r);
+    const uint8_t ret_g = ((1-t)*s_g) + (t*e_g);
+    const uint8_t ret_b = ((1-t)*s_b) + (t*e_b);
+    const uint8_t ret_a = ((1-t)*s_a) + (t*e_a);
+
+    return (ret_r << 24) | (ret_g << 16) | (ret_b << 8) | ret_a;
+}
+
+// Fade 1 pixel; 2 channels per 32 bit multiply, each channel sum fits in its own 16 bits
+static inline uint32_t fade_pixel(const uint32_t start, const uint32_t target, const uint32_t w) {
+    const uint32_t lo = ((( start       & 0x00FF00FF) * (256 - w) + ( target       & 0x00FF00FF) * w) >> 8) & 0x00FF00FF;
+    const uint32_t hi = ((((start >> 8) & 0x00FF00FF) * (256 - w) + ((target >> 8) & 0x00FF00FF) * w)     ) & 0xFF00FF00;
+    const uint32_t color = hi | lo;
+
+    return (color == start) ? target : color;   // Lerp stalled on rounding, snap
+}
+
+// Scalar kernel, 1 pixel at a time; pixels already at their target are skipped
+static bool fade_row_scalar(uint32_t *pixels, const uint64_t *display, const uint32_t width,
+                            const uint32_t fg_color, const uint32_t bg_color, const uint32_t w) {
+    bool fading = false;
+
+    for (uint32_t x = 0; x < width; x += 64) {
+        uint64_t bits = display[x / 64];
+
+        for (uint32_t i = x; i < x + 64; i++, bits <<= 1) {
+            const uint32_t mask = -(uint32_t)(bits >> 63);
+            const uint32_t target = (fg_color & mask) | (bg_color & ~mask);
+
+            if (pixels[i] != target) {
+                pixels[i] = fade_pixel(pixels[i], target, w);
+                fading |= (pixels[i] != target);
+            }
+        }
+    }
+
+    return fading;
+}
+
+#ifdef __SSE2__
+// SSE2 kernel, 4 pixels at a time; groups already at their target are skipped
+static bool fade_row_sse2(uint32_t *pixels, const uint64_t *display, const uint32_t width,
+                          const uint32_t fg_color, const uint32_t bg_color, const uint32_t w) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bits = _mm_set_epi32(1, 2, 4, 8);     // Leftmost pixel is the highest bit
+    const __m128i fg = _mm_set1_epi32(fg_color);
+    const __m128i bg = _mm_set1_epi32(bg_color);
+    const __m128i ws = _mm_set1_epi16(256 - w);
+    const __m128i wt = _mm_set1_epi16(w);
+    int settled = 0xFFFF;
+
+    for (uint32_t x = 0; x < width; x += 4) {
+        const uint32_t nibble = (display[x / 64] >> (60 - x % 64)) & 0xF;
+        const __m128i mask = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(nibble), bits), bits);
+        const __m128i target = _mm_or_si128(_mm_and_si128(mask, fg), _mm_andnot_si128(mask, bg));
+        const __m128i start = _mm_loadu_si128((const __m128i *)&pixels[x]);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(start, target)) == 0xFFFF) continue;   // All 4 settled
+
+        const __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(start, zero), ws),
+                                                        _mm_mullo_epi16(_mm_unpacklo_epi8(target, zero), wt)), 8);
+        const __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(start, zero), ws),
+                                                        _mm_mullo_epi16(_mm_unpackhi_epi8(target, zero), wt)), 8);
+        __m128i color = _mm_packus_epi16(lo, hi);
+
+        const __m128i stalled = _mm_cmpeq_epi32(color, start);
+        color = _mm_or_si128(_mm_and_si128(stalled, target), _mm_andnot_si128(stalled, color));
+
+        _mm_storeu_si128((__m128i *)&pixels[x], color);
+        settled &= _mm_movemask_epi8(_mm_cmpeq_epi32(color, target));
+    }
+
+    return settled != 0xFFFF;
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_FADE_AVX2
+// AVX2 kernel, 8 pixels at a time, settled groups skipped; only called when the host CPU supports it
+__attribute__((target("avx2")))
+static bool fade_row_avx2(uint32_t *pixels, const uint64_t *display, const uint32_t width,
+                          const uint32_t fg_color, const uint32_t bg_color, const uint32_t w) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bits = _mm256_set_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i fg = _mm256_set1_epi32(fg_color);
+    const __m256i bg = _mm256_set1_epi32(bg_color);
+    const __m256i ws = _mm256_set1_epi16(256 - w);
+    const __m256i wt = _mm256_set1_epi16(w);
+    uint32_t settled = 0xFFFFFFFF;
+
+    for (uint32_t x = 0; x < width; x += 8) {
+        const uint32_t byte = (display[x / 64] >> (56 - x % 64)) & 0xFF;
+        const __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(byte), bits), bits);
+        const __m256i target = _mm256_blendv_epi8(bg, fg, mask);
+        const __m256i start = _mm256_loadu_si256((const __m256i *)&pixels[x]);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(start, target)) == -1) continue;  // All 8 settled
+
+        // Unpack/pack work within each 128 bit half, so pixel order comes out unchanged
+        const __m256i lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(start, zero), ws),
+                                                              _mm256_mullo_epi16(_mm256_unpacklo_epi8(target, zero), wt)), 8);
+        const __m256i hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(start, zero), ws),
+                                                              _mm256_mullo_epi16(_mm256_unpackhi_epi8(target, zero), wt)), 8);
+        __m256i color = _mm256_packus_epi16(lo, hi);
+
+        color = _mm256_blendv_epi8(color, target, _mm256_cmpeq_epi32(color, start));
+
+        _mm256_storeu_si256((__m256i *)&pixels[x], color);
+        settled &= (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi32(color, target));
+    }
+
+    return settled != 0xFFFFFFFF;
+}
+#endif
+
+// Can this host run the given fade kernel
+bool fade_kernel_supported(const fade_kernel_t kernel) {
+    switch (kernel) {
+        case FADE_AUTO:
+        case FADE_SCALAR:
+            return true;
+
+        case FADE_SSE2:
+#ifdef __SSE2__
+            return true;
+#else
+            return false;
+#endif
+
+        case FADE_AVX2:
+#ifdef HAVE_FADE_AVX2
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+    }
+
+    return false;
+}
+
+// Fade the pixel colors of the given rows towards fg/bg per the packed display,
+//   returns the rows still fading afterwards
+uint64_t fade_pixels(const fade_kernel_t kernel, uint32_t *pixel_color, const uint64_t *display,
+                     const uint32_t width, const uint32_t height, const uint64_t rows,
+                     const uint32_t fg_color, const uint32_t bg_color, const float rate) {
+    bool (*fade_row)(uint32_t *, const uint64_t *, uint32_t, uint32_t, uint32_t, uint32_t) = fade_row_scalar;
+
+#ifdef __SSE2__
+    if (kernel == FADE_SSE2 || kernel == FADE_AUTO) fade_row = fade_row_sse2;
+#endif
+#ifdef HAVE_FADE_AVX2
+    if ((kernel == FADE_AVX2 || kernel == FADE_AUTO) && fade_kernel_supported(FADE_AVX2)) fade_row = fade_row_avx2;
+#endif
+
+    // Lerp rate as an 8 bit fraction, 256 = 1.0
+    const float clamped = (rate < 0.0f) ? 0.0f : (rate > 1.0f) ? 1.0f : rate;
+    const uint32_t w = (uint32_t)(clamped * 256 + 0.5f);
+    const uint32_t words = width / 64;  // Packed display words per row
+    uint64_t fading = 0;
+
+    for (uint32_t y = 0; y < height; y++) {
+        if (!(rows & (1ull << y))) continue;
+
+        if (fade_row(&pixel_color[y * width], &display[y * words], width, fg_color, bg_color, w))
+            fading |= 1ull << y;
+    }
+
+    return fading;
+}
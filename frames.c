@@ -0,0 +1,49 @@
+#include "chip8.h"
+
+// Frame handover
+//   Lock-free triple buffer between the emulation thread (producer) and the render thread
+//   (consumer). Each owns 1 of the 3 frames (back and front) and the third is in the middle; both
+//   only ever swap their own frame with the middle one, in 1 atomic exchange, so neither ever waits
+//   on the other or sees a frame while it is being written. FRAME_NEW is set on the middle index
+//   while it holds a frame the render thread hasn't taken yet; publishing over such a frame just
+//   replaces it, so the render thread always takes the newest one and skips the rest.
+
+#define FRAME_NEW 4u
+
+// Set up a triple buffer: frame 0 starts as the middle, 1 as the back and 2 as the front
+void frames_init(frames_t *frames) {
+    memset(frames->frames, 0, sizeof frames->frames);
+    atomic_init(&frames->middle, 0);
+    frames->back = 1;
+    frames->front = 2;
+}
+
+// Hand a finished display over to the render thread; never waits. Returns true if the render
+//   thread had already taken the previous frame, i.e. it needs waking up for this one
+bool frames_publish(frames_t *frames, const uint64_t display[32]) {
+    memcpy(frames->frames[frames->back], display, sizeof frames->frames[0]);
+    const uint32_t old = atomic_exchange(&frames->middle, frames->back | FRAME_NEW);
+    frames->back = old & ~FRAME_NEW;
+    return !(old & FRAME_NEW);
+}
+
+// Is there a frame the render thread hasn't taken yet
+bool frames_pending(frames_t *frames) {
+    return atomic_load(&frames->middle) & FRAME_NEW;
+}
+
+// Take the newest frame into display, if there is one; returns the rows it changed
+uint32_t frames_take(frames_t *frames, uint64_t display[32]) {
+    if (!frames_pending(frames)) return 0;
+    frames->front = atomic_exchange(&frames->middle, frames->front) & ~FRAME_NEW;
+
+    uint32_t changed = 0;
+    for (uint32_t row = 0; row < 32; row++) {
+        if (frames->frames[frames->front][row] != display[row]) {
+            display[row] = frames->frames[frames->front][row];
+            changed |= 1u << row;
+        }
+    }
+
+    return changed;
+}
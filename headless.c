@@ -0,0 +1,33 @@
+#include "chip8.h"
+
+// Headless frontend: CHIP8 core only, no SDL window/audio/delays
+int main(int argc, char **argv) {
+    // Default Usage message for args
+    if (argc < 2) {
+       fprintf(stderr, "Usage: %s <rom_name> [--max-frames N] [--max-insts N] [--load-state FILE] [--save-state FILE] [--replay FILE] [--profile FILE] [--heatmap FILE] [--trace N] [--trace-file FILE]\n", argv[0]);
+       exit(EXIT_FAILURE);
+    }
+
+    // Initialize emulator configuration/options
+    config_t config = {0};
+    if (!set_config_from_args(&config, argc, argv)) exit(EXIT_FAILURE);
+    config.headless = true;
+    if (config.max_frames == 0 && config.max_insts == 0) config.max_frames = 600;
+
+    // Play back recorded input with the settings it was recorded with
+    input_log_t *replay = NULL;
+    if (config.replay && !(replay = replay_open(config.replay, &config))) exit(EXIT_FAILURE);
+
+    // Initialize CHIP8 machine
+    chip8_t chip8 = {0};
+    const char *rom_name = argv[1];
+    if (!init_chip8(&chip8, config, rom_name)) exit(EXIT_FAILURE);
+    if (replay) snapshot_chip8(&chip8, &replay->boot);
+    if (config.load_state && !load_state_file(&chip8, config.load_state)) exit(EXIT_FAILURE);
+
+    const bool ok = run_headless(&chip8, config, replay);
+    replay_close(replay);
+    if (!ok) exit(EXIT_FAILURE);
+
+    exit(EXIT_SUCCESS);
+}
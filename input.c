@@ -0,0 +1,183 @@
+#include "chip8.h"
+
+// Input recording and replay
+//   Keys only ever change between frames and CXNN draws from the machine's own seeded generator,
+//   so a run is fully determined by its RNG seed, clock rate, quirks and the keypad at the start
+//   of each frame. A recording is just those, plus every keypad change (or machine reset) keyed by
+//   the frame it happened before. The instruction count at each change and the final display hash
+//   are stored too, so a replay can tell if it ran differently.
+//
+// File format: input_header_t, then num_events events of
+//   varint (frame delta << 1 | reset), varint instruction count delta, keys (2 bytes, low first)
+//   Varints are 7 bits a byte, low bits first, top bit set on all but the last byte
+
+#define INPUT_FILE_VERSION 1
+
+typedef struct {
+    char magic[4];              // "C8IN"
+    uint16_t version;           // INPUT_FILE_VERSION
+    uint16_t byte_order;        // 0x0102 as written by the recording host
+    uint32_t rng_seed;
+    uint32_t insts_per_second;
+    uint32_t extension;         // extension_t
+    uint32_t num_events;
+    uint64_t frames;            // Length of the recording
+    uint64_t insts;             // Instructions run in it
+    uint64_t display_hash;      // Display at the end of it
+    uint8_t reserved[16];       // Zero
+} input_header_t;
+
+_Static_assert(sizeof(input_header_t) == 64, "input recording header is 64 bytes");
+
+static void write_varint(FILE *file, uint64_t value) {
+    for (; value >= 0x80; value >>= 7) fputc((value & 0x7F) | 0x80, file);
+    fputc(value, file);
+}
+
+static bool read_varint(FILE *file, uint64_t *value) {
+    *value = 0;
+    for (uint8_t shift = 0; shift < 64; shift += 7) {
+        const int byte = fgetc(file);
+        if (byte == EOF) return false;
+
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+
+    return false;   // Too long
+}
+
+// Start recording input to a file, for a machine about to run with config; NULL on error
+input_log_t *record_open(const char path[], const config_t config) {
+    input_log_t *log = calloc(1, sizeof *log);
+    if (!log) return NULL;
+
+    log->file = fopen(path, "wb");
+    if (!log->file) {
+        fprintf(stderr, "Could not open input recording %s for writing\n", path);
+        free(log);
+        return NULL;
+    }
+
+    log->rng_seed = config.rng_seed;
+    log->insts_per_second = config.insts_per_second;
+    log->extension = config.current_extension;
+
+    // Header is written again with the totals when the recording is closed
+    const input_header_t header = {0};
+    fwrite(&header, sizeof header, 1, log->file);
+    return log;
+}
+
+// Record the keys held from a frame on (1 bit per key), and whether the machine was reset first
+void record_input(input_log_t *log, const uint64_t frame, const uint64_t insts,
+                  const uint16_t keys, const bool reset) {
+    write_varint(log->file, (frame - log->frames) << 1 | reset);
+    write_varint(log->file, insts - log->insts);
+    fputc(keys & 0xFF, log->file);
+    fputc(keys >> 8, log->file);
+
+    log->frames = frame;
+    log->insts = insts;
+    log->num_events++;
+}
+
+// Finish a recording that ran for frames frames and insts instructions, ending with chip8's display
+bool record_close(input_log_t *log, const uint64_t frames, const uint64_t insts, const chip8_t *chip8) {
+    const input_header_t header = {
+        .magic = { 'C', '8', 'I', 'N' },
+        .version = INPUT_FILE_VERSION,
+        .byte_order = 0x0102,
+        .rng_seed = log->rng_seed,
+        .insts_per_second = log->insts_per_second,
+        .extension = log->extension,
+        .num_events = log->num_events,
+        .frames = frames,
+        .insts = insts,
+        .display_hash = display_hash(chip8),
+    };
+
+    bool ok = fseek(log->file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof header, 1, log->file) == 1;
+    ok &= (fclose(log->file) == 0);
+    if (!ok) fprintf(stderr, "Could not write input recording\n");
+
+    free(log);
+    return ok;
+}
+
+// Read a whole input recording to replay, and set config up to run it the way it was recorded;
+//   NULL on error
+input_log_t *replay_open(const char path[], config_t *config) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Input recording %s is invalid or does not exist\n", path);
+        return NULL;
+    }
+
+    input_header_t header;
+    input_log_t *log = calloc(1, sizeof *log);
+    if (!log || fread(&header, sizeof header, 1, file) != 1 ||
+        memcmp(header.magic, "C8IN", sizeof header.magic) != 0) {
+        fprintf(stderr, "%s is not an input recording\n", path);
+        goto error;
+    }
+
+    if (header.version != INPUT_FILE_VERSION || header.byte_order != 0x0102 || header.extension > XOCHIP) {
+        fprintf(stderr, "Input recording %s was written by an incompatible version or host\n", path);
+        goto error;
+    }
+
+    *log = (input_log_t){
+        .rng_seed = header.rng_seed,
+        .insts_per_second = header.insts_per_second,
+        .extension = header.extension,
+        .frames = header.frames,
+        .insts = header.insts,
+        .display_hash = header.display_hash,
+        .events = calloc(header.num_events ? header.num_events : 1, sizeof *log->events),
+    };
+    if (!log->events) goto error;
+
+    uint64_t frame = 0;
+    uint64_t insts = 0;
+    for (; log->num_events < header.num_events; log->num_events++) {
+        uint64_t frame_delta, insts_delta;
+        uint8_t keys[2];
+        if (!read_varint(file, &frame_delta) || !read_varint(file, &insts_delta) ||
+            fread(keys, sizeof keys, 1, file) != 1) {
+            fprintf(stderr, "Input recording %s is cut short\n", path);
+            goto error;
+        }
+
+        frame += frame_delta >> 1;
+        insts += insts_delta;
+        log->events[log->num_events] = (input_event_t){
+            .frame = frame,
+            .insts = insts,
+            .keys = keys[0] | keys[1] << 8,
+            .reset = frame_delta & 1,
+        };
+    }
+
+    fclose(file);
+
+    config->rng_seed = log->rng_seed;
+    config->insts_per_second = log->insts_per_second;
+    config->current_extension = log->extension;
+    config->max_frames = log->frames;
+    config->max_insts = 0;
+    return log;     // Success
+
+error:
+    if (log) free(log->events);
+    free(log);
+    fclose(file);
+    return NULL;
+}
+
+void replay_close(input_log_t *log) {
+    if (!log) return;
+
+    free(log->events);
+    free(log);
+}
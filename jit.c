@@ -0,0 +1,761 @@
+#define _DEFAULT_SOURCE     // mmap() MAP_ANONYMOUS
+#include <stddef.h>
+
+#include "chip8.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+
+// x86-64 dynamic recompiler
+//   Straight-line CHIP8 code from a branch target up to the next jump/call/return/skip is
+//   translated into 1 native block, cached by its start PC. Inside a block the V registers
+//   it uses live in host registers, and are written back to chip8->V when the block exits.
+//   Anything the JIT does not compile (DXYN, FX33/FX55/FX65, CXNN, FX0A, ...) ends the block
+//   and is run by the interpreter instead, 1 instruction at a time.
+
+#define JIT_CODE_SIZE (1024 * 1024)     // Bytes of executable memory per machine
+#define JIT_MAX_BLOCKS 4096
+#define JIT_MAX_BLOCK_INSTS 64          // Longest block, in CHIP8 instructions
+#define JIT_MAX_INST_BYTES 64           // Worst case native code for 1 CHIP8 instruction
+#define JIT_MAX_EXTRA_BYTES 512         // Worst case block prologue + epilogue
+
+// x86-64 general purpose registers
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// Host registers CHIP8 V registers can live in; RAX/RCX are scratch, RDI holds chip8_t *
+static const uint8_t v_host_regs[] = { RDX, RSI, R8, R9, R10, R11, RBX, RBP, R12, R13, R14, R15 };
+#define NUM_V_HOST_REGS (sizeof v_host_regs / sizeof v_host_regs[0])
+
+// Field offsets in chip8_t, used as [rdi + disp32] memory operands
+#define OFF_V(x)    ((int32_t)(offsetof(chip8_t, V) + (x)))
+#define OFF_I       ((int32_t)offsetof(chip8_t, I))
+#define OFF_PC      ((int32_t)offsetof(chip8_t, PC))
+#define OFF_SP      ((int32_t)offsetof(chip8_t, stack_ptr))
+#define OFF_STACK   ((int32_t)offsetof(chip8_t, stack))
+#define OFF_STACK_END (OFF_STACK + STACK_SIZE * 2)
+#define OFF_TICKS   ((int32_t)offsetof(chip8_t, ticks))
+#define OFF_DT_END  ((int32_t)offsetof(chip8_t, delay_end))
+#define OFF_ST_END  ((int32_t)offsetof(chip8_t, sound_end))
+#define OFF_KEYPAD  ((int32_t)offsetof(chip8_t, keypad))
+#define OFF_EFFECTS ((int32_t)offsetof(chip8_t, effects))
+
+// Native code of a block, called with chip8_t * in RDI
+typedef void (*jit_code_t)(chip8_t *chip8);
+
+// Compiled block of CHIP8 code
+typedef struct {
+    uint16_t start;     // CHIP8 address of first instruction
+    uint16_t end;       // CHIP8 address after last instruction, == start if invalidated
+    uint16_t insts;     // Instructions in block, 0 if the first one can't be compiled
+    jit_code_t code;    // Native code, NULL if insts == 0
+} jit_block_t;
+
+// JIT code cache for 1 machine
+struct jit {
+    uint8_t *code;                      // Executable memory, NULL if the host refused it
+    uint32_t code_used;
+    jit_block_t blocks[JIT_MAX_BLOCKS];
+    uint32_t num_blocks;
+    jit_block_t *block_at[4096];        // Block starting at each CHIP8 address
+    uint16_t code_refs[4096];           // Number of live blocks covering each RAM byte
+    extension_t extension;              // Extension/quirks the blocks were compiled for
+    chip8_t *shadow;                    // JIT_LOCKSTEP: interpreter copy of the machine
+};
+
+// ---- x86-64 instruction encoding ----
+
+#define EMIT(b) (*(*p)++ = (uint8_t)(b))
+
+static void emit32(uint8_t **p, const uint32_t value) {
+    for (uint8_t i = 0; i < 4; i++) EMIT(value >> (i * 8));
+}
+
+// REX prefix; only emitted if needed, or if forced for byte access to SIL/DIL/BPL/SPL
+static void emit_rex(uint8_t **p, const bool w, const uint8_t reg, const uint8_t rm, const bool force) {
+    const uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex != 0x40 || force) EMIT(rex);
+}
+
+// ModRM for [rdi + disp32]
+static void emit_mem(uint8_t **p, const uint8_t reg, const int32_t disp) {
+    EMIT(0x80 | ((reg & 7) << 3) | RDI);
+    emit32(p, disp);
+}
+
+// <op> dst32, src32 for the "op r/m32, r32" forms (mov 0x89, add 0x01, or 0x09, ...)
+static void emit_rr(uint8_t **p, const uint8_t opcode, const uint8_t dst, const uint8_t src) {
+    emit_rex(p, false, src, dst, false);
+    EMIT(opcode);
+    EMIT(0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+// <op> dst32, imm32 for the 0x81 group (add /0, or /1, and /4, sub /5, xor /6, cmp /7)
+static void emit_ri(uint8_t **p, const uint8_t ext, const uint8_t dst, const uint32_t imm) {
+    emit_rex(p, false, 0, dst, false);
+    EMIT(0x81);
+    EMIT(0xC0 | (ext << 3) | (dst & 7));
+    emit32(p, imm);
+}
+
+// mov dst32, imm32
+static void emit_mov_ri(uint8_t **p, const uint8_t dst, const uint32_t imm) {
+    emit_rex(p, false, 0, dst, false);
+    EMIT(0xB8 + (dst & 7));
+    emit32(p, imm);
+}
+
+// <shift> dst32, imm8 for the 0xC1 group (shl /4, shr /5)
+static void emit_shift(uint8_t **p, const uint8_t ext, const uint8_t dst, const uint8_t imm) {
+    emit_rex(p, false, 0, dst, false);
+    EMIT(0xC1);
+    EMIT(0xC0 | (ext << 3) | (dst & 7));
+    EMIT(imm);
+}
+
+// and dst32, 0xFF; keeps a host register holding a V register in 0-255
+static void emit_mask8(uint8_t **p, const uint8_t dst) {
+    emit_ri(p, 4, dst, 0xFF);
+}
+
+// movzx dst32, byte [rdi + disp]
+static void emit_load_u8(uint8_t **p, const uint8_t dst, const int32_t disp) {
+    emit_rex(p, false, dst, RDI, false);
+    EMIT(0x0F); EMIT(0xB6);
+    emit_mem(p, dst, disp);
+}
+
+// mov byte [rdi + disp], src8
+static void emit_store_u8(uint8_t **p, const uint8_t src, const int32_t disp) {
+    emit_rex(p, false, src, RDI, true);
+    EMIT(0x88);
+    emit_mem(p, src, disp);
+}
+
+// movzx eax, word [rdi + disp]
+static void emit_load_u16_eax(uint8_t **p, const int32_t disp) {
+    EMIT(0x0F); EMIT(0xB7);
+    emit_mem(p, RAX, disp);
+}
+
+// mov word [rdi + disp], ax
+static void emit_store_u16_ax(uint8_t **p, const int32_t disp) {
+    EMIT(0x66); EMIT(0x89);
+    emit_mem(p, RAX, disp);
+}
+
+// mov word [rdi + disp], imm16
+static void emit_store_u16_imm(uint8_t **p, const int32_t disp, const uint16_t imm) {
+    EMIT(0x66); EMIT(0xC7);
+    emit_mem(p, 0, disp);
+    EMIT(imm); EMIT(imm >> 8);
+}
+
+// qword [rdi + disp] = ticks + src, the tick a timer set to src runs out at
+static void emit_timer_end(uint8_t **p, const uint8_t src, const int32_t disp) {
+    EMIT(0x48); EMIT(0x8B); emit_mem(p, RAX, OFF_TICKS);    // mov rax, [rdi + ticks]
+    emit_rex(p, true, src, RAX, false);                     // add rax, src
+    EMIT(0x01);
+    EMIT(0xC0 | ((src & 7) << 3) | RAX);
+    EMIT(0x48); EMIT(0x89); emit_mem(p, RAX, disp);         // mov [rdi + disp], rax
+}
+
+// rax = &chip8 field at to if rax points at the one at from, for the subroutine stack ring
+static void emit_stack_wrap(uint8_t **p, const int32_t from, const int32_t to) {
+    EMIT(0x48); EMIT(0x8D); emit_mem(p, RCX, from);         // lea rcx, [rdi + from]
+    EMIT(0x48); EMIT(0x39); EMIT(0xC8);                     // cmp rax, rcx
+    EMIT(0x48); EMIT(0x8D); emit_mem(p, RCX, to);           // lea rcx, [rdi + to]
+    EMIT(0x48); EMIT(0x0F); EMIT(0x44); EMIT(0xC1);         // cmove rax, rcx
+}
+
+// Set PC to next_pc, or next_pc + 2 if the flags match condition code cc (skip);
+//   eax must have been zeroed before the flags were set
+static void emit_skip(uint8_t **p, const uint8_t cc, const uint16_t next_pc) {
+    EMIT(0x0F); EMIT(0x90 | cc); EMIT(0xC0);                // setcc al
+    EMIT(0x8D); EMIT(0x04); EMIT(0x45); emit32(p, next_pc); // lea eax, [rax*2 + next_pc]
+    emit_store_u16_ax(p, OFF_PC);
+}
+
+#define CC_AE 0x3
+#define CC_E  0x4
+#define CC_NE 0x5
+
+// ---- Block compiler ----
+
+// V registers read or written by a decoded instruction, 0xFFFF if the JIT can't compile it
+static uint16_t regs_used(const decoded_t *inst) {
+    const uint16_t X = 1 << inst->X;
+    const uint16_t Y = 1 << inst->Y;
+    const uint16_t F = 1 << 0xF;
+
+    switch (inst->op) {
+        case OP_NOP:
+        case OP_JP:
+        case OP_CALL:
+        case OP_RET:
+        case OP_LD_I:
+            return 0;
+
+        case OP_LD_VX_NN:
+        case OP_ADD_VX_NN:
+        case OP_SE_VX_NN:
+        case OP_SNE_VX_NN:
+        case OP_SKP:
+        case OP_SKNP:
+        case OP_LD_VX_DT:
+        case OP_LD_DT_VX:
+        case OP_LD_ST_VX:
+        case OP_ADD_I_VX:
+        case OP_LD_F_VX:
+            return X;
+
+        case OP_LD_VX_VY:
+        case OP_OR:
+        case OP_AND:
+        case OP_XOR:
+        case OP_SE_VX_VY:
+        case OP_SNE_VX_VY:
+            return X | Y;
+
+        case OP_SHR_VX:
+        case OP_SHL_VX:
+            return X | F;
+
+        case OP_OR_VF_RESET:
+        case OP_AND_VF_RESET:
+        case OP_XOR_VF_RESET:
+        case OP_ADD_VX_VY:
+        case OP_SUB:
+        case OP_SUBN:
+        case OP_SHR_VY:
+        case OP_SHL_VY:
+            return X | Y | F;
+
+        default:
+            return 0xFFFF;  // Left to the interpreter
+    }
+}
+
+// Does this instruction end a block (changes PC)
+static bool ends_block(const decoded_t *inst) {
+    switch (inst->op) {
+        case OP_JP:
+        case OP_CALL:
+        case OP_RET:
+        case OP_SE_VX_NN:
+        case OP_SNE_VX_NN:
+        case OP_SE_VX_VY:
+        case OP_SNE_VX_VY:
+        case OP_SKP:
+        case OP_SKNP:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Emit native code for 1 CHIP8 instruction; host[] maps V registers to host registers,
+//   next_pc is the address of the following instruction
+static void emit_instruction(uint8_t **p, const decoded_t *inst, const uint8_t host[16],
+                             const uint16_t next_pc) {
+    const uint8_t rX = host[inst->X];
+    const uint8_t rY = host[inst->Y];
+    const uint8_t rF = host[0xF];
+
+    switch (inst->op) {
+        case OP_NOP:
+            break;
+
+        case OP_JP:
+            // 0x1NNN: Jump to address NNN
+            emit_store_u16_imm(p, OFF_PC, inst->NNN);
+            break;
+
+        case OP_CALL:
+            // 0x2NNN: Push return address, jump to NNN; the stack wraps around as stack_push()
+            EMIT(0x48); EMIT(0x8B); emit_mem(p, RAX, OFF_SP);   // mov rax, [rdi + stack_ptr]
+            EMIT(0x66); EMIT(0xC7); EMIT(0x00);                 // mov word [rax], next_pc
+            EMIT(next_pc); EMIT(next_pc >> 8);
+            EMIT(0x48); EMIT(0x83); EMIT(0xC0); EMIT(0x02);     // add rax, 2
+            emit_stack_wrap(p, OFF_STACK_END, OFF_STACK);
+            EMIT(0x48); EMIT(0x89); emit_mem(p, RAX, OFF_SP);   // mov [rdi + stack_ptr], rax
+            EMIT(0x83); emit_mem(p, 0, OFF_EFFECTS); EMIT(0x01);  // add dword [rdi + effects], 1
+            emit_store_u16_imm(p, OFF_PC, inst->NNN);
+            break;
+
+        case OP_RET:
+            // 0x00EE: Pop return address into PC; the stack wraps around as stack_pop()
+            EMIT(0x48); EMIT(0x8B); emit_mem(p, RAX, OFF_SP);   // mov rax, [rdi + stack_ptr]
+            emit_stack_wrap(p, OFF_STACK, OFF_STACK_END);
+            EMIT(0x48); EMIT(0x83); EMIT(0xE8); EMIT(0x02);     // sub rax, 2
+            EMIT(0x48); EMIT(0x89); emit_mem(p, RAX, OFF_SP);   // mov [rdi + stack_ptr], rax
+            EMIT(0x0F); EMIT(0xB7); EMIT(0x00);                 // movzx eax, word [rax]
+            emit_store_u16_ax(p, OFF_PC);
+            break;
+
+        case OP_SE_VX_NN:
+        case OP_SNE_VX_NN:
+            // 0x3XNN/0x4XNN: Skip next instruction if VX ==/!= NN
+            emit_rr(p, 0x31, RAX, RAX);
+            emit_ri(p, 7, rX, inst->NN);
+            emit_skip(p, inst->op == OP_SE_VX_NN ? CC_E : CC_NE, next_pc);
+            break;
+
+        case OP_SE_VX_VY:
+        case OP_SNE_VX_VY:
+            // 0x5XY0/0x9XY0: Skip next instruction if VX ==/!= VY
+            emit_rr(p, 0x31, RAX, RAX);
+            emit_rr(p, 0x39, rX, rY);
+            emit_skip(p, inst->op == OP_SE_VX_VY ? CC_E : CC_NE, next_pc);
+            break;
+
+        case OP_SKP:
+        case OP_SKNP:
+            // 0xEX9E/0xEXA1: Skip next instruction if key in VX (low nibble) is/isn't pressed
+            emit_rr(p, 0x89, RAX, rX);
+            EMIT(0x83); EMIT(0xE0); EMIT(0x0F);                 // and eax, 0xF
+            EMIT(0x0F); EMIT(0xB6); EMIT(0x8C); EMIT(0x07);     // movzx ecx, byte [rdi + rax + keypad]
+            emit32(p, OFF_KEYPAD);
+            emit_rr(p, 0x31, RAX, RAX);
+            EMIT(0x85); EMIT(0xC9);                             // test ecx, ecx
+            emit_skip(p, inst->op == OP_SKP ? CC_NE : CC_E, next_pc);
+            break;
+
+        case OP_LD_VX_NN:
+            // 0x6XNN: VX = NN
+            emit_mov_ri(p, rX, inst->NN);
+            break;
+
+        case OP_ADD_VX_NN:
+            // 0x7XNN: VX += NN
+            emit_ri(p, 0, rX, inst->NN);
+            emit_mask8(p, rX);
+            break;
+
+        case OP_LD_VX_VY:
+            // 0x8XY0: VX = VY
+            emit_rr(p, 0x89, rX, rY);
+            break;
+
+        case OP_OR:
+        case OP_OR_VF_RESET:
+            // 0x8XY1: VX |= VY
+            emit_rr(p, 0x09, rX, rY);
+            if (inst->op == OP_OR_VF_RESET) emit_mov_ri(p, rF, 0);
+            break;
+
+        case OP_AND:
+        case OP_AND_VF_RESET:
+            // 0x8XY2: VX &= VY
+            emit_rr(p, 0x21, rX, rY);
+            if (inst->op == OP_AND_VF_RESET) emit_mov_ri(p, rF, 0);
+            break;
+
+        case OP_XOR:
+        case OP_XOR_VF_RESET:
+            // 0x8XY3: VX ^= VY
+            emit_rr(p, 0x31, rX, rY);
+            if (inst->op == OP_XOR_VF_RESET) emit_mov_ri(p, rF, 0);
+            break;
+
+        case OP_ADD_VX_VY:
+            // 0x8XY4: VX += VY, VF = carry
+            emit_rr(p, 0x01, rX, rY);
+            emit_rr(p, 0x89, RAX, rX);
+            emit_shift(p, 5, RAX, 8);
+            emit_mask8(p, rX);
+            emit_rr(p, 0x89, rF, RAX);
+            break;
+
+        case OP_SUB:
+            // 0x8XY5: VX -= VY, VF = no borrow (VX >= VY)
+            emit_rr(p, 0x31, RAX, RAX);
+            emit_rr(p, 0x39, rX, rY);
+            EMIT(0x0F); EMIT(0x90 | CC_AE); EMIT(0xC0);         // setae al
+            emit_rr(p, 0x29, rX, rY);
+            emit_mask8(p, rX);
+            emit_rr(p, 0x89, rF, RAX);
+            break;
+
+        case OP_SUBN:
+            // 0x8XY7: VX = VY - VX, VF = no borrow (VY >= VX)
+            emit_rr(p, 0x31, RAX, RAX);
+            emit_rr(p, 0x39, rY, rX);
+            EMIT(0x0F); EMIT(0x90 | CC_AE); EMIT(0xC0);         // setae al
+            emit_rr(p, 0x89, RCX, rY);
+            emit_rr(p, 0x29, RCX, rX);
+            emit_mask8(p, RCX);
+            emit_rr(p, 0x89, rX, RCX);
+            emit_rr(p, 0x89, rF, RAX);
+            break;
+
+        case OP_SHR_VX:
+        case OP_SHR_VY: {
+            // 0x8XY6: VX = VX (or VY on CHIP8) >> 1, VF = shifted off bit
+            const uint8_t src = (inst->op == OP_SHR_VY) ? rY : rX;
+            emit_rr(p, 0x89, RAX, src);
+            emit_ri(p, 4, RAX, 1);
+            emit_rr(p, 0x89, rX, src);
+            emit_shift(p, 5, rX, 1);
+            emit_rr(p, 0x89, rF, RAX);
+            break;
+        }
+
+        case OP_SHL_VX:
+        case OP_SHL_VY: {
+            // 0x8XYE: VX = VX (or VY on CHIP8) << 1, VF = shifted off bit
+            const uint8_t src = (inst->op == OP_SHL_VY) ? rY : rX;
+            emit_rr(p, 0x89, RAX, src);
+            emit_shift(p, 5, RAX, 7);
+            emit_rr(p, 0x89, rX, src);
+            emit_shift(p, 4, rX, 1);
+            emit_mask8(p, rX);
+            emit_rr(p, 0x89, rF, RAX);
+            break;
+        }
+
+        case OP_LD_I:
+            // 0xANNN: I = NNN
+            emit_store_u16_imm(p, OFF_I, inst->NNN);
+            break;
+
+        case OP_ADD_I_VX:
+            // 0xFX1E: I += VX
+            emit_load_u16_eax(p, OFF_I);
+            emit_rr(p, 0x01, RAX, rX);
+            emit_store_u16_ax(p, OFF_I);
+            break;
+
+        case OP_LD_F_VX:
+            // 0xFX29: I = VX * 5 (font character)
+            emit_rr(p, 0x89, RAX, rX);
+            EMIT(0x8D); EMIT(0x04); EMIT(0x80);                 // lea eax, [rax + rax*4]
+            emit_store_u16_ax(p, OFF_I);
+            break;
+
+        case OP_LD_VX_DT:
+            // 0xFX07: VX = delay timer, the ticks left until it runs out or 0
+            EMIT(0x31); EMIT(0xC9);                             // xor ecx, ecx
+            EMIT(0x48); EMIT(0x8B); emit_mem(p, RAX, OFF_DT_END);   // mov rax, [rdi + delay_end]
+            EMIT(0x48); EMIT(0x2B); emit_mem(p, RAX, OFF_TICKS);    // sub rax, [rdi + ticks]
+            EMIT(0x48); EMIT(0x0F); EMIT(0x42); EMIT(0xC1);     // cmovb rax, rcx
+            emit_rr(p, 0x89, rX, RAX);
+            break;
+
+        case OP_LD_DT_VX:
+            // 0xFX15: delay timer = VX, runs out VX ticks from now
+            emit_timer_end(p, rX, OFF_DT_END);
+            break;
+
+        case OP_LD_ST_VX:
+            // 0xFX18: sound timer = VX
+            emit_timer_end(p, rX, OFF_ST_END);
+            break;
+
+        default:
+            break;  // Never compiled, see regs_used()
+    }
+}
+
+// V registers written by an instruction the JIT compiles
+static uint16_t regs_written(const decoded_t *inst) {
+    switch (inst->op) {
+        case OP_LD_VX_NN:
+        case OP_ADD_VX_NN:
+        case OP_LD_VX_VY:
+        case OP_OR:
+        case OP_AND:
+        case OP_XOR:
+        case OP_LD_VX_DT:
+            return 1 << inst->X;
+
+        case OP_OR_VF_RESET:
+        case OP_AND_VF_RESET:
+        case OP_XOR_VF_RESET:
+        case OP_ADD_VX_VY:
+        case OP_SUB:
+        case OP_SUBN:
+        case OP_SHR_VX:
+        case OP_SHR_VY:
+        case OP_SHL_VX:
+        case OP_SHL_VY:
+            return (1 << inst->X) | (1 << 0xF);
+
+        default:
+            return 0;
+    }
+}
+
+// Drop every compiled block
+static void flush_blocks(jit_t *jit, const extension_t extension) {
+    jit->code_used = 0;
+    jit->num_blocks = 0;
+    memset(jit->block_at, 0, sizeof jit->block_at);
+    memset(jit->code_refs, 0, sizeof jit->code_refs);
+    jit->extension = extension;
+}
+
+// Drop every block containing a RAM address that was just written to
+static void invalidate_address(jit_t *jit, const uint16_t address) {
+    for (uint32_t i = 0; jit->code_refs[address] && i < jit->num_blocks; i++) {
+        jit_block_t *block = &jit->blocks[i];
+        if (address < block->start || address >= block->end) continue;
+
+        for (uint16_t a = block->start; a < block->end; a++)
+            jit->code_refs[a]--;
+
+        jit->block_at[block->start] = NULL;
+        block->end = block->start;
+    }
+}
+
+// Translate the block of CHIP8 code starting at an even address
+static jit_block_t *compile_block(jit_t *jit, const chip8_t *chip8, const uint16_t start) {
+    decoded_t insts[JIT_MAX_BLOCK_INSTS];
+    uint16_t num_insts = 0;
+    uint16_t used = 0;      // V registers used in this block
+    uint16_t dirty = 0;     // V registers written in this block
+    uint16_t pc = start;
+
+    // Make room for the worst case block
+    if (jit->num_blocks >= JIT_MAX_BLOCKS ||
+        jit->code_used + JIT_MAX_BLOCK_INSTS * JIT_MAX_INST_BYTES + JIT_MAX_EXTRA_BYTES > JIT_CODE_SIZE)
+        flush_blocks(jit, jit->extension);
+
+    // Find the end of the block, stopping before anything that can't be compiled or
+    //   would need more V registers than there are host registers to hold them
+    while (num_insts < JIT_MAX_BLOCK_INSTS && pc + 1 < (uint16_t)sizeof chip8->ram) {
+        const decoded_t inst = decode_instruction((chip8->ram[pc] << 8) | chip8->ram[pc+1],
+                                                  jit->extension);
+        const uint16_t regs = regs_used(&inst);
+        if (regs == 0xFFFF) break;
+        if (__builtin_popcount(used | regs) > (int)NUM_V_HOST_REGS) break;
+
+        used |= regs;
+        dirty |= regs_written(&inst);
+        insts[num_insts++] = inst;
+        pc += 2;
+
+        if (ends_block(&inst)) break;
+    }
+
+    jit_block_t *block = &jit->blocks[jit->num_blocks++];
+    *block = (jit_block_t){
+        .start = start,
+        .end = num_insts ? pc : start + 2,  // Uncompilable blocks still need invalidating
+        .insts = num_insts,
+        .code = NULL,
+    };
+    jit->block_at[start] = block;
+    for (uint16_t a = block->start; a < block->end; a++)
+        jit->code_refs[a]++;
+
+    if (num_insts == 0) return block;
+
+    // Assign host registers to the V registers used
+    uint8_t host[16] = {0};
+    uint8_t num_host = 0;
+    for (uint8_t v = 0; v < 16; v++)
+        if (used & (1 << v)) host[v] = v_host_regs[num_host++];
+
+    uint8_t *const code = jit->code + jit->code_used;
+    uint8_t *cursor = code;
+    uint8_t **p = &cursor;
+
+    // Prologue: save callee saved registers, load V registers
+    for (uint8_t i = 0; i < num_host; i++) {
+        const uint8_t r = v_host_regs[i];
+        if (r == RBX || r == RBP || r >= R12) {
+            if (r >= R8) EMIT(0x41);
+            EMIT(0x50 + (r & 7));   // push r
+        }
+    }
+    for (uint8_t v = 0; v < 16; v++)
+        if (used & (1 << v)) emit_load_u8(p, host[v], OFF_V(v));
+
+    // Body
+    for (uint16_t i = 0; i < num_insts; i++)
+        emit_instruction(p, &insts[i], host, start + (i + 1) * 2);
+
+    // Epilogue: write back V registers, set PC if the block just ran off its end,
+    //   restore callee saved registers
+    for (uint8_t v = 0; v < 16; v++)
+        if (dirty & (1 << v)) emit_store_u8(p, host[v], OFF_V(v));
+
+    if (!ends_block(&insts[num_insts-1]))
+        emit_store_u16_imm(p, OFF_PC, pc);
+
+    for (int8_t i = num_host - 1; i >= 0; i--) {
+        const uint8_t r = v_host_regs[i];
+        if (r == RBX || r == RBP || r >= R12) {
+            if (r >= R8) EMIT(0x41);
+            EMIT(0x58 + (r & 7));   // pop r
+        }
+    }
+    EMIT(0xC3);     // ret
+
+    jit->code_used += cursor - code;
+    block->code = (jit_code_t)(void *)code;
+    return block;
+}
+
+// ---- Driver ----
+
+// Get (creating on first use) the JIT for a machine, NULL if the host has no executable memory
+static jit_t *get_jit(chip8_t *chip8, const config_t config) {
+    if (!chip8->jit) {
+        chip8->jit = calloc(1, sizeof *chip8->jit);
+        if (!chip8->jit) return NULL;
+
+        void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED)
+            fprintf(stderr, "Could not map JIT code memory, using the interpreter\n");
+        else
+            chip8->jit->code = code;
+
+        flush_blocks(chip8->jit, config.current_extension);
+    }
+
+    if (!chip8->jit->code) return NULL;
+
+    if (config.engine == JIT_LOCKSTEP && !chip8->jit->shadow) {
+        chip8->jit->shadow = malloc(sizeof *chip8->jit->shadow);
+        if (!chip8->jit->shadow) return NULL;
+    }
+
+    // Blocks are only valid for the extension they were compiled for
+    if (chip8->jit->extension != config.current_extension)
+        flush_blocks(chip8->jit, config.current_extension);
+
+    return chip8->jit;
+}
+
+// JIT_LOCKSTEP: copy machine state into the shadow before a block runs
+static void lockstep_begin(chip8_t *shadow, const chip8_t *chip8) {
+    memcpy(shadow, chip8, sizeof *shadow);
+    shadow->stack_ptr = shadow->stack + (chip8->stack_ptr - chip8->stack);
+    shadow->jit = NULL;
+}
+
+// JIT_LOCKSTEP: run the same instructions on the shadow with the interpreter and compare
+static void lockstep_check(chip8_t *shadow, const chip8_t *chip8, const config_t config,
+                           const jit_block_t *block) {
+    const uint32_t count = interpret_instructions(shadow, config, block->insts);
+
+    if (count == block->insts &&
+        shadow->PC == chip8->PC &&
+        shadow->I == chip8->I &&
+        shadow->delay_end == chip8->delay_end &&
+        shadow->sound_end == chip8->sound_end &&
+        shadow->stack_ptr - shadow->stack == chip8->stack_ptr - chip8->stack &&
+        memcmp(shadow->V, chip8->V, sizeof chip8->V) == 0 &&
+        memcmp(shadow->stack, chip8->stack, sizeof chip8->stack) == 0 &&
+        memcmp(shadow->ram, chip8->ram, sizeof chip8->ram) == 0)
+        return;     // Identical
+
+    fprintf(stderr, "JIT lockstep mismatch in block 0x%04X-0x%04X (%u instructions)\n",
+            block->start, block->end, block->insts);
+    const chip8_t *machines[] = { shadow, chip8 };
+    const char *names[] = { "interpreter", "jit" };
+    for (uint8_t m = 0; m < 2; m++) {
+        fprintf(stderr, "%11s: PC: 0x%04X I: 0x%04X SP: %d DT: %u ST: %u V:", names[m],
+                machines[m]->PC, machines[m]->I, (int)(machines[m]->stack_ptr - machines[m]->stack),
+                read_delay_timer(machines[m]), read_sound_timer(machines[m]));
+        for (uint8_t i = 0; i < 16; i++) fprintf(stderr, " %02X", machines[m]->V[i]);
+        fprintf(stderr, "\n");
+    }
+    exit(EXIT_FAILURE);
+}
+
+// Emulate up to max_insts CHIP8 instructions using JIT compiled blocks where possible,
+//   returns instructions run. Stops early after a sprite draw on CHIP8 (display wait)
+uint32_t jit_emulate_instructions(chip8_t *chip8, const config_t config, const uint32_t max_insts) {
+    jit_t *jit = get_jit(chip8, config);
+    if (!jit) return interpret_instructions(chip8, config, max_insts);
+
+    const bool lockstep = (config.engine == JIT_LOCKSTEP);
+    const interpreter_t interpret = select_interpreter(chip8, config.current_extension);
+    uint32_t count = 0;
+
+    while (count < max_insts) {
+        const uint16_t PC = chip8->PC;
+        jit_block_t *block = NULL;
+
+        if ((PC & 1) == 0 && PC + 1 < (uint16_t)sizeof chip8->ram) {
+            block = jit->block_at[PC];
+            if (!block) block = compile_block(jit, chip8, PC);
+        }
+
+        // Run the whole block natively if it fits in the remaining instruction budget
+        if (block && block->insts && block->insts <= max_insts - count) {
+            if (lockstep) lockstep_begin(jit->shadow, chip8);
+
+            block->code(chip8);
+            count += block->insts;
+
+            if (lockstep) lockstep_check(jit->shadow, chip8, config, block);
+            continue;
+        }
+
+        // Otherwise interpret 1 instruction, watching for RAM writes over compiled code
+        const decoded_t inst = decode_instruction((chip8->ram[PC & 0xFFF] << 8) | chip8->ram[(PC+1) & 0xFFF],
+                                                  config.current_extension);
+        const uint16_t I = chip8->I;
+        count += interpret(chip8, 1);
+
+        switch (inst.op) {
+            case OP_LD_B_VX:
+                for (uint32_t offset = 0; offset < 3; offset++)
+                    invalidate_address(jit, (I + offset) & 0xFFF);
+                break;
+
+            case OP_STORE:
+            case OP_STORE_INC_I:
+                for (uint32_t offset = 0; offset <= inst.X; offset++)
+                    invalidate_address(jit, (I + offset) & 0xFFF);
+                break;
+
+            case OP_DRW_WAIT:
+                return count;   // Display wait, end of frame
+
+            default:
+                break;
+        }
+    }
+
+    return count;
+}
+
+// Free a machine's JIT code cache
+void jit_destroy(chip8_t *chip8) {
+    if (!chip8->jit) return;
+
+    if (chip8->jit->code) munmap(chip8->jit->code, JIT_CODE_SIZE);
+    free(chip8->jit->shadow);
+    free(chip8->jit);
+    chip8->jit = NULL;
+}
+
+// Drop any compiled blocks covering length bytes of RAM from address on
+void jit_invalidate(chip8_t *chip8, const uint16_t address, const uint16_t length) {
+    if (!chip8->jit) return;
+
+    for (uint32_t offset = 0; offset < length; offset++)
+        invalidate_address(chip8->jit, (address + offset) & 0xFFF);
+}
+
+#else
+// No JIT for this host, always interpret
+uint32_t jit_emulate_instructions(chip8_t *chip8, const config_t config, const uint32_t max_insts) {
+    return interpret_instructions(chip8, config, max_insts);
+}
+
+void jit_destroy(chip8_t *chip8) {
+    (void)chip8;
+}
+
+void jit_invalidate(chip8_t *chip8, const uint16_t address, const uint16_t length) {
+    (void)chip8; (void)address; (void)length;
+}
+#endif
@@ -0,0 +1,272 @@
+#include "chip8.h"
+
+// Execution profiling
+//   While chip8->profile points at a profile_t, the interpreter runs a profiling twin of itself
+//   that counts where straight runs of instructions start and end (jumps, taken skips, calls,
+//   returns, the start and end of every run), what each icache entry was decoded as, where the
+//   runs of RAM bytes it reads and writes start and end, and sprite collisions; the frontends
+//   count frames. Nothing is counted for an instruction that goes on to the next one but for the
+//   rare ones at odd addresses, which count their operation, and 2 counts per change of flow or
+//   access however many instructions or bytes it covers. Reports are written once at the end,
+//   summing instructions and RAM accesses per address up from where their runs start and end,
+//   and counting the instructions run at each address by operation between the times its icache
+//   entry was decoded as another (self modifying code), so every one counts as what it ran as.
+//   Profiling starts with an empty icache so everything run is decoded while profiling.
+//
+// Report formats:
+//   JSON: totals, then "ops" (every operation by name), "pc" ([address, count] for every address
+//     run) and "ram" ([address, reads, writes] for every address accessed)
+//   CSV: kind,name,count rows; kind is total, op, pc, read or write, name an address for the last 3
+//   Heatmap: binary PGM, 64x64 pixels; pixel n is address n, black if never run
+
+// Operation names for reports, opcode pattern then what it does
+static const char *op_names[OP_FUSED_FIRST] = {
+    [OP_DECODE]       = "decode",   // Never reported, always counted as what it decodes to
+    [OP_NOP]          = "0NNN NOP",
+    [OP_CLS]          = "00E0 CLS",
+    [OP_RET]          = "00EE RET",
+    [OP_JP]           = "1NNN JP",
+    [OP_CALL]         = "2NNN CALL",
+    [OP_SE_VX_NN]     = "3XNN SE VX NN",
+    [OP_SNE_VX_NN]    = "4XNN SNE VX NN",
+    [OP_SE_VX_VY]     = "5XY0 SE VX VY",
+    [OP_LD_VX_NN]     = "6XNN LD VX NN",
+    [OP_ADD_VX_NN]    = "7XNN ADD VX NN",
+    [OP_LD_VX_VY]     = "8XY0 LD VX VY",
+    [OP_OR]           = "8XY1 OR",
+    [OP_OR_VF_RESET]  = "8XY1 OR VF reset",
+    [OP_AND]          = "8XY2 AND",
+    [OP_AND_VF_RESET] = "8XY2 AND VF reset",
+    [OP_XOR]          = "8XY3 XOR",
+    [OP_XOR_VF_RESET] = "8XY3 XOR VF reset",
+    [OP_ADD_VX_VY]    = "8XY4 ADD VX VY",
+    [OP_SUB]          = "8XY5 SUB",
+    [OP_SHR_VX]       = "8XY6 SHR VX",
+    [OP_SHR_VY]       = "8XY6 SHR VY",
+    [OP_SUBN]         = "8XY7 SUBN",
+    [OP_SHL_VX]       = "8XYE SHL VX",
+    [OP_SHL_VY]       = "8XYE SHL VY",
+    [OP_SNE_VX_VY]    = "9XY0 SNE VX VY",
+    [OP_LD_I]         = "ANNN LD I",
+    [OP_JP_V0]        = "BNNN JP V0",
+    [OP_RND]          = "CXNN RND",
+    [OP_DRW]          = "DXYN DRW",
+    [OP_DRW_WAIT]     = "DXYN DRW display wait",
+    [OP_SKP]          = "EX9E SKP",
+    [OP_SKNP]         = "EXA1 SKNP",
+    [OP_LD_VX_DT]     = "FX07 LD VX DT",
+    [OP_LD_VX_K]      = "FX0A LD VX K",
+    [OP_LD_DT_VX]     = "FX15 LD DT VX",
+    [OP_LD_ST_VX]     = "FX18 LD ST VX",
+    [OP_ADD_I_VX]     = "FX1E ADD I VX",
+    [OP_LD_F_VX]      = "FX29 LD F VX",
+    [OP_LD_B_VX]      = "FX33 LD B VX",
+    [OP_STORE]        = "FX55 LD [I] VX",
+    [OP_STORE_INC_I]  = "FX55 LD [I] VX inc I",
+    [OP_LOAD]         = "FX65 LD VX [I]",
+    [OP_LOAD_INC_I]   = "FX65 LD VX [I] inc I",
+};
+
+// Print a string as a JSON string literal
+static void print_json_string(FILE *file, const char *string) {
+    fputc('"', file);
+    for (; *string; string++) {
+        if (*string == '"' || *string == '\\') fprintf(file, "\\%c", *string);
+        else if ((uint8_t)*string < 0x20) fprintf(file, "\\u%04x", (uint8_t)*string);
+        else fputc(*string, file);
+    }
+    fputc('"', file);
+}
+
+// A profile's instructions and RAM accesses per address and instructions per operation, summed up
+//   for reports
+typedef struct {
+    uint64_t pc[4096];              // Instructions run per address
+    uint64_t reads[4096];           // Data reads per address
+    uint64_t writes[4096];          // Writes per address
+    uint64_t ops[OP_FUSED_FIRST];   // Instructions run per operation
+    uint64_t insts;                 // Instructions run
+    uint64_t draws;                 // Sprites drawn
+} counts_t;
+
+// Operation each fused superinstruction starts with; the ones after it are counted from their own
+//   icache entries
+static const uint8_t fused_first_op[NUM_FUSED_OPS] = {
+    [OP_FUSED_ADD_SKIP_JP - OP_FUSED_FIRST] = OP_ADD_VX_NN,
+    [OP_FUSED_DT_SKIP_JP - OP_FUSED_FIRST]  = OP_LD_VX_DT,
+    [OP_FUSED_LD_I_DRW - OP_FUSED_FIRST]    = OP_LD_I,
+    [OP_FUSED_ADD_I_LOAD - OP_FUSED_FIRST]  = OP_ADD_I_VX,
+};
+
+// Instructions run at an address, from where the straight runs through it start and end
+static uint64_t count_runs(const int64_t runs[4096 + 2], const uint16_t address) {
+    int64_t count = 0;
+    for (uint16_t start = address & 1; start <= address; start += 2) count += runs[start];
+    return count;
+}
+
+// Count the instructions run so far at the even address PC as the operation its icache entry was
+//   decoded as until now, the one about to run there not included
+void profile_recount(profile_t *profile, const uint16_t PC) {
+    const uint16_t entry = (PC >> 1) & 0x7FF;
+    const uint64_t count = count_runs(profile->runs, PC & 0xFFF) - 1;
+    profile->ops[profile->cached[entry]] += count - profile->cached_from[entry];
+    profile->cached_from[entry] = count;
+}
+
+// Accesses per address, from how many bytes from each address on were accessed how often; the
+//   bytes past the end of RAM wrap around to its start
+static void count_accesses(const uint64_t access[17][4096], uint64_t counts[4096]) {
+    memset(counts, 0, 4096 * sizeof counts[0]);
+    for (uint8_t length = 1; length <= 16; length++)
+        for (uint16_t address = 0; address < 4096; address++)
+            if (access[length][address])
+                for (uint8_t i = 0; i < length; i++) counts[(address + i) & 0xFFF] += access[length][address];
+}
+
+// Sum up a profile's instructions, RAM accesses and operations
+static void count_profile(const profile_t *profile, counts_t *counts) {
+    int64_t runs[2] = { 0, 0 };     // Straight runs through the address, even and odd ones apart
+    for (uint16_t address = 0; address < 4096; address++) {
+        runs[address & 1] += profile->runs[address];
+        counts->pc[address] = runs[address & 1];
+    }
+
+    count_accesses(profile->reads, counts->reads);
+    count_accesses(profile->writes, counts->writes);
+
+    // Instructions run from the icache since its entry was last decoded count as that
+    uint64_t ops[OP_COUNT];
+    memcpy(ops, profile->ops, sizeof ops);
+    for (uint16_t entry = 0; entry < 4096/2; entry++)
+        ops[profile->cached[entry]] += counts->pc[entry * 2] - profile->cached_from[entry];
+
+    memcpy(counts->ops, ops, sizeof counts->ops);
+    for (uint8_t op = OP_FUSED_FIRST; op < OP_COUNT; op++)
+        counts->ops[fused_first_op[op - OP_FUSED_FIRST]] += ops[op];
+
+    counts->insts = 0;
+    for (uint8_t op = OP_NOP; op < OP_FUSED_FIRST; op++) counts->insts += counts->ops[op];
+    counts->draws = counts->ops[OP_DRW] + counts->ops[OP_DRW_WAIT];
+}
+
+static void print_json(FILE *file, const profile_t *profile, const counts_t *counts, const chip8_t *chip8) {
+    fprintf(file, "{\n  \"rom\": ");
+    print_json_string(file, chip8->rom_name ? chip8->rom_name : "");
+    fprintf(file, ",\n  \"instructions\": %llu,\n", (long long unsigned)counts->insts);
+    fprintf(file, "  \"frames\": %llu,\n", (long long unsigned)profile->frames);
+    fprintf(file, "  \"draw_frames\": %llu,\n", (long long unsigned)profile->draw_frames);
+    fprintf(file, "  \"draws\": %llu,\n", (long long unsigned)counts->draws);
+    fprintf(file, "  \"collisions\": %llu,\n", (long long unsigned)profile->collisions);
+
+    fprintf(file, "  \"ops\": {");
+    for (uint8_t op = OP_NOP; op < OP_FUSED_FIRST; op++)
+        fprintf(file, "%s\n    \"%s\": %llu", op > OP_NOP ? "," : "", op_names[op],
+                (long long unsigned)counts->ops[op]);
+
+    fprintf(file, "\n  },\n  \"pc\": [");
+    const char *separator = "";
+    for (uint16_t address = 0; address < 4096; address++) {
+        if (!counts->pc[address]) continue;
+        fprintf(file, "%s\n    [%u, %llu]", separator, address, (long long unsigned)counts->pc[address]);
+        separator = ",";
+    }
+
+    fprintf(file, "\n  ],\n  \"ram\": [");
+    separator = "";
+    for (uint16_t address = 0; address < 4096; address++) {
+        if (!counts->reads[address] && !counts->writes[address]) continue;
+        fprintf(file, "%s\n    [%u, %llu, %llu]", separator, address,
+                (long long unsigned)counts->reads[address], (long long unsigned)counts->writes[address]);
+        separator = ",";
+    }
+    fprintf(file, "\n  ]\n}\n");
+}
+
+static void print_csv(FILE *file, const profile_t *profile, const counts_t *counts) {
+    fprintf(file, "kind,name,count\n");
+    fprintf(file, "total,instructions,%llu\n", (long long unsigned)counts->insts);
+    fprintf(file, "total,frames,%llu\n", (long long unsigned)profile->frames);
+    fprintf(file, "total,draw_frames,%llu\n", (long long unsigned)profile->draw_frames);
+    fprintf(file, "total,draws,%llu\n", (long long unsigned)counts->draws);
+    fprintf(file, "total,collisions,%llu\n", (long long unsigned)profile->collisions);
+
+    for (uint8_t op = OP_NOP; op < OP_FUSED_FIRST; op++)
+        fprintf(file, "op,%s,%llu\n", op_names[op], (long long unsigned)counts->ops[op]);
+
+    for (uint16_t address = 0; address < 4096; address++)
+        if (counts->pc[address])
+            fprintf(file, "pc,0x%03X,%llu\n", address, (long long unsigned)counts->pc[address]);
+    for (uint16_t address = 0; address < 4096; address++)
+        if (counts->reads[address])
+            fprintf(file, "read,0x%03X,%llu\n", address, (long long unsigned)counts->reads[address]);
+    for (uint16_t address = 0; address < 4096; address++)
+        if (counts->writes[address])
+            fprintf(file, "write,0x%03X,%llu\n", address, (long long unsigned)counts->writes[address]);
+}
+
+// Write a profile as a report: CSV if path ends in .csv, JSON otherwise
+bool write_profile(const profile_t *profile, const chip8_t *chip8, const char path[]) {
+    counts_t *counts = malloc(sizeof *counts);
+    if (!counts) return false;
+    count_profile(profile, counts);
+
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Could not open profile report %s for writing\n", path);
+        free(counts);
+        return false;
+    }
+
+    const size_t length = strlen(path);
+    if (length >= 4 && strcmp(&path[length - 4], ".csv") == 0) print_csv(file, profile, counts);
+    else print_json(file, profile, counts, chip8);
+    free(counts);
+
+    if (ferror(file) | (fclose(file) != 0)) {
+        fprintf(stderr, "Could not write profile report %s\n", path);
+        return false;
+    }
+
+    return true;    // Success
+}
+
+// log2(x) in 8.8 fixed point for x >= 1, the fraction linear between powers of 2
+static uint32_t log2_fixed(const uint64_t x) {
+    const uint32_t msb = 63 - __builtin_clzll(x);
+    const uint32_t fraction = (msb >= 8 ? x >> (msb - 8) : x << (8 - msb)) & 0xFF;
+    return msb << 8 | fraction;
+}
+
+// Write a profile's instructions run per address as a 64x64 grayscale PGM image
+bool write_heatmap(const profile_t *profile, const char path[]) {
+    counts_t *counts = malloc(sizeof *counts);
+    if (!counts) return false;
+    count_profile(profile, counts);
+
+    uint64_t max = 1;
+    for (uint16_t address = 0; address < 4096; address++)
+        if (counts->pc[address] > max) max = counts->pc[address];
+
+    // Addresses run at all are at least 1, so they stand out from the ones never run
+    uint8_t pixels[4096];
+    const uint32_t range = log2_fixed(max) ? log2_fixed(max) : 1;
+    for (uint16_t address = 0; address < 4096; address++)
+        pixels[address] = counts->pc[address] ? 1 + 254 * log2_fixed(counts->pc[address]) / range : 0;
+    free(counts);
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not open heatmap %s for writing\n", path);
+        return false;
+    }
+
+    fprintf(file, "P5\n64 64\n255\n");
+    fwrite(pixels, sizeof pixels, 1, file);
+    if (ferror(file) | (fclose(file) != 0)) {
+        fprintf(stderr, "Could not write heatmap %s\n", path);
+        return false;
+    }
+
+    return true;    // Success
+}
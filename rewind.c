@@ -0,0 +1,242 @@
+#include "chip8.h"
+
+// Rewind history
+//   Machine state is pushed once per frame into a fixed size byte ring. Every REWIND_KEY_INTERVAL
+//   frames the state is stored whole as a keyframe; the frames in between are stored as the XOR
+//   of their state with that keyframe, which is almost all zero bytes (a few registers, the odd
+//   RAM/display byte), run length encoded. Each record is then only as big as what changed since
+//   its keyframe, typically a few dozen bytes, so minutes of frames fit in a few MB.
+//   When the ring is full the oldest keyframe is dropped along with the frames that refer to it.
+//
+// Record layout in the ring, at any byte position (records wrap around the end):
+//   record_header_t, RLE payload, uint32_t record size again so the ring can be walked backwards
+//
+// RLE payload: control byte c, then
+//   c < 0x80: c+1 zero bytes
+//   c >= 0x80: (c & 0x7F)+1 literal bytes follow
+
+#define REWIND_KEY_INTERVAL 60  // 1 keyframe per second of frames
+#define RLE_MAX_RUN 128
+
+// Longest possible record: header, all literal payload, trailer
+#define RLE_MAX_SIZE (sizeof(chip8_state_t) + (sizeof(chip8_state_t) + RLE_MAX_RUN - 1) / RLE_MAX_RUN)
+#define RECORD_MAX_SIZE (sizeof(record_header_t) + RLE_MAX_SIZE + sizeof(uint32_t))
+
+typedef struct {
+    uint32_t size;      // Whole record, header to trailer
+    uint32_t key;       // 1 if this is a keyframe
+    uint64_t key_pos;   // Ring position of the keyframe this record is a delta of (itself if key)
+} record_header_t;
+
+static const chip8_state_t zero_state;  // What keyframes are stored as a delta of
+
+struct rewind {
+    uint8_t *ring;
+    uint64_t size;          // Bytes in the ring
+    uint64_t head;          // Position the next record is written at; positions only ever grow
+    uint64_t tail;          // Position of the oldest record
+    uint32_t frames;        // Records in the ring
+
+    chip8_state_t key;      // Decoded keyframe at key_pos
+    uint64_t key_pos;       // UINT64_MAX = none, the next push is a keyframe
+    uint32_t since_key;     // Records pushed since the keyframe
+
+    chip8_state_t state;                // Scratch state being encoded/decoded
+    chip8_state_t delta;                // Scratch state XOR keyframe
+    uint8_t record[RECORD_MAX_SIZE];    // Scratch record, unwrapped
+};
+
+// Copy bytes into/out of the ring at an absolute position, wrapping around its end
+static void ring_write(rewind_t *history, const uint64_t pos, const void *data, const uint32_t length) {
+    const uint64_t at = pos % history->size;
+    const uint64_t first = (history->size - at < length) ? history->size - at : length;
+    memcpy(&history->ring[at], data, first);
+    memcpy(history->ring, (const uint8_t *)data + first, length - first);
+}
+
+static void ring_read(const rewind_t *history, const uint64_t pos, void *data, const uint32_t length) {
+    const uint64_t at = pos % history->size;
+    const uint64_t first = (history->size - at < length) ? history->size - at : length;
+    memcpy(data, &history->ring[at], first);
+    memcpy((uint8_t *)data + first, history->ring, length - first);
+}
+
+// XOR a state with its keyframe (zeros for a keyframe itself), 8 bytes at a time
+static void xor_state(const chip8_state_t *a, const chip8_state_t *b, chip8_state_t *out) {
+    for (uint32_t i = 0; i < sizeof(chip8_state_t); i += 8) {
+        uint64_t x, y;
+        memcpy(&x, (const uint8_t *)a + i, 8);
+        memcpy(&y, (const uint8_t *)b + i, 8);
+        x ^= y;
+        memcpy((uint8_t *)out + i, &x, 8);
+    }
+}
+
+// Run length encode a delta, returns payload bytes written to out
+static uint32_t rle_encode(const uint8_t *delta, uint8_t *out) {
+    uint32_t length = 0;
+
+    for (uint32_t i = 0; i < sizeof(chip8_state_t); ) {
+        const uint32_t max = (sizeof(chip8_state_t) - i < RLE_MAX_RUN) ? sizeof(chip8_state_t) - i : RLE_MAX_RUN;
+        uint32_t run = 0;
+
+        if (delta[i] == 0) {
+            // Zero runs 8 bytes at a time while they last
+            uint64_t word;
+            while (run + 8 <= max && (memcpy(&word, &delta[i+run], 8), word == 0)) run += 8;
+            while (run < max && delta[i+run] == 0) run++;
+            out[length++] = run - 1;
+        } else {
+            // Literals up to the next pair of zero bytes; a single zero is cheaper kept as a literal
+            uint8_t *control = &out[length++];
+            while (run < max && !(delta[i+run] == 0 && run + 1 < max && delta[i+run+1] == 0))
+                out[length++] = delta[i + run++];
+            *control = 0x80 | (run - 1);
+        }
+
+        i += run;
+    }
+
+    return length;
+}
+
+// Undo rle_encode, XORing the delta back onto base
+static void rle_decode(const uint8_t *in, const uint8_t *base, uint8_t *state) {
+    for (uint32_t i = 0; i < sizeof(chip8_state_t); ) {
+        const uint8_t control = *in++;
+        const uint32_t run = (control & 0x7F) + 1;
+
+        if (control & 0x80) {
+            for (uint32_t j = 0; j < run; j++, i++) state[i] = base[i] ^ *in++;
+        } else {
+            memcpy(&state[i], &base[i], run);
+            i += run;
+        }
+    }
+}
+
+// Decode the record at a ring position into history->state; its keyframe must be history->key
+//   unless it is a keyframe itself. Returns its header
+static record_header_t read_record(rewind_t *history, const uint64_t pos) {
+    record_header_t header;
+    ring_read(history, pos, &header, sizeof header);
+    ring_read(history, pos, history->record, header.size);
+
+    rle_decode(history->record + sizeof header,
+               (const uint8_t *)(header.key ? &zero_state : &history->key), (uint8_t *)&history->state);
+    return header;
+}
+
+// Drop the oldest keyframe and every record that refers to it
+static void drop_oldest(rewind_t *history) {
+    record_header_t header;
+    const uint64_t key_pos = history->tail;
+
+    do {
+        ring_read(history, history->tail, &header, sizeof header);
+        history->tail += header.size;
+        history->frames--;
+        if (history->tail == history->head) break;
+        ring_read(history, history->tail, &header, sizeof header);
+    } while (header.key_pos == key_pos);
+
+    if (history->key_pos == key_pos) history->key_pos = UINT64_MAX;   // Encoding against it no more
+}
+
+// Create a rewind history of the given size in bytes, NULL on error
+rewind_t *rewind_create(const size_t size) {
+    if (size < RECORD_MAX_SIZE * 2) {
+        fprintf(stderr, "Rewind buffer of %zu bytes is too small\n", size);
+        return NULL;
+    }
+
+    rewind_t *history = calloc(1, sizeof *history);
+    if (!history) return NULL;
+
+    history->ring = malloc(size);
+    if (!history->ring) {
+        free(history);
+        return NULL;
+    }
+
+    history->size = size;
+    history->key_pos = UINT64_MAX;
+    return history;
+}
+
+void rewind_destroy(rewind_t *history) {
+    if (!history) return;
+
+    free(history->ring);
+    free(history);
+}
+
+// Push a machine's current state as the newest frame
+void rewind_push(rewind_t *history, const chip8_t *chip8) {
+    snapshot_chip8(chip8, &history->state);
+
+    const bool key = (history->key_pos == UINT64_MAX || history->since_key >= REWIND_KEY_INTERVAL);
+    record_header_t header = {
+        .key = key,
+        .key_pos = key ? history->head : history->key_pos,
+    };
+
+    xor_state(&history->state, key ? &zero_state : &history->key, &history->delta);
+    const uint32_t payload = rle_encode((const uint8_t *)&history->delta, history->record + sizeof header);
+    header.size = sizeof header + payload + sizeof header.size;
+    memcpy(history->record, &header, sizeof header);
+    memcpy(history->record + sizeof header + payload, &header.size, sizeof header.size);
+
+    // Make room, oldest first; dropping the keyframe being encoded against makes this 1 a keyframe
+    while (history->head - history->tail + header.size > history->size) {
+        drop_oldest(history);
+        if (history->key_pos == UINT64_MAX && !key) {
+            rewind_push(history, chip8);
+            return;
+        }
+    }
+
+    ring_write(history, history->head, history->record, header.size);
+    if (key) {
+        history->key = history->state;
+        history->key_pos = history->head;
+        history->since_key = 0;
+    }
+    history->since_key++;
+    history->head += header.size;
+    history->frames++;
+}
+
+// Take the newest frame off the history and put the machine back in it; false if there is none
+bool rewind_pop(rewind_t *history, chip8_t *chip8) {
+    if (history->frames == 0) return false;
+
+    uint32_t size;
+    ring_read(history, history->head - sizeof size, &size, sizeof size);
+    const uint64_t pos = history->head - size;
+
+    // Frames before the current keyframe (after popping it) refer to an older one, decode that first
+    record_header_t header;
+    ring_read(history, pos, &header, sizeof header);
+    if (!header.key && header.key_pos != history->key_pos) {
+        read_record(history, header.key_pos);
+        history->key = history->state;
+        history->key_pos = header.key_pos;
+    }
+
+    read_record(history, pos);
+    restore_chip8(chip8, &history->state);
+
+    history->head = pos;
+    history->frames--;
+    if (header.key) history->key_pos = UINT64_MAX;   // Gone, the next push starts a new keyframe
+    else if (history->since_key) history->since_key--;
+
+    return true;    // Success
+}
+
+// Frames in the history, and bytes they take up
+uint32_t rewind_frames(const rewind_t *history, size_t *bytes) {
+    if (bytes) *bytes = history->head - history->tail;
+    return history->frames;
+}
@@ -0,0 +1,211 @@
+#define _DEFAULT_SOURCE     // mmap()
+#include <stddef.h>
+
+#include "chip8.h"
+
+#if defined(__unix__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Save states
+//   A snapshot is a chip8_state_t, the machine minus its pointers and host side caches. Taking one
+//   is a few KB of memcpy; restoring one compares RAM block by block and only writes (and
+//   invalidates predecoded/compiled code for) what differs, so a fuzzer or search going back to
+//   the same checkpoint over and over keeps its caches warm and never touches the ROM file.
+//
+// Save state file format: a 64 byte header, then the chip8_state_t exactly as in memory, so the
+//   state can be used straight from a read only memory map of the file. Files are only read back
+//   on hosts with the same byte order and a matching version/layout.
+
+#define STATE_FILE_VERSION 1
+
+typedef struct {
+    char magic[4];          // "C8ST"
+    uint16_t version;       // STATE_FILE_VERSION
+    uint16_t byte_order;    // 0x0102 as written by the saving host
+    uint32_t header_size;   // sizeof(state_file_header_t), the state follows right after
+    uint32_t state_size;    // sizeof(chip8_state_t)
+    uint8_t reserved[48];   // Zero
+} state_file_header_t;
+
+_Static_assert(sizeof(state_file_header_t) == 64, "save state header is 64 bytes");
+
+static const state_file_header_t state_file_header = {
+    .magic = { 'C', '8', 'S', 'T' },
+    .version = STATE_FILE_VERSION,
+    .byte_order = 0x0102,
+    .header_size = sizeof(state_file_header_t),
+    .state_size = sizeof(chip8_state_t),
+};
+
+// Copy a machine's state out
+void snapshot_chip8(const chip8_t *chip8, chip8_state_t *state) {
+    memcpy(state->ram, chip8->ram, sizeof state->ram);
+    memcpy(state->display, chip8->display, sizeof state->display);
+    state->ticks = chip8->ticks;
+    state->delay_end = chip8->delay_end;
+    state->sound_end = chip8->sound_end;
+    memcpy(state->stack, chip8->stack, sizeof state->stack);
+    state->I = chip8->I;
+    state->PC = chip8->PC;
+    memcpy(state->V, chip8->V, sizeof state->V);
+
+    state->keypad = 0;
+    for (uint8_t i = 0; i < 16; i++) state->keypad |= (uint16_t)chip8->keypad[i] << i;
+
+    state->stack_depth = chip8->stack_ptr - chip8->stack;
+    state->wait_key = chip8->wait_key;
+    state->rng = chip8->rng;
+    state->state = chip8->state;
+    memset(state->reserved, 0, sizeof state->reserved);
+}
+
+// Put a machine back in a snapshotted state
+void restore_chip8(chip8_t *chip8, const chip8_state_t *state) {
+    // RAM 64 bytes at a time, then 8 bytes (4 predecoded instructions) at a time within a block
+    //   that differs, dropping cached code only where it changed
+    for (uint16_t block = 0; block < sizeof chip8->ram; block += 64) {
+        if (memcmp(&chip8->ram[block], &state->ram[block], 64) == 0) continue;
+
+        for (uint16_t a = block; a < block + 64; a += 8) {
+            if (memcmp(&chip8->ram[a], &state->ram[a], 8) == 0) continue;
+
+            memcpy(&chip8->ram[a], &state->ram[a], 8);
+            for (uint16_t i = a / 2; i < a / 2 + 4; i++) chip8->icache[i].op = OP_DECODE;
+            jit_invalidate(chip8, a, 8);
+        }
+    }
+
+    memcpy(chip8->display, state->display, sizeof chip8->display);
+    chip8->ticks = state->ticks;
+    chip8->delay_end = state->delay_end;
+    chip8->sound_end = state->sound_end;
+    memcpy(chip8->stack, state->stack, sizeof chip8->stack);
+    chip8->I = state->I;
+    chip8->PC = state->PC;
+    memcpy(chip8->V, state->V, sizeof chip8->V);
+
+    for (uint8_t i = 0; i < 16; i++) chip8->keypad[i] = (state->keypad >> i) & 1;
+
+    chip8->stack_ptr = &chip8->stack[state->stack_depth % STACK_SIZE];
+    chip8->wait_key = state->wait_key;
+    chip8->rng = state->rng;
+    chip8->state = state->state;
+
+    // Whole screen may have changed, and nothing seen before the restore says anything about after
+    chip8->dirty_rows = UINT32_MAX;
+    chip8->draw = true;
+    chip8->effects++;
+    chip8->idle.regs = UINT64_MAX;
+}
+
+// Write a snapshot to a save state file
+bool save_state_file(const chip8_state_t *state, const char path[]) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not open save state file %s for writing\n", path);
+        return false;
+    }
+
+    const bool ok = fwrite(&state_file_header, sizeof state_file_header, 1, file) == 1 &&
+                    fwrite(state, sizeof *state, 1, file) == 1;
+    if (fclose(file) != 0 || !ok) {
+        fprintf(stderr, "Could not write save state file %s\n", path);
+        return false;
+    }
+
+    return true;    // Success
+}
+
+// Is a save state file header one this build can use
+static bool check_state_header(const state_file_header_t *header, const char path[]) {
+    if (memcmp(header->magic, state_file_header.magic, sizeof header->magic) != 0) {
+        fprintf(stderr, "%s is not a save state file\n", path);
+        return false;
+    }
+
+    if (header->byte_order != state_file_header.byte_order ||
+        header->version != STATE_FILE_VERSION ||
+        header->header_size != sizeof(state_file_header_t) ||
+        header->state_size != sizeof(chip8_state_t)) {
+        fprintf(stderr, "Save state file %s was written by an incompatible version or host\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+#define STATE_FILE_SIZE (sizeof(state_file_header_t) + sizeof(chip8_state_t))
+
+#if defined(__unix__)
+// Memory map a save state file read only
+const chip8_state_t *map_state_file(const char path[]) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Save state file %s is invalid or does not exist\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != STATE_FILE_SIZE) {
+        fprintf(stderr, "Save state file %s has the wrong size\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, STATE_FILE_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // Mapping stays valid
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Could not map save state file %s\n", path);
+        return NULL;
+    }
+
+    if (!check_state_header(map, path)) {
+        munmap(map, STATE_FILE_SIZE);
+        return NULL;
+    }
+
+    return (const chip8_state_t *)((const uint8_t *)map + sizeof(state_file_header_t));
+}
+
+void unmap_state_file(const chip8_state_t *state) {
+    munmap((uint8_t *)state - sizeof(state_file_header_t), STATE_FILE_SIZE);
+}
+#else
+// No mmap on this host, read the file into memory instead
+const chip8_state_t *map_state_file(const char path[]) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Save state file %s is invalid or does not exist\n", path);
+        return NULL;
+    }
+
+    uint8_t *data = malloc(STATE_FILE_SIZE);
+    const bool ok = data && fread(data, STATE_FILE_SIZE, 1, file) == 1 && fgetc(file) == EOF;
+    fclose(file);
+    if (!ok || !check_state_header((const state_file_header_t *)data, path)) {
+        if (data && !ok) fprintf(stderr, "Save state file %s has the wrong size\n", path);
+        free(data);
+        return NULL;
+    }
+
+    return (const chip8_state_t *)(data + sizeof(state_file_header_t));
+}
+
+void unmap_state_file(const chip8_state_t *state) {
+    free((uint8_t *)state - sizeof(state_file_header_t));
+}
+#endif
+
+// Restore a machine from a save state file
+bool load_state_file(chip8_t *chip8, const char path[]) {
+    const chip8_state_t *state = map_state_file(path);
+    if (!state) return false;
+
+    restore_chip8(chip8, state);
+    unmap_state_file(state);
+    return true;    // Success
+}
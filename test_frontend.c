@@ -0,0 +1,254 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include "chip8.h"
+
+// Frontend handover tests, no SDL needed
+//   Checks the lock-free structures the SDL frontend's threads share: the frame triple buffer
+//   between the emulation and render threads, and the sound queue between the emulation thread and
+//   the audio callback, first on their own and then with both ends on their own threads. Prints
+//   each failed check and exits nonzero if any failed.
+
+#define THREADED_FRAMES 200000
+#define THREADED_SOUNDS 100000
+
+// Audio test device: the host clock runs at the sample rate so 1 tick is 1 sample, and the square
+//   wave is 4 samples high then 4 low. Events are rendered AUDIO_DELAY samples after they happen
+#define AUDIO_RATE 8000
+#define AUDIO_BUFFER 64
+#define AUDIO_DELAY (AUDIO_BUFFER * 5 / 4)
+#define AUDIO_VOLUME 1000
+
+static uint32_t checks = 0;
+static uint32_t failures = 0;
+
+#define CHECK(condition) do { \
+        checks++; \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+// Display of frame n: every row holds n, and its row number so rows can't be mixed up
+static void fill_display(uint64_t display[32], const uint64_t n) {
+    for (uint32_t row = 0; row < 32; row++) display[row] = n << 5 | row;
+}
+
+// Which frame a display is, UINT64_MAX if its rows come from more than 1 frame (torn)
+static uint64_t display_frame(const uint64_t display[32]) {
+    for (uint32_t row = 0; row < 32; row++)
+        if (display[row] != (display[0] >> 5 << 5 | row)) return UINT64_MAX;
+    return display[0] >> 5;
+}
+
+static void test_frames(void) {
+    frames_t frames;
+    frames_init(&frames);
+    uint64_t display[32] = {0};
+    uint64_t screen[32] = {0};
+
+    // Nothing published yet
+    CHECK(!frames_pending(&frames));
+    CHECK(frames_take(&frames, screen) == 0);
+
+    // The first frame wakes the render thread, frames published before it takes one don't,
+    //   and it takes only the newest
+    fill_display(display, 1);
+    CHECK(frames_publish(&frames, display));
+    CHECK(frames_pending(&frames));
+    fill_display(display, 2);
+    CHECK(!frames_publish(&frames, display));
+    CHECK(frames_take(&frames, screen) == UINT32_MAX);
+    CHECK(display_frame(screen) == 2);
+    CHECK(!frames_pending(&frames));
+    CHECK(frames_take(&frames, screen) == 0);
+
+    // Taking a frame reports only the rows that changed
+    CHECK(frames_publish(&frames, display));
+    CHECK(frames_take(&frames, screen) == 0);
+    display[5] ^= 1ull << 63;
+    display[31] ^= 1;
+    CHECK(frames_publish(&frames, display));
+    CHECK(frames_take(&frames, screen) == (1u << 5 | 1u << 31));
+    CHECK(memcmp(screen, display, sizeof screen) == 0);
+
+    // Every frame cycles through all 3 buffers without ever handing out the one being written
+    for (uint64_t n = 3; n < 12; n++) {
+        fill_display(display, n);
+        frames_publish(&frames, display);
+        CHECK(frames.back != frames.front);
+        CHECK(frames.back != (atomic_load(&frames.middle) & 3));
+        if (n % 2) {
+            frames_take(&frames, screen);
+            CHECK(display_frame(screen) == n);
+        }
+    }
+}
+
+// Emulation thread stand in: publishes frames 1 to THREADED_FRAMES as fast as it can
+static void *publish_frames(void *data) {
+    frames_t *frames = data;
+    uint64_t display[32];
+    for (uint64_t n = 1; n <= THREADED_FRAMES; n++) {
+        fill_display(display, n);
+        frames_publish(frames, display);
+        if (n % 64 == 0) sched_yield();
+    }
+    return NULL;
+}
+
+static void test_frames_threaded(void) {
+    frames_t frames;
+    frames_init(&frames);
+
+    pthread_t producer;
+    if (pthread_create(&producer, NULL, publish_frames, &frames) != 0) {
+        fprintf(stderr, "Could not start producer thread\n");
+        failures++;
+        return;
+    }
+
+    // Render thread: every frame taken is whole and newer than the last, down to the last one
+    uint64_t screen[32] = {0};
+    uint64_t last = 0;
+    uint32_t torn = 0, backwards = 0, taken = 0;
+    while (last < THREADED_FRAMES) {
+        if (!frames_take(&frames, screen)) {
+            sched_yield();
+            continue;
+        }
+
+        const uint64_t n = display_frame(screen);
+        if (n == UINT64_MAX) torn++;
+        else if (n <= last) backwards++;
+        else last = n;
+        taken++;
+    }
+    pthread_join(producer, NULL);
+
+    CHECK(torn == 0);
+    CHECK(backwards == 0);
+    CHECK(taken > 0);
+    CHECK(!frames_pending(&frames));
+    printf("frames: %u of %u taken, the rest skipped\n", taken, THREADED_FRAMES);
+}
+
+// Render buffers of audio back to back from host clock time start on, into samples
+static void render_buffers(audio_t *audio, int16_t *samples, const uint32_t buffers, const int64_t start) {
+    for (uint32_t n = 0; n < buffers; n++)
+        render_audio(audio, &samples[n * AUDIO_BUFFER], AUDIO_BUFFER, start + n * AUDIO_BUFFER);
+}
+
+static void test_audio(void) {
+    audio_t audio;
+
+    // The queue holds SOUND_QUEUE_SIZE changes until the audio callback consumes them
+    audio_init(&audio, AUDIO_RATE, AUDIO_RATE, AUDIO_BUFFER, AUDIO_RATE / 8, AUDIO_VOLUME);
+    bool queued = true;
+    for (uint32_t i = 0; i < SOUND_QUEUE_SIZE; i++) queued &= queue_sound(&audio, 0, i % 2);
+    CHECK(queued);
+    CHECK(!queue_sound(&audio, 0, true));
+
+    // The tone turns on and off at the sample each change happened at plus the delay, fading in
+    //   and out over SOUND_RAMP_SAMPLES, and is silent otherwise
+    const int64_t start = 1000;
+    const int32_t on = 10 + AUDIO_DELAY, off = 200 + AUDIO_DELAY;
+    int16_t samples[6 * AUDIO_BUFFER];
+    audio_init(&audio, AUDIO_RATE, AUDIO_RATE, AUDIO_BUFFER, AUDIO_RATE / 8, AUDIO_VOLUME);
+    CHECK(queue_sound(&audio, start + 10, true));
+    CHECK(queue_sound(&audio, start + 200, false));
+    render_buffers(&audio, samples, 6, start);
+
+    uint32_t silent = 0, ramp = 0, full = 0, wave = 0;
+    for (int32_t i = 0; i < 6 * AUDIO_BUFFER; i++) {
+        int32_t gain = 0;
+        if (i >= off) gain = SOUND_RAMP_SAMPLES - (i - off + 1);
+        else if (i >= on) gain = i - on + 1;
+        if (gain < 0) gain = 0;
+        if (gain > SOUND_RAMP_SAMPLES) gain = SOUND_RAMP_SAMPLES;
+
+        const int32_t expected = ((i % 8) < 4 ? AUDIO_VOLUME : -AUDIO_VOLUME) * gain / SOUND_RAMP_SAMPLES;
+        if (samples[i] != expected) {
+            if (!gain) silent++;
+            else if (gain < SOUND_RAMP_SAMPLES) ramp++;
+            else full++;
+        }
+        if (gain == SOUND_RAMP_SAMPLES && (samples[i] > 0) != ((i % 8) < 4)) wave++;
+    }
+    CHECK(silent == 0);
+    CHECK(ramp == 0);
+    CHECK(full == 0);
+    CHECK(wave == 0);
+    CHECK(samples[on - 1] == 0 && samples[on] != 0);
+    CHECK(samples[on + SOUND_RAMP_SAMPLES - 1] == AUDIO_VOLUME * ((on + SOUND_RAMP_SAMPLES - 1) % 8 < 4 ? 1 : -1));
+    CHECK(atomic_load(&audio.tail) == atomic_load(&audio.head));
+
+    // A change already due when the callback gets to it is rendered at the start of the buffer
+    CHECK(queue_sound(&audio, start, true));
+    render_audio(&audio, samples, AUDIO_BUFFER, start + 6 * AUDIO_BUFFER);
+    CHECK(samples[0] != 0);
+    CHECK(atomic_load(&audio.tail) == atomic_load(&audio.head));
+
+    // Volume changes take effect from the next buffer on
+    atomic_store(&audio.volume, AUDIO_VOLUME / 2);
+    render_audio(&audio, samples, AUDIO_BUFFER, start + 7 * AUDIO_BUFFER);
+    CHECK(samples[0] == AUDIO_VOLUME / 2 || samples[0] == -AUDIO_VOLUME / 2);
+
+    // Falling far behind or ahead of the host clock starts the sample clock over from it, so a
+    //   change is still rendered its delay after it happened
+    const int64_t later = start + 10 * AUDIO_RATE;
+    CHECK(queue_sound(&audio, later + 20, false));
+    render_buffers(&audio, samples, 3, later);
+    CHECK(samples[20 + AUDIO_DELAY - 1] != 0);
+    CHECK(samples[20 + AUDIO_DELAY + SOUND_RAMP_SAMPLES - 1] == 0);
+}
+
+// Emulation thread stand in: queues THREADED_SOUNDS changes, alternating on and off, waiting
+//   whenever the queue is full
+static void *queue_sounds(void *data) {
+    audio_t *audio = data;
+    for (uint32_t n = 0; n < THREADED_SOUNDS; n++)
+        while (!queue_sound(audio, n, n % 2 == 0)) sched_yield();
+    return NULL;
+}
+
+static void test_audio_threaded(void) {
+    audio_t audio;
+    audio_init(&audio, AUDIO_RATE, AUDIO_RATE, AUDIO_BUFFER, AUDIO_RATE / 8, AUDIO_VOLUME);
+
+    pthread_t producer;
+    if (pthread_create(&producer, NULL, queue_sounds, &audio) != 0) {
+        fprintf(stderr, "Could not start producer thread\n");
+        failures++;
+        return;
+    }
+
+    // Audio callback: the clock runs well ahead of the changes' times, so each buffer consumes
+    //   every change queued so far, and none may be lost or left behind
+    int16_t samples[AUDIO_BUFFER];
+    int64_t now = 1;
+    uint32_t buffers = 0;
+    while (atomic_load(&audio.tail) < THREADED_SOUNDS) {
+        render_audio(&audio, samples, AUDIO_BUFFER, now);
+        now += AUDIO_BUFFER;
+        buffers++;
+        sched_yield();
+    }
+    pthread_join(producer, NULL);
+
+    CHECK(atomic_load(&audio.tail) == THREADED_SOUNDS);
+    CHECK(atomic_load(&audio.head) == THREADED_SOUNDS);
+    CHECK(!audio.on);
+    printf("audio: %u changes in %u buffers\n", THREADED_SOUNDS, buffers);
+}
+
+int main(void) {
+    test_frames();
+    test_frames_threaded();
+    test_audio();
+    test_audio_threaded();
+
+    printf("%u checks, %u failed\n", checks, failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,421 @@
+#define _DEFAULT_SOURCE     // sigaction()
+#include "chip8.h"
+
+#if defined(__unix__)
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+// Instruction tracing
+//   While chip8->trace is set, the interpreter runs its instrumented twin, which writes a 16 byte
+//   record per instruction into a power of 2 sized ring: no formatting, no I/O, just a store, so a
+//   whole run can be traced at close to full speed and the last N instructions kept for a post
+//   mortem. The ring is dumped to a trace file on demand, at exit or from a fatal signal handler,
+//   and decoded offline (trace_decode.c) into the same descriptions the old printf per instruction
+//   debug output gave.
+//
+// Trace file format: a 64 byte header, then count trace_record_t exactly as in memory, oldest
+//   first. Files are only read back on hosts with the same byte order and record layout.
+
+#define TRACE_FILE_VERSION 1
+
+typedef struct {
+    char magic[4];          // "C8TR"
+    uint16_t version;       // TRACE_FILE_VERSION
+    uint16_t byte_order;    // 0x0102 as written by the tracing host
+    uint32_t record_size;   // sizeof(trace_record_t)
+    uint32_t reserved0;     // Zero
+    uint64_t count;         // Records that follow
+    uint64_t first;         // Instructions traced before the first of them, i.e. dropped from the ring
+    uint8_t reserved[32];   // Zero
+} trace_file_header_t;
+
+_Static_assert(sizeof(trace_file_header_t) == 64, "trace file header is 64 bytes");
+
+// Create a trace ring keeping at least the newest records instructions, NULL on error
+trace_t *trace_create(const uint64_t records) {
+    uint64_t size = 1;
+    while (size < records) size <<= 1;
+
+    trace_t *trace = calloc(1, sizeof *trace);
+    if (!trace) return NULL;
+
+    trace->records = calloc(size, sizeof *trace->records);
+    if (!trace->records) {
+        fprintf(stderr, "Could not allocate a trace of %llu instructions\n", (long long unsigned)size);
+        free(trace);
+        return NULL;
+    }
+
+    trace->mask = size - 1;
+    return trace;
+}
+
+void trace_destroy(trace_t *trace) {
+    if (!trace) return;
+
+    free(trace->records);
+    free(trace);
+}
+
+// Header for a dump of a trace; the records in it are oldest first from records[first & mask]
+static trace_file_header_t trace_header(const trace_t *trace) {
+    const uint64_t count = (trace->head <= trace->mask) ? trace->head : trace->mask + 1;
+
+    return (trace_file_header_t){
+        .magic = { 'C', '8', 'T', 'R' },
+        .version = TRACE_FILE_VERSION,
+        .byte_order = 0x0102,
+        .record_size = sizeof(trace_record_t),
+        .count = count,
+        .first = trace->head - count,
+    };
+}
+
+// Write a trace's records to a trace file, oldest first
+bool trace_dump(const trace_t *trace, const char path[]) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not open trace file %s for writing\n", path);
+        return false;
+    }
+
+    // Oldest records run to the end of the ring, the rest wrap around from its start
+    const trace_file_header_t header = trace_header(trace);
+    const uint64_t start = header.first & trace->mask;
+    const uint64_t to_end = (header.count < trace->mask + 1 - start) ? header.count : trace->mask + 1 - start;
+
+    bool ok = fwrite(&header, sizeof header, 1, file) == 1;
+    ok = ok && fwrite(&trace->records[start], sizeof(trace_record_t), to_end, file) == to_end;
+    ok = ok && fwrite(trace->records, sizeof(trace_record_t), header.count - to_end, file) == header.count - to_end;
+    if (fclose(file) != 0 || !ok) {
+        fprintf(stderr, "Could not write trace file %s\n", path);
+        return false;
+    }
+
+    return true;    // Success
+}
+
+#if defined(__unix__)
+// Trace dumped by the fatal signal handler, only ever set from the thread it traces
+static const trace_t *crash_trace;
+static const char *crash_path;
+
+// Write all of a buffer to a file descriptor; async signal safe
+static bool write_all(const int fd, const void *data, size_t length) {
+    for (const uint8_t *bytes = data; length; ) {
+        const ssize_t written = write(fd, bytes, length);
+        if (written <= 0) return false;
+        bytes += written;
+        length -= written;
+    }
+
+    return true;
+}
+
+// Fatal signal: dump the trace with only async signal safe calls, then die of the signal as usual
+static void dump_on_signal(const int signal_number) {
+    const trace_t *trace = crash_trace;
+    const int fd = trace ? open(crash_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+
+    if (fd >= 0) {
+        const trace_file_header_t header = trace_header(trace);
+        const uint64_t start = header.first & trace->mask;
+        const uint64_t to_end = (header.count < trace->mask + 1 - start) ? header.count : trace->mask + 1 - start;
+
+        if (write_all(fd, &header, sizeof header) &&
+            write_all(fd, &trace->records[start], to_end * sizeof(trace_record_t)))
+            write_all(fd, trace->records, (header.count - to_end) * sizeof(trace_record_t));
+        close(fd);
+    }
+
+    raise(signal_number);   // Handler was reset to the default one on entry
+}
+
+// Dump a trace to path if the process crashes (fatal signal), NULL trace to stop
+void trace_dump_on_crash(const trace_t *trace, const char path[]) {
+    static const int fatal_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+    struct sigaction action = {
+        .sa_handler = trace ? dump_on_signal : SIG_DFL,
+        .sa_flags = SA_RESETHAND,
+    };
+    sigemptyset(&action.sa_mask);
+
+    crash_trace = trace;
+    crash_path = path;
+    for (uint8_t i = 0; i < sizeof fatal_signals / sizeof fatal_signals[0]; i++)
+        sigaction(fatal_signals[i], &action, NULL);
+}
+#else
+// No signals to catch crashes with on this host; traces are still dumped on demand and at exit
+void trace_dump_on_crash(const trace_t *trace, const char path[]) {
+    (void)trace; (void)path;
+}
+#endif
+
+// Read all records of a trace file, NULL on error
+trace_record_t *read_trace_file(const char path[], uint64_t *count, uint64_t *first) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Trace file %s is invalid or does not exist\n", path);
+        return NULL;
+    }
+
+    trace_file_header_t header;
+    if (fread(&header, sizeof header, 1, file) != 1 || memcmp(header.magic, "C8TR", sizeof header.magic) != 0) {
+        fprintf(stderr, "%s is not a trace file\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    if (header.version != TRACE_FILE_VERSION || header.byte_order != 0x0102 ||
+        header.record_size != sizeof(trace_record_t)) {
+        fprintf(stderr, "Trace file %s was written by an incompatible version or host\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    trace_record_t *records = malloc((header.count ? header.count : 1) * sizeof *records);
+    if (!records || fread(records, sizeof *records, header.count, file) != header.count) {
+        fprintf(stderr, "Trace file %s is cut short\n", path);
+        free(records);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    *count = header.count;
+    *first = header.first;
+    return records;
+}
+
+// Print what a traced instruction did, in the words of the old per instruction debug output;
+//   values it showed from after the instruction ran come from the next record, where needed
+void describe_instruction(FILE *out, const trace_record_t *record, const trace_record_t *next) {
+    const uint16_t NNN = record->opcode & 0x0FFF;
+    const uint8_t NN = record->opcode & 0x0FF;
+    const uint8_t N = record->opcode & 0x0F;
+    const uint8_t X = (record->opcode >> 8) & 0x0F;
+    const uint8_t Y = (record->opcode >> 4) & 0x0F;
+    const uint8_t VX = record->VX;
+    const uint8_t VY = record->VY;
+    const uint16_t I = record->I;
+
+    fprintf(out, "Address: 0x%04X, Opcode: 0x%04X Desc: ", record->PC, record->opcode);
+
+    switch ((record->opcode >> 12) & 0x0F) {
+        case 0x00:
+            if (NN == 0xE0) {
+                // 0x00E0: Clear the screen
+                fprintf(out, "Clear screen\n");
+
+            } else if (NN == 0xEE) {
+                // 0x00EE: Return from subroutine; returned to where the next instruction ran
+                if (next) fprintf(out, "Return from subroutine to address 0x%04X\n", next->PC);
+                else fprintf(out, "Return from subroutine\n");
+            } else {
+                fprintf(out, "Unimplemented Opcode.\n");
+            }
+            break;
+
+        case 0x01:
+            // 0x1NNN: Jump to address NNN
+            fprintf(out, "Jump to address NNN (0x%04X)\n", NNN);
+            break;
+
+        case 0x02:
+            // 0x2NNN: Call subroutine at NNN
+            fprintf(out, "Call subroutine at NNN (0x%04X)\n", NNN);
+            break;
+
+        case 0x03:
+            // 0x3XNN: Check if VX == NN, if so, skip the next instruction
+            fprintf(out, "Check if V%X (0x%02X) == NN (0x%02X), skip next instruction if true\n", X, VX, NN);
+            break;
+
+        case 0x04:
+            // 0x4XNN: Check if VX != NN, if so, skip the next instruction
+            fprintf(out, "Check if V%X (0x%02X) != NN (0x%02X), skip next instruction if true\n", X, VX, NN);
+            break;
+
+        case 0x05:
+            // 0x5XY0: Check if VX == VY, if so, skip the next instruction
+            fprintf(out, "Check if V%X (0x%02X) == V%X (0x%02X), skip next instruction if true\n", X, VX, Y, VY);
+            break;
+
+        case 0x06:
+            // 0x6XNN: Set register VX to NN
+            fprintf(out, "Set register V%X = NN (0x%02X)\n", X, NN);
+            break;
+
+        case 0x07:
+            // 0x7XNN: Set register VX += NN
+            fprintf(out, "Set register V%X (0x%02X) += NN (0x%02X). Result: 0x%02X\n", X, VX, NN, record->result);
+            break;
+
+        case 0x08:
+            switch (N) {
+                case 0:
+                    // 0x8XY0: Set register VX = VY
+                    fprintf(out, "Set register V%X = V%X (0x%02X)\n", X, Y, VY);
+                    break;
+
+                case 1:
+                    // 0x8XY1: Set register VX |= VY
+                    fprintf(out, "Set register V%X (0x%02X) |= V%X (0x%02X); Result: 0x%02X\n",
+                            X, VX, Y, VY, record->result);
+                    break;
+
+                case 2:
+                    // 0x8XY2: Set register VX &= VY
+                    fprintf(out, "Set register V%X (0x%02X) &= V%X (0x%02X); Result: 0x%02X\n",
+                            X, VX, Y, VY, record->result);
+                    break;
+
+                case 3:
+                    // 0x8XY3: Set register VX ^= VY
+                    fprintf(out, "Set register V%X (0x%02X) ^= V%X (0x%02X); Result: 0x%02X\n",
+                            X, VX, Y, VY, record->result);
+                    break;
+
+                case 4:
+                    // 0x8XY4: Set register VX += VY, set VF to 1 if carry
+                    fprintf(out, "Set register V%X (0x%02X) += V%X (0x%02X), VF = 1 if carry; Result: 0x%02X, VF = %X\n",
+                            X, VX, Y, VY, record->result, record->VF);
+                    break;
+
+                case 5:
+                    // 0x8XY5: Set register VX -= VY, set VF to 1 if there is not a borrow (result is positive/0)
+                    fprintf(out, "Set register V%X (0x%02X) -= V%X (0x%02X), VF = 1 if no borrow; Result: 0x%02X, VF = %X\n",
+                            X, VX, Y, VY, record->result, record->VF);
+                    break;
+
+                case 6:
+                    // 0x8XY6: Set register VX >>= 1, store shifted off bit in VF
+                    fprintf(out, "Set register V%X (0x%02X) >>= 1, VF = shifted off bit (%X); Result: 0x%02X\n",
+                            X, VX, record->VF, record->result);
+                    break;
+
+                case 7:
+                    // 0x8XY7: Set register VX = VY - VX, set VF to 1 if there is not a borrow (result is positive/0)
+                    fprintf(out, "Set register V%X = V%X (0x%02X) - V%X (0x%02X), VF = 1 if no borrow; Result: 0x%02X, VF = %X\n",
+                            X, Y, VY, X, VX, record->result, record->VF);
+                    break;
+
+                case 0xE:
+                    // 0x8XYE: Set register VX <<= 1, store shifted off bit in VF
+                    fprintf(out, "Set register V%X (0x%02X) <<= 1, VF = shifted off bit (%X); Result: 0x%02X\n",
+                            X, VX, record->VF, record->result);
+                    break;
+
+                default:
+                    fprintf(out, "Unimplemented Opcode.\n");
+                    break;
+            }
+            break;
+
+        case 0x09:
+            // 0x9XY0: Check if VX != VY; Skip next instruction if so
+            fprintf(out, "Check if V%X (0x%02X) != V%X (0x%02X), skip next instruction if true\n", X, VX, Y, VY);
+            break;
+
+        case 0x0A:
+            // 0xANNN: Set index register I to NNN
+            fprintf(out, "Set I to NNN (0x%04X)\n", NNN);
+            break;
+
+        case 0x0B:
+            // 0xBNNN: Jump to V0 + NNN; jumped to where the next instruction ran
+            if (next)
+                fprintf(out, "Set PC to V0 (0x%02X) + NNN (0x%04X); Result PC = 0x%04X\n",
+                        (next->PC - NNN) & 0xFF, NNN, next->PC);
+            else
+                fprintf(out, "Set PC to V0 + NNN (0x%04X)\n", NNN);
+            break;
+
+        case 0x0C:
+            // 0xCXNN: Sets register VX = random byte & NN (bitwise AND)
+            fprintf(out, "Set V%X = random byte & NN (0x%02X)\n", X, NN);
+            break;
+
+        case 0x0D:
+            // 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I
+            fprintf(out, "Draw N (%u) height sprite at coords V%X (0x%02X), V%X (0x%02X) "
+                    "from memory location I (0x%04X). Set VF = 1 if any pixels are turned off.\n",
+                    N, X, VX, Y, VY, I);
+            break;
+
+        case 0x0E: {
+            // 0xEX9E/0xEXA1: Skip next instruction if key in VX is (not) pressed; whether it was
+            //   shows in whether the next instruction ran 4 bytes on instead of 2
+            const bool skipped = next && next->PC == (uint16_t)(record->PC + 4);
+            const char key[2] = { next ? '0' + (skipped == (NN == 0x9E)) : '?', '\0' };
+            if (NN == 0x9E)
+                fprintf(out, "Skip next instruction if key in V%X (0x%02X) is pressed; Keypad value: %s\n", X, VX, key);
+            else if (NN == 0xA1)
+                fprintf(out, "Skip next instruction if key in V%X (0x%02X) is not pressed; Keypad value: %s\n", X, VX, key);
+            else
+                fprintf(out, "Unimplemented Opcode.\n");
+            break;
+        }
+
+        case 0x0F:
+            switch (NN) {
+                case 0x0A:
+                    // 0xFX0A: VX = get_key(); Await until a keypress, and store in VX
+                    fprintf(out, "Await until a key is pressed; Store key in V%X\n", X);
+                    break;
+
+                case 0x1E:
+                    // 0xFX1E: I += VX; Add VX to register I. For non-Amiga CHIP8, does not affect VF
+                    fprintf(out, "I (0x%04X) += V%X (0x%02X); Result (I): 0x%04X\n", I, X, VX, I + VX);
+                    break;
+
+                case 0x07:
+                    // 0xFX07: VX = delay timer
+                    fprintf(out, "Set V%X = delay timer value (0x%02X)\n", X, record->result);
+                    break;
+
+                case 0x15:
+                    // 0xFX15: delay timer = VX
+                    fprintf(out, "Set delay timer value = V%X (0x%02X)\n", X, VX);
+                    break;
+
+                case 0x18:
+                    // 0xFX18: sound timer = VX
+                    fprintf(out, "Set sound timer value = V%X (0x%02X)\n", X, VX);
+                    break;
+
+                case 0x29:
+                    // 0xFX29: Set register I to sprite location in memory for character in VX (0x0-0xF)
+                    fprintf(out, "Set I to sprite location in memory for character in V%X (0x%02X). Result(VX*5) = (0x%02X)\n",
+                            X, VX, VX * 5);
+                    break;
+
+                case 0x33:
+                    // 0xFX33: Store BCD representation of VX at memory offset from I
+                    fprintf(out, "Store BCD representation of V%X (0x%02X) at memory from I (0x%04X)\n", X, VX, I);
+                    break;
+
+                case 0x55:
+                    // 0xFX55: Register dump V0-VX inclusive to memory offset from I
+                    fprintf(out, "Register dump V0-V%X (0x%02X) inclusive at memory from I (0x%04X)\n", X, VX, I);
+                    break;
+
+                case 0x65:
+                    // 0xFX65: Register load V0-VX inclusive from memory offset from I
+                    fprintf(out, "Register load V0-V%X (0x%02X) inclusive at memory from I (0x%04X)\n", X, VX, I);
+                    break;
+
+                default:
+                    fprintf(out, "Unimplemented Opcode.\n");
+                    break;
+            }
+            break;
+
+        default:
+            fprintf(out, "Unimplemented Opcode.\n");
+            break;  // Unimplemented or invalid opcode
+    }
+}
@@ -0,0 +1,34 @@
+#include "chip8.h"
+
+// Trace decoder: prints a trace file dumped by --trace/F6 one instruction a line, oldest first
+int main(int argc, char **argv) {
+    // Default Usage message for args
+    if (argc < 2) {
+       fprintf(stderr, "Usage: %s <trace_file> [--last N]\n", argv[0]);
+       exit(EXIT_FAILURE);
+    }
+
+    // Only the newest N records, e.g. the lead up to a crash
+    uint64_t last = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--last") == 0 && i + 1 < argc) {
+            last = strtoull(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint64_t count, first;
+    trace_record_t *records = read_trace_file(argv[1], &count, &first);
+    if (!records) exit(EXIT_FAILURE);
+
+    const uint64_t start = (last && last < count) ? count - last : 0;
+    for (uint64_t i = start; i < count; i++) {
+        printf("#%llu Tick: %u, Depth: %u, ", (long long unsigned)(first + i), records[i].tick, records[i].depth);
+        describe_instruction(stdout, &records[i], i + 1 < count ? &records[i + 1] : NULL);
+    }
+
+    free(records);
+    exit(EXIT_SUCCESS);
+}